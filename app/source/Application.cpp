@@ -1,4 +1,6 @@
+#include <glob.h>
 #include <string.h>
+#include <fstream>
 
 #include "Application.hpp"
 #include "SVR/DockingLayout.hpp"
@@ -6,6 +8,9 @@
 namespace SVR
 {
 
+const int Application::MaxVolumeLevels;
+const int Application::VirtualBrickSize;
+
 Application::Application()
     : isQuitting(false), window(nullptr), glContext(nullptr)
 {
@@ -14,6 +19,43 @@ Application::Application()
     fullscreen = false;
     fovy = 60.0;
     cubeFile = nullptr;
+    cubeAccessMode = FitsAccessMode::Mapped;
+    cubeHdu = -1;
+    cubePlane = 0;
+    cubePlaneCount = 1;
+    playingPlanes = false;
+    planePrefetchReady = false;
+    prefetchedPlane = -1;
+    prefetchedMinValue = prefetchedMaxValue = 0.0;
+    rescaleReady = false;
+    rescaleStartTime = 0;
+    previewSize = 128;
+    previewing = false;
+    previewCubeSize = glm::ivec3(0);
+    refinedMinValue = refinedMaxValue = 0.0;
+    rangeCubeFile = nullptr;
+    planeRangeReady = false;
+    planeRangeCancelled = false;
+    rangedPlane = -1;
+    planeRangeMinValue = planeRangeMaxValue = 0.0;
+    startupTime = 0;
+    saveHduIndex = false;
+    saveStatistics = false;
+    deviceScaleMapping = false;
+    cubeStorageFormat = PixelFormat::L8;
+    rawCubeMinValue = rawCubeMaxValue = 0.0;
+    brickSize = 16;
+    volumeLevelCount = MaxVolumeLevels;
+    virtualVolumeBudget = 0;
+    brickFeedbackPhase = 0;
+    virtualMinValue = virtualMaxValue = 0.0;
+    virtualFrame = 0;
+    brickUploadBudget = 8 << 20;
+    volumeLevelsDirty = true;
+    cubeReadAhead = FitsReadAhead::Hints;
+    cubeHugePages = false;
+    useCubeCache = false;
+    cubeCacheDirectory = CubeCache::getDefaultDirectory();
     gammaCorrection = 2.2;
 
     cubeViewRegion = AABox(glm::vec3(0.0, 0.0, 0.0), glm::vec3(1.0, 1.0, 1.0));
@@ -54,6 +96,7 @@ void Application::quit()
 bool Application::initialize(int argc, const char **argv)
 {
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_JOYSTICK);
+    startupTime = SDL_GetTicks();
 
     if(!parseCommandLine(argc, argv))
         return false;
@@ -120,12 +163,36 @@ void Application::printHelp()
 printf(
 "SVR [options] -cube cubeFile\n"
 "-cube      <filename>  The data cube to display\n"
+"-cubeList  <filename>  Display a cube made of the 2D FITS files listed in a file, one per line.\n"
+"-cubeGlob  <pattern>   Display a cube made of the sorted 2D FITS files that match a pattern.\n"
+"-windowed              Only map the cube regions that are displayed.\n"
+"-streamed              Read the cube in blocks with pread, instead of mapping it.\n"
+"-streamedDirect        Streamed, bypassing the page cache with O_DIRECT.\n"
+"-hdu       <int>       The header data unit with the cube.\n"
+"-plane     <int>       The plane of the fourth and higher axes, such as time or Stokes.\n"
+"                       Page up and page down step through the planes, P plays them.\n"
+"-saveHduIndex          Store the header data unit index next to the cube.\n"
+"-saveStatistics        Compute the cube statistics and store them next to the cube.\n"
+"-readAhead <mode>      Cube read ahead: none, hints or prefetch.\n"
+"-hugePages             Request huge pages for the cube mapping.\n"
+"-cache                 Use a preprocessed copy of the cube from the cache.\n"
+"-cacheDir  <dir>       The cube cache directory. Implies -cache.\n"
 "-sw        <int>       The screen width.\n"
 "-sh        <int>       The screen height.\n"
 "-fovy      <number>    The vertical field of view in degrees.\n"
 "-fullscreen            Use the fullscreen mode\n"
 "-colormap  <name>      The color map name\n"
-"-datascale <scale>     The data scale to use\n"
+"-datascale <scale>     The data scale to use. M selects the next one.\n"
+"-deviceScale           Map the data scale in the compute device, from a float copy of the cube.\n"
+"-volumeFormat <format> The volume format in the compute device: l8, r16 or r32f.\n"
+"-brickSize <size>      The brick size for skipping the empty space in the raycast, or 0 to disable it.\n"
+"-volumeLevels <count>  The number of volume levels for the level of detail, from 1 to 4.\n"
+"-virtualVolume <MB>    Streams the bricks of the volume into a brick atlas of this size\n"
+"                       in the compute device.\n"
+"-brickUploadBudget <MB>\n"
+"                       The bricks of the virtual volume that are uploaded in each frame.\n"
+"-previewSize <size>    The largest axis of the start-up preview volume, or 0 to map\n"
+"                       the whole volume first.\n"
 "-averageSampling       Render in sample averaging mode.\n"
 "-cubeMappingBox  <nx ny nz px py pz>   The virtual space box to which the\n"
 "                                       volume is mapped.\n"
@@ -133,6 +200,7 @@ printf(
 "-xSlice  <start> <size>       X axis slice.\n"
 "-ySlice  <start> <size>       Y axis slice.\n"
 "-zSlice  <start> <size>       Z axis slice.\n"
+"                              ] and [ widen and narrow it, period and comma move it.\n"
 "\n"
 "Available color maps:\n"
 "gray\n"
@@ -177,6 +245,64 @@ bool Application::parseCommandLine(int argc, const char **argv)
         {
             cubeFileName = argv[i];
         }
+        else if(!strcmp(argv[i], "-cubeList") && argv[++i])
+        {
+            cubeFileName = cubeListFileName = argv[i];
+        }
+        else if(!strcmp(argv[i], "-cubeGlob") && argv[++i])
+        {
+            cubeFileName = cubeGlobPattern = argv[i];
+        }
+        else if(!strcmp(argv[i], "-windowed"))
+        {
+            cubeAccessMode = FitsAccessMode::Windowed;
+        }
+        else if(!strcmp(argv[i], "-streamed"))
+        {
+            cubeAccessMode = FitsAccessMode::Streamed;
+        }
+        else if(!strcmp(argv[i], "-streamedDirect"))
+        {
+            cubeAccessMode = FitsAccessMode::StreamedDirect;
+        }
+        else if(!strcmp(argv[i], "-hdu") && argv[++i])
+        {
+            cubeHdu = atoi(argv[i]);
+        }
+        else if(!strcmp(argv[i], "-plane") && argv[++i])
+        {
+            cubePlane = atoi(argv[i]);
+        }
+        else if(!strcmp(argv[i], "-saveHduIndex"))
+        {
+            saveHduIndex = true;
+        }
+        else if(!strcmp(argv[i], "-saveStatistics"))
+        {
+            saveStatistics = true;
+        }
+        else if(!strcmp(argv[i], "-readAhead") && argv[++i])
+        {
+            if(!strcmp(argv[i], "none"))
+                cubeReadAhead = FitsReadAhead::None;
+            else if(!strcmp(argv[i], "prefetch"))
+                cubeReadAhead = FitsReadAhead::Prefetch;
+            else
+                cubeReadAhead = FitsReadAhead::Hints;
+        }
+        else if(!strcmp(argv[i], "-hugePages"))
+        {
+            cubeHugePages = true;
+        }
+        else if(!strcmp(argv[i], "-cache"))
+        {
+            useCubeCache = true;
+        }
+        else if(!strcmp(argv[i], "-cacheDir") && argv[++i])
+        {
+            cubeCacheDirectory = argv[i];
+            useCubeCache = true;
+        }
         else if(!strcmp(argv[i], "-colormap") && argv[++i])
         {
             colorMapName = argv[i];
@@ -185,6 +311,39 @@ bool Application::parseCommandLine(int argc, const char **argv)
         {
             setDataScaleNamed(argv[i]);
         }
+        else if(!strcmp(argv[i], "-deviceScale"))
+        {
+            deviceScaleMapping = true;
+        }
+        else if(!strcmp(argv[i], "-volumeFormat") && argv[++i])
+        {
+            if(!strcmp(argv[i], "r16"))
+                cubeStorageFormat = PixelFormat::R16;
+            else if(!strcmp(argv[i], "r32f"))
+                cubeStorageFormat = PixelFormat::R32F;
+            else
+                cubeStorageFormat = PixelFormat::L8;
+        }
+        else if(!strcmp(argv[i], "-brickSize") && argv[++i])
+        {
+            brickSize = std::max(0, atoi(argv[i]));
+        }
+        else if(!strcmp(argv[i], "-volumeLevels") && argv[++i])
+        {
+            volumeLevelCount = std::min(std::max(1, atoi(argv[i])), int(MaxVolumeLevels));
+        }
+        else if(!strcmp(argv[i], "-virtualVolume") && argv[++i])
+        {
+            virtualVolumeBudget = size_t(std::max(0, atoi(argv[i]))) << 20;
+        }
+        else if(!strcmp(argv[i], "-brickUploadBudget") && argv[++i])
+        {
+            brickUploadBudget = size_t(std::max(1, atoi(argv[i]))) << 20;
+        }
+        else if(!strcmp(argv[i], "-previewSize") && argv[++i])
+        {
+            previewSize = std::max(0, atoi(argv[i]));
+        }
         else if(!strcmp(argv[i], "-cubeMappingBox") && (++i) + 6 <= argc)
         {
             cubeImageBox.min = glm::vec3(atof(argv[i]), atof(argv[i+1]), atof(argv[i+2]));
@@ -237,8 +396,29 @@ bool Application::parseCommandLine(int argc, const char **argv)
 
 void Application::setDataScale(const DataScalePtr &newDataScale)
 {
-    dataScale = newDataScale;
-    // TODO: Perform the new mapping.
+    // The resident bricks of the virtual volume are mapped again when they are requested.
+    if(computeBrickAtlas)
+    {
+        dataScale = newDataScale;
+        resetVirtualVolume();
+        return;
+    }
+
+    // Before the cube is loaded, the scale is only selected.
+    if(!computeCubeBuffer)
+    {
+        dataScale = newDataScale;
+        return;
+    }
+
+    // The raw cube is already in the device, so only the mapping kernel is run.
+    if(computeRawCubeBuffer)
+    {
+        mapCubeInDevice(newDataScale);
+        return;
+    }
+
+    startRescale(newDataScale);
 }
 
 void Application::setDataScaleNamed(const std::string &name)
@@ -256,6 +436,16 @@ void Application::setDataScaleNamed(const std::string &name)
     }
 }
 
+void Application::selectNextDataScale()
+{
+    auto it = dataScaleNameMap.upper_bound(dataScaleName);
+    if(it == dataScaleNameMap.end())
+        it = dataScaleNameMap.begin();
+
+    printf("Data scale: %s\n", it->first.c_str());
+    setDataScaleNamed(it->first);
+}
+
 bool Application::initializeTextures()
 {
     screenColorBuffer = renderer->createTexture2D(screenWidth, screenHeight, PixelFormat::RGBA32F);
@@ -348,8 +538,25 @@ bool Application::initializeScene()
     camera->setPosition(glm::vec3(0.0, 0.0, 3.0));
 
     // Load the image cube.
-    cubeFile = FitsFile::open(cubeFileName.c_str(), false);
+    cubeFile = openCube();
+    if(!cubeFile)
+        return false;
+
+    if(saveHduIndex)
+        cubeFile->saveHduIndex(FitsFile::hduIndexFileNameFor(cubeFileName));
+
+    if(cubeHdu >= 0 && !cubeFile->selectHdu(cubeHdu))
+    {
+        logError("The requested header data unit does not exist");
+        return false;
+    }
+
+    printf("Using HDU %d of %d\n", (int)cubeFile->getSelectedHdu(), (int)cubeFile->getHduCount());
     printf("Opened cube of size: %d %d %d\n", (int)cubeFile->getWidth(), (int)cubeFile->getHeight(), (int)cubeFile->getDepth());
+    cubePlaneCount = int(cubeFile->getPlaneCount());
+    cubePlane = std::max(0, std::min(cubePlane, cubePlaneCount - 1));
+    if(cubePlaneCount > 1)
+        printf("Using plane %d of %d\n", cubePlane, cubePlaneCount);
     if(!xSlice.isValid())
         xSlice.setWholeSize(cubeFile->getWidth());
     else
@@ -365,10 +572,21 @@ bool Application::initializeScene()
     else
         zSlice.clampToRange(0, cubeFile->getDepth());
 
-    for(auto &kv: cubeFile->getHeaderProperties())
-        printf("%s = %s\n", kv.first.c_str(), kv.second.c_str());
+    for(auto &card: cubeFile->getHeader())
+        printf("%.*s = %.*s\n", int(card.key.size), card.key.data, int(card.value.size), card.value.data);
+
+    if(useCubeCache)
+        useCachedCube();
+    if(cubeStatistics.isEmpty())
+        loadCubeStatistics();
 
-    performScaleMapping();
+    cubeFile->setReadAhead(cubeReadAhead);
+    if(cubeHugePages)
+        cubeFile->adviseAccess(MemoryAccessHint::HugePages);
+
+    // A preview is displayed at once, and the whole volume replaces it when it is mapped.
+    if(virtualVolumeBudget > 0 || !startPreviewVolume())
+        performScaleMapping();
 
     // Set the color map.
     setColorMapNamed(colorMapName);
@@ -376,6 +594,90 @@ bool Application::initializeScene()
     return true;
 }
 
+FitsFile *Application::openCube()
+{
+    if(cubeListFileName.empty() && cubeGlobPattern.empty())
+        return FitsFile::open(cubeFileName.c_str(), false, cubeAccessMode);
+
+    std::vector<std::string> sliceFileNames;
+    if(!cubeListFileName.empty())
+    {
+        // Relative names are relative to the list file.
+        std::ifstream listFile(cubeListFileName);
+        auto separator = cubeListFileName.rfind('/');
+        auto listDirectory = separator != std::string::npos ? cubeListFileName.substr(0, separator + 1) : std::string();
+        std::string line;
+        while(std::getline(listFile, line))
+        {
+            if(line.empty() || line[0] == '#')
+                continue;
+            sliceFileNames.push_back(line[0] == '/' ? line : listDirectory + line);
+        }
+    }
+    else
+    {
+        glob_t globResult;
+        if(glob(cubeGlobPattern.c_str(), 0, nullptr, &globResult) == 0)
+        {
+            for(size_t i = 0; i < globResult.gl_pathc; ++i)
+                sliceFileNames.push_back(globResult.gl_pathv[i]);
+        }
+        globfree(&globResult);
+    }
+
+    if(sliceFileNames.empty())
+    {
+        logError("The cube does not have any slice file");
+        return nullptr;
+    }
+
+    printf("Using a virtual cube of %d slice files\n", (int)sliceFileNames.size());
+    return FitsFile::openSlices(sliceFileNames, cubeAccessMode);
+}
+
+void Application::useCachedCube()
+{
+    CubeCache cache(cubeCacheDirectory);
+    auto key = cache.computeKey(cubeFileName, cubeFile);
+    auto cachedCube = cache.open(key, cubeStatistics, cubeAccessMode);
+    if(!cachedCube)
+    {
+        printf("Storing the cube in the cache %s\n", cubeCacheDirectory.c_str());
+        cachedCube = cache.store(key, cubeFile, cubeStatistics, cubeAccessMode);
+        if(!cachedCube)
+            return;
+    }
+
+    // The cached cube is already in physical values and in the host byte order.
+    printf("Using cached cube %s, values in [%g, %g]\n", key.c_str(), cubeStatistics.minValue, cubeStatistics.maxValue);
+    cubeFile->close();
+    delete cubeFile;
+    cubeFile = cachedCube;
+}
+
+void Application::loadCubeStatistics()
+{
+    auto key = computeCubeKey(cubeFileName, cubeFile);
+    if(key.empty())
+        return;
+
+    auto statisticsFileName = CubeStatistics::sidecarFileNameFor(cubeFileName);
+    if(cubeStatistics.load(statisticsFileName, key))
+    {
+        printf("Using the cube statistics %s, values in [%g, %g]\n", statisticsFileName.c_str(), cubeStatistics.minValue, cubeStatistics.maxValue);
+        return;
+    }
+
+    if(!saveStatistics)
+        return;
+
+    computeCubeStatistics(cubeFile, cubeStatistics);
+    printf("Computed the cube statistics, values in [%g, %g], mean %g, sigma %g, %llu NaN\n", cubeStatistics.minValue, cubeStatistics.maxValue,
+        cubeStatistics.meanValue, cubeStatistics.standardDeviation, (unsigned long long)cubeStatistics.nanCount);
+    if(!cubeStatistics.save(statisticsFileName, key))
+        logError("Failed to save the cube statistics");
+}
+
 bool Application::initializeUI()
 {
     screenWidget = std::make_shared<ContainerWidget> ();
@@ -427,29 +729,1136 @@ bool Application::initializeUI()
 }
 
 void Application::performScaleMapping()
+{
+    finishPlanePrefetch();
+
+    // The bricks of the virtual volume are only mapped when the raycast requests them.
+    if(virtualVolumeBudget > 0)
+    {
+        if(createVirtualVolume())
+        {
+            printCubeMemoryCost();
+            return;
+        }
+
+        logWarning("Failed to create the virtual volume, the whole volume is used.");
+        virtualVolumeBudget = 0;
+    }
+
+    // Map the cube, or convert it into physical values that are mapped in the device.
+    auto usageBefore = cubeFile->getMemoryUsage();
+    std::unique_ptr<uint8_t[]> wholeData;
+    if(deviceScaleMapping)
+    {
+        computeRawCubeBuffer = createRawCubeBuffer(cubePlane, rawCubeMinValue, rawCubeMaxValue);
+        if(!computeRawCubeBuffer)
+        {
+            logWarning("Failed to allocate the raw cube in the compute device, the data scale is mapped in the host.");
+            deviceScaleMapping = false;
+        }
+    }
+
+    if(!deviceScaleMapping)
+        wholeData = mapCubePlane(dataScale, cubePlane);
+    auto usageAfter = cubeFile->getMemoryUsage();
+    printf("Cube mapping: %.1f MB mapped, %.1f MB resident, %ld minor faults, %ld major faults\n",
+        usageAfter.mappedSize / (1024.0*1024.0), usageAfter.residentSize / (1024.0*1024.0),
+        usageAfter.minorPageFaults - usageBefore.minorPageFaults,
+        usageAfter.majorPageFaults - usageBefore.majorPageFaults);
+
+    // Create the compute buffer, or write the new data into it.
+    if(deviceScaleMapping)
+        mapCubeInDevice(dataScale);
+    else if(!computeCubeBuffer)
+        computeCubeBuffer = createCubeBuffer(wholeData.get());
+    else
+        uploadCubeData(wholeData.get());
+    volumeLevelsDirty = true;
+
+    rememberPlaneRange(dataScale, cubePlane);
+    printCubeMemoryCost();
+
+    if(cubePlaneCount > 1)
+        startPlanePrefetch((cubePlane + 1) % cubePlaneCount);
+}
+
+std::unique_ptr<float[]> Application::sampleCubeRegion(FitsFile *cube, SliceRange x, SliceRange y, SliceRange z, int stride,
+    double &minValue, double &maxValue)
+{
+    // Only every stride-th row of every stride-th slice is read, and the range is estimated from those rows.
+    auto size = (glm::ivec3(x.size, y.size, z.size) + stride - 1) / stride;
+    std::unique_ptr<float[]> samples(new float[size_t(size.x)*size.y*size.z]);
+    std::unique_ptr<float[]> row(new float[x.size]);
+    minValue = maxValue = NAN;
+    auto destination = samples.get();
+    for(int k = 0; k < size.z; ++k)
+    {
+        for(int j = 0; j < size.y; ++j)
+        {
+            PhysicalMapping physical;
+            mapFitsInto(physical, cube, row.get(), x, SliceRange(y.start + j*stride, 1), SliceRange(z.start + k*stride, 1));
+            for(int i = 0; i < size.x; ++i)
+                *destination++ = row[i*stride];
+            minValue = detail::minIgnoreNaN(minValue, physical.minValue);
+            maxValue = detail::maxIgnoreNaN(maxValue, physical.maxValue);
+        }
+    }
+
+    return samples;
+}
+
+bool Application::startPreviewVolume()
+{
+    // Small volumes are mapped at once.
+    int maxAxis = std::max(xSlice.size, std::max(ySlice.size, zSlice.size));
+    if(previewSize <= 0 || maxAxis <= previewSize)
+        return false;
+
+    auto startTime = SDL_GetTicks();
+    int stride = (maxAxis + previewSize - 1) / previewSize;
+    auto size = (glm::ivec3(xSlice.size, ySlice.size, zSlice.size) + stride - 1) / stride;
+    auto planeSlices = getPlaneSlices(cubePlane);
+    double estimatedMin, estimatedMax;
+    auto previewData = sampleCubeRegion(cubeFile, xSlice, ySlice, planeSlices, stride, estimatedMin, estimatedMax);
+
+    double minValue, maxValue;
+    if(!cubeStatistics.getRegionRange(cubeFile, xSlice, ySlice, planeSlices, minValue, maxValue))
+    {
+        minValue = estimatedMin;
+        maxValue = estimatedMax;
+    }
+
+    // The preview is mapped in the device, whatever the mapping of the whole volume.
+    auto rawPreview = computePlatform->createImage3D(PixelFormat::R32F, size.x, size.y, size.z,
+        size.x*sizeof(float), size_t(size.x)*size.y*sizeof(float), (const char*)previewData.get());
+    auto preview = computePlatform->createImage3D(cubeStorageFormat, size.x, size.y, size.z);
+    auto device = computePlatform->getComputeDevice(0);
+    bool mapped = rawPreview && preview &&
+        dataScale->mapImageInDevice(device, cubeMappingsFloatProgram, rawPreview, preview, size.x, size.y, size.z, minValue, maxValue);
+    if(rawPreview)
+        rawPreview->destroy();
+    if(!mapped)
+    {
+        if(preview)
+            preview->destroy();
+        logWarning("Failed to create the preview volume, the whole volume is mapped first.");
+        return false;
+    }
+
+    computeCubeBuffer = preview;
+    previewCubeSize = size;
+    previewing = true;
+    volumeLevelsDirty = true;
+    printf("Preview volume %d %d %d, every %d voxels: %u ms\n", size.x, size.y, size.z, stride, SDL_GetTicks() - startTime);
+
+    // The rescaling thread maps the whole volume with a copy of the scale, the new scales wait for it.
+    rescaleDataScale = dataScale->copy();
+    rescaleReady = false;
+    rescaleStartTime = SDL_GetTicks();
+    int plane = cubePlane;
+    rescaleThread = std::thread([this, plane]() {
+        if(deviceScaleMapping)
+            refinedRawCubeBuffer = createRawCubeBuffer(plane, refinedMinValue, refinedMaxValue);
+        else
+            rescaledData = mapCubePlane(rescaleDataScale, plane);
+        rescaleReady = true;
+    });
+    return true;
+}
+
+void Application::finishPreviewRefinement()
+{
+    // The whole volume replaces the preview, with its own levels and brick ranges.
+    previewing = false;
+    computeCubeBuffer->destroy();
+    computeCubeBuffer.reset();
+    dataScale = rescaleDataScale;
+    rescaleDataScale.reset();
+    rescaleReady = false;
+
+    if(deviceScaleMapping && !refinedRawCubeBuffer)
+    {
+        logWarning("Failed to allocate the raw cube in the compute device, the data scale is mapped in the host.");
+        deviceScaleMapping = false;
+        rescaledData = mapCubePlane(dataScale, cubePlane);
+    }
+
+    if(deviceScaleMapping)
+    {
+        computeRawCubeBuffer = refinedRawCubeBuffer;
+        refinedRawCubeBuffer.reset();
+        rawCubeMinValue = refinedMinValue;
+        rawCubeMaxValue = refinedMaxValue;
+        mapCubeInDevice(dataScale);
+    }
+    else
+    {
+        computeCubeBuffer = createCubeBuffer(rescaledData.get());
+        rescaledData.reset();
+    }
+    volumeLevelsDirty = true;
+
+    rememberPlaneRange(dataScale, cubePlane);
+    printCubeMemoryCost();
+    printf("Full resolution volume: %u ms after start-up\n", SDL_GetTicks() - startupTime);
+}
+
+glm::ivec3 Application::getCubeBufferSize() const
+{
+    return previewing ? previewCubeSize : glm::ivec3(xSlice.size, ySlice.size, zSlice.size);
+}
+
+size_t Application::getCubeElementSize() const
+{
+    switch(cubeStorageFormat)
+    {
+    case PixelFormat::R16:
+        return 2;
+    case PixelFormat::R32F:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+void Application::printCubeMemoryCost()
+{
+    const char *formatName = "l8";
+    if(cubeStorageFormat == PixelFormat::R16)
+        formatName = "r16";
+    else if(cubeStorageFormat == PixelFormat::R32F)
+        formatName = "r32f";
+
+    if(computeBrickAtlas)
+    {
+        double atlasSize = double(brickCache.getSlotCount())*glm::pow(VirtualBrickSize + 2.0, 3.0)*getCubeElementSize();
+        printf("Virtual volume format %s: %.1f MB brick atlas for %d bricks, %.1f MB page table in the compute device\n", formatName,
+            atlasSize / (1024.0*1024.0), int(brickCache.getSlotCount()), brickCache.getBrickCount()*4*sizeof(float) / (1024.0*1024.0));
+        return;
+    }
+
+    // The prefetched plane is a second sampled volume, or a second raw cube.
+    double volumeSize = double(xSlice.size)*ySlice.size*zSlice.size;
+    double sampledSize = volumeSize*getCubeElementSize();
+    double rawSize = computeRawCubeBuffer ? volumeSize*sizeof(float) : 0.0;
+    int bufferedPlanes = cubePlaneCount > 1 ? 2 : 1;
+    double deviceSize = computeRawCubeBuffer ? sampledSize + rawSize*bufferedPlanes : sampledSize*bufferedPlanes;
+
+    // Each coarser level has an eighth of the voxels of the previous one.
+    for(int level = 1; level < volumeLevelCount; ++level)
+        deviceSize += sampledSize / double(1 << 3*level);
+    printf("Volume format %s: %.1f MB in the compute device\n", formatName, deviceSize / (1024.0*1024.0));
+}
+
+SliceRange Application::getPlaneSlices(int plane) const
+{
+    return SliceRange(plane*int(cubeFile->getDepth()) + zSlice.start, zSlice.size);
+}
+
+std::unique_ptr<uint8_t[]> Application::mapCubePlane(const DataScalePtr &scale, int plane)
+{
+    // The known range of the cube, or of an already mapped plane, skips the min and max pass.
+    return mapCubeRegion(scale, xSlice, ySlice, getPlaneSlices(plane), &cubeStatistics);
+}
+
+std::unique_ptr<uint8_t[]> Application::mapCubeRegion(const DataScalePtr &scale, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics)
 {
     // Allocate space for the mapped fits
-    size_t wholeSize = xSlice.size*ySlice.size*zSlice.size;
-    std::unique_ptr<uint8_t[]> wholeData(new uint8_t[wholeSize]);
+    size_t wholeSize = size_t(x.size)*y.size*z.size;
+    std::unique_ptr<uint8_t[]> wholeData(new uint8_t[wholeSize*getCubeElementSize()]);
+
+    switch(cubeStorageFormat)
+    {
+    case PixelFormat::R16:
+        scale->mapFitsIntoU16(cubeFile, reinterpret_cast<uint16_t*> (wholeData.get()), x, y, z, statistics);
+        break;
+    case PixelFormat::R32F:
+        scale->mapFitsIntoFloat(cubeFile, reinterpret_cast<float*> (wholeData.get()), x, y, z, statistics);
+        break;
+    default:
+        scale->mapFitsIntoU8(cubeFile, wholeData.get(), x, y, z, statistics);
+        break;
+    }
+    return wholeData;
+}
+
+ComputeBufferPtr Application::createCubeBuffer(const uint8_t *data)
+{
+    auto elementSize = getCubeElementSize();
+    return computePlatform->createImage3D(cubeStorageFormat,
+        xSlice.size, ySlice.size, zSlice.size,
+        xSlice.size*elementSize,
+        xSlice.size*ySlice.size*elementSize, (const char*)data);
+}
+
+void Application::uploadCubeData(const uint8_t *data)
+{
+    // The volume is written in slabs of slices, to bound the size of each transfer.
+    const size_t SlabSize = 16 << 20;
+    auto device = computePlatform->getComputeDevice(0);
+    size_t rowSize = xSlice.size*getCubeElementSize();
+    size_t sliceSize = rowSize*ySlice.size;
+    size_t slabDepth = std::max(size_t(1), SlabSize / std::max(size_t(1), sliceSize));
+    for(size_t z = 0; z < size_t(zSlice.size); z += slabDepth)
+    {
+        auto depth = std::min(slabDepth, zSlice.size - z);
+        device->writeImage3D(computeCubeBuffer, 0, 0, z, xSlice.size, ySlice.size, depth,
+            rowSize, sliceSize, data + z*sliceSize);
+    }
+    volumeLevelsDirty = true;
+}
+
+std::unique_ptr<float[]> Application::convertCubeRegion(SliceRange x, SliceRange y, SliceRange z, double &minValue, double &maxValue)
+{
+    // The identity mapping converts the region into floats, and gets its range.
+    size_t wholeSize = size_t(x.size)*y.size*z.size;
+    std::unique_ptr<float[]> rawData(new float[wholeSize]);
+    PhysicalMapping physical;
+    mapFitsInto(physical, cubeFile, rawData.get(), x, y, z, &cubeStatistics);
+    minValue = physical.minValue;
+    maxValue = physical.maxValue;
+    return rawData;
+}
 
-    // Map the cube.
-    dataScale->mapFitsIntoU8(cubeFile, wholeData.get(), xSlice, ySlice, zSlice);
+ComputeBufferPtr Application::createRawCubeBuffer(int plane, double &minValue, double &maxValue)
+{
+    auto rawData = convertCubeRegion(xSlice, ySlice, getPlaneSlices(plane), minValue, maxValue);
+    return computePlatform->createImage3D(PixelFormat::R32F,
+        xSlice.size, ySlice.size, zSlice.size,
+        xSlice.size*sizeof(float),
+        xSlice.size*ySlice.size*sizeof(float), (const char*)rawData.get());
+}
 
-    // Create the compute buffer.
+void Application::replaceRawCubeBuffer(const ComputeBufferPtr &rawCube, double minValue, double maxValue)
+{
+    if(!rawCube)
+    {
+        logError("Failed to allocate the raw cube in the compute device.");
+        return;
+    }
+
+    computeRawCubeBuffer->destroy();
+    computeRawCubeBuffer = rawCube;
+    rawCubeMinValue = minValue;
+    rawCubeMaxValue = maxValue;
+    mapCubeInDevice(dataScale);
+}
+
+void Application::mapCubeInDevice(const DataScalePtr &scale)
+{
     if(!computeCubeBuffer)
+        computeCubeBuffer = computePlatform->createImage3D(cubeStorageFormat, xSlice.size, ySlice.size, zSlice.size);
+
+    // The kernel is queued before the next raycast, which sees the whole mapped cube.
+    auto device = computePlatform->getComputeDevice(0);
+    if(!scale->mapImageInDevice(device, cubeMappingsFloatProgram, computeRawCubeBuffer, computeCubeBuffer,
+        xSlice.size, ySlice.size, zSlice.size, rawCubeMinValue, rawCubeMaxValue))
     {
-        computeCubeBuffer = computePlatform->createImage3D(PixelFormat::L8,
-            xSlice.size, ySlice.size, zSlice.size,
-            xSlice.size,
-            xSlice.size*ySlice.size, (char*)wholeData.get());
+        logError("Failed to map the cube in the compute device.");
+        return;
     }
 
-    // TODO: Upload the new version of the data
+    dataScale = scale;
+    volumeLevelsDirty = true;
+}
+
+void Application::updateVolumeLevels()
+{
+    if(!volumeLevelsDirty)
+        return;
+    volumeLevelsDirty = false;
+
+    // Build the coarser levels by halving the previous one.
+    auto device = computePlatform->getComputeDevice(0);
+    for(auto &level : computeCubeLevels)
+        level->destroy();
+    computeCubeLevels.clear();
+
+    std::vector<glm::ivec3> levelSizes;
+    levelSizes.push_back(getCubeBufferSize());
+    while(int(levelSizes.size()) < volumeLevelCount && std::max(levelSizes.back().x, std::max(levelSizes.back().y, levelSizes.back().z)) > 1)
+    {
+        auto size = (levelSizes.back() + 1) / 2;
+        auto level = computePlatform->createImage3D(cubeStorageFormat, size.x, size.y, size.z);
+        if(!level)
+        {
+            logWarning("Failed to allocate a volume level, the coarser levels are not used.");
+            break;
+        }
+
+        auto kernel = raycastProgram->createKernel("downsampleVolume");
+        kernel->setBufferArg(0, computeCubeLevels.empty() ? computeCubeBuffer : computeCubeLevels.back());
+        kernel->setBufferArg(1, level);
+        device->runGlobalKernel3D(kernel, size.x, size.y, size.z);
+        computeCubeLevels.push_back(level);
+        levelSizes.push_back(size);
+    }
+
+    // The brick ranges of each level are stacked along z, so the image stays
+    // within the brick grid of the finest level in x and y.
+    if(computeBrickRanges)
+        computeBrickRanges->destroy();
+    computeBrickRanges.reset();
+    if(brickSize > 0)
+    {
+        size_t brickSliceCount = 0;
+        for(auto &size : levelSizes)
+            brickSliceCount += (size.z + brickSize - 1) / brickSize;
+        computeBrickRanges = computePlatform->createImage3D(PixelFormat::RGBA32F,
+            (levelSizes[0].x + brickSize - 1) / brickSize, (levelSizes[0].y + brickSize - 1) / brickSize, brickSliceCount);
+        if(!computeBrickRanges)
+        {
+            logWarning("Failed to allocate the brick ranges, the empty space is not skipped.");
+            brickSize = 0;
+        }
+    }
+
+    if(!computeBrickRanges)
+    {
+        computeBrickRanges = computePlatform->createImage3D(PixelFormat::RGBA32F, 1, 1, 1);
+        return;
+    }
+
+    int brickSliceOffset = 0;
+    for(size_t i = 0; i < levelSizes.size(); ++i)
+    {
+        auto brickCount = (levelSizes[i] + brickSize - 1) / brickSize;
+        auto kernel = raycastProgram->createKernel("computeBrickRanges");
+        kernel->setBufferArg(0, i > 0 ? computeCubeLevels[i - 1] : computeCubeBuffer);
+        kernel->setBufferArg(1, computeBrickRanges);
+        kernel->setIntArg(2, brickSize);
+        kernel->setIntArg(3, brickSliceOffset);
+        device->runGlobalKernel3D(kernel, brickCount.x, brickCount.y, brickCount.z);
+        brickSliceOffset += brickCount.z;
+    }
+}
+
+bool Application::createVirtualVolume()
+{
+    // The page table has an entry for each brick of the viewed box.
+    deviceScaleMapping = false;
+    pageTableSize = glm::ivec3(xSlice.size + VirtualBrickSize - 1, ySlice.size + VirtualBrickSize - 1, zSlice.size + VirtualBrickSize - 1) / VirtualBrickSize;
+    size_t brickCount = size_t(pageTableSize.x)*pageTableSize.y*pageTableSize.z;
+    computePageTable = computePlatform->createImage3D(PixelFormat::RGBA32F, pageTableSize.x, pageTableSize.y, pageTableSize.z);
+    if(!computePageTable)
+        return false;
+
+    // The atlas has the same number of slots along each axis, within the budget and the minimum 3D image size of OpenCL.
+    const int MaxAtlasSize = 2048;
+    int slotSize = VirtualBrickSize + 2;
+    int slotsPerAxis = int(std::cbrt(double(virtualVolumeBudget) / (double(slotSize)*slotSize*slotSize*getCubeElementSize())));
+    slotsPerAxis = std::min(slotsPerAxis, MaxAtlasSize / slotSize);
+    while(slotsPerAxis > 1 && size_t(slotsPerAxis - 1)*(slotsPerAxis - 1)*(slotsPerAxis - 1) >= brickCount)
+        --slotsPerAxis;
+    while(slotsPerAxis > 0)
+    {
+        computeBrickAtlas = computePlatform->createImage3D(cubeStorageFormat, slotsPerAxis*slotSize, slotsPerAxis*slotSize, slotsPerAxis*slotSize);
+        if(computeBrickAtlas)
+            break;
+        slotsPerAxis = slotsPerAxis*3/4;
+    }
+
+    if(!computeBrickAtlas)
+    {
+        computePageTable->destroy();
+        computePageTable.reset();
+        return false;
+    }
+
+    atlasSlotCount = glm::ivec3(slotsPerAxis);
+    brickCache.reset(brickCount, size_t(slotsPerAxis)*slotsPerAxis*slotsPerAxis);
+
+    // The loaded bricks wait for at most two frames of uploads.
+    resetVirtualVolume();
+    brickLoader.start(2*std::max(size_t(1), brickUploadBudget / getVirtualSlotSize()));
+    return true;
+}
+
+void Application::destroyVirtualVolume()
+{
+    // The loader reads the cube with the old box.
+    brickLoader.stop();
+    if(computeBrickAtlas)
+        computeBrickAtlas->destroy();
+    if(computePageTable)
+        computePageTable->destroy();
+    if(computeBrickFeedback)
+        computeBrickFeedback->destroy();
+    computeBrickAtlas.reset();
+    computePageTable.reset();
+    computeBrickFeedback.reset();
+}
+
+void Application::resetVirtualVolume()
+{
+    if(!computeBrickAtlas)
+        return;
+
+    // The bricks are mapped with the range of the whole slices of the plane, which the statistics have.
+    // Otherwise the range is estimated, until it is read in background.
+    if(!cubeStatistics.getRegionRange(cubeFile, SliceRange(0, cubeFile->getWidth()), SliceRange(0, cubeFile->getHeight()),
+        getPlaneSlices(cubePlane), virtualMinValue, virtualMaxValue))
+        startPlaneRangeRead(cubePlane);
+
+    // The displayed scale has the range of the bricks, for the color bar. The loader maps
+    // the new bricks with a copy of it, and discards the old ones.
+    dataScale->setRange(virtualMinValue, virtualMaxValue);
+    auto scale = dataScale->copy();
+    auto plane = cubePlane;
+    auto minValue = virtualMinValue;
+    auto maxValue = virtualMaxValue;
+    brickLoader.setLoadFunction([=](size_t brick) {
+        return mapVirtualBrick(scale, plane, minValue, maxValue, brick);
+    });
+
+    // Evict every brick.
+    brickCache.reset(brickCache.getBrickCount(), brickCache.getSlotCount());
+    std::vector<float> emptyPages(brickCache.getBrickCount()*4, 0.0f);
+    computePlatform->getComputeDevice(0)->writeImage3D(computePageTable, 0, 0, 0, pageTableSize.x, pageTableSize.y, pageTableSize.z,
+        pageTableSize.x*4*sizeof(float), size_t(pageTableSize.x)*pageTableSize.y*4*sizeof(float), emptyPages.data());
+}
+
+void Application::startPlaneRangeRead(int plane)
+{
+    // The estimate of the plane that is being read is kept.
+    if(planeRangeThread.joinable() && rangedPlane == plane)
+        return;
+    cancelPlaneRangeRead();
+
+    // The range is read with another instance of the cube, because the brick loader reads this one.
+    if(!rangeCubeFile)
+    {
+        rangeCubeFile = openCube();
+        if(rangeCubeFile && !rangeCubeFile->selectHdu(cubeFile->getSelectedHdu()))
+        {
+            delete rangeCubeFile;
+            rangeCubeFile = nullptr;
+        }
+        if(!rangeCubeFile)
+        {
+            logError("Failed to open the cube for reading the range of a plane.");
+            return;
+        }
+        rangeCubeFile->setReadAhead(cubeReadAhead);
+    }
+
+    // The estimate has about as many samples as the preview of the whole volume.
+    const int EstimateSize = 128;
+    SliceRange wholeX(0, cubeFile->getWidth());
+    SliceRange wholeY(0, cubeFile->getHeight());
+    auto planeSlices = getPlaneSlices(plane);
+    int maxAxis = std::max(wholeX.size, std::max(wholeY.size, planeSlices.size));
+    int stride = std::max(1, (maxAxis + EstimateSize - 1) / EstimateSize);
+    sampleCubeRegion(rangeCubeFile, wholeX, wholeY, planeSlices, stride, virtualMinValue, virtualMaxValue);
+    printf("Estimated range of plane %d, every %d voxels: [%g, %g]\n", plane, stride, virtualMinValue, virtualMaxValue);
+
+    // The rows are read in chunks, so that a new plane cancels the read quickly.
+    rangedPlane = plane;
+    planeRangeReady = false;
+    planeRangeCancelled = false;
+    planeRangeThread = std::thread([this, wholeX, wholeY, planeSlices]() {
+        const size_t ChunkSize = 16 << 20;
+        int rowsPerChunk = int(std::max(size_t(1), ChunkSize / (size_t(wholeX.size)*sizeof(float))));
+        std::unique_ptr<float[]> rows(new float[size_t(rowsPerChunk)*wholeX.size]);
+        double minValue = NAN, maxValue = NAN;
+        for(int slice = planeSlices.start; slice < planeSlices.start + planeSlices.size && !planeRangeCancelled; ++slice)
+        {
+            for(int row = 0; row < wholeY.size && !planeRangeCancelled; row += rowsPerChunk)
+            {
+                PhysicalMapping physical;
+                mapFitsInto(physical, rangeCubeFile, rows.get(), wholeX, SliceRange(row, std::min(rowsPerChunk, wholeY.size - row)), SliceRange(slice, 1));
+                minValue = detail::minIgnoreNaN(minValue, physical.minValue);
+                maxValue = detail::maxIgnoreNaN(maxValue, physical.maxValue);
+            }
+        }
+
+        planeRangeMinValue = minValue;
+        planeRangeMaxValue = maxValue;
+        planeRangeReady = !planeRangeCancelled;
+    });
+}
+
+void Application::finishPlaneRangeRead()
+{
+    planeRangeThread.join();
+    planeRangeReady = false;
+
+    // The range is remembered for the plane, and replaces the estimate of the displayed plane.
+    cubeStatistics.setRegionRange(SliceRange(0, cubeFile->getWidth()), SliceRange(0, cubeFile->getHeight()), getPlaneSlices(rangedPlane),
+        planeRangeMinValue, planeRangeMaxValue);
+    printf("Range of plane %d: [%g, %g]\n", rangedPlane, planeRangeMinValue, planeRangeMaxValue);
+    if(rangedPlane == cubePlane && (planeRangeMinValue != virtualMinValue || planeRangeMaxValue != virtualMaxValue))
+        resetVirtualVolume();
+}
+
+void Application::cancelPlaneRangeRead()
+{
+    if(!planeRangeThread.joinable())
+        return;
+
+    planeRangeCancelled = true;
+    planeRangeThread.join();
+    planeRangeReady = false;
+}
+
+// A box is outside of the frustum when its corners are all behind one of the planes of the frustum.
+inline bool isBoxInFrustum(const FrustumCorners &corners, const AABox &box)
+{
+    static const FrustumCorner Faces[6][3] = {
+        {FrustumCorner::LeftTopNear, FrustumCorner::RightTopNear, FrustumCorner::LeftBottomNear},
+        {FrustumCorner::LeftTopFar, FrustumCorner::RightTopFar, FrustumCorner::LeftBottomFar},
+        {FrustumCorner::LeftTopNear, FrustumCorner::LeftBottomNear, FrustumCorner::LeftTopFar},
+        {FrustumCorner::RightTopNear, FrustumCorner::RightBottomNear, FrustumCorner::RightTopFar},
+        {FrustumCorner::LeftTopNear, FrustumCorner::RightTopNear, FrustumCorner::LeftTopFar},
+        {FrustumCorner::LeftBottomNear, FrustumCorner::RightBottomNear, FrustumCorner::LeftBottomFar},
+    };
+
+    glm::vec3 center(0.0f);
+    for(int i = 0; i < 8; ++i)
+        center += glm::vec3(corners[i]) / 8.0f;
+
+    for(auto &face : Faces)
+    {
+        glm::vec3 a(corners[(int)face[0]]), b(corners[(int)face[1]]), c(corners[(int)face[2]]);
+        auto normal = glm::cross(b - a, c - a);
+        if(glm::dot(normal, center - a) < 0.0f)
+            normal = -normal;
+
+        bool outside = true;
+        for(int i = 0; i < 8 && outside; ++i)
+        {
+            glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+            outside = glm::dot(normal, corner - a) < 0.0f;
+        }
+        if(outside)
+            return false;
+    }
+
+    return true;
+}
+
+bool Application::updateVirtualVolume()
+{
+    // A request that is not repeated by the feedback, during a whole rotation of the tile rays, is cancelled.
+    const uint64_t RequestLifetime = 16;
+
+    // The feedback has a texel for each 4x4 tile of the volume color buffer.
+    auto device = computePlatform->getComputeDevice(0);
+    size_t feedbackWidth = (volumeColorBuffer->getWidth() + 3) / 4;
+    size_t feedbackHeight = (volumeColorBuffer->getHeight() + 3) / 4;
+    if(!computeBrickFeedback || brickFeedback.size() != feedbackWidth*feedbackHeight*4)
+    {
+        if(computeBrickFeedback)
+            computeBrickFeedback->destroy();
+        brickFeedback.assign(feedbackWidth*feedbackHeight*4, 0.0f);
+        computeBrickFeedback = computePlatform->createImage2D(PixelFormat::RGBA32F, feedbackWidth, feedbackHeight, 0, (const char*)brickFeedback.data());
+        if(!computeBrickFeedback)
+        {
+            logWarning("Failed to allocate the brick feedback, the virtual volume is not rendered.");
+            brickFeedback.clear();
+            return false;
+        }
+        return true;
+    }
+
+    device->readImage2D(computeBrickFeedback, 0, 0, feedbackWidth, feedbackHeight, feedbackWidth*4*sizeof(float), brickFeedback.data());
+    brickFeedbackPhase = (brickFeedbackPhase + 1) % 16;
+    ++virtualFrame;
+
+    // The visible bricks are used first, so that the uploads do not evict them.
+    brickCache.beginFrame();
+    std::vector<size_t> missingBricks;
+    for(size_t i = 0; i < brickFeedback.size(); i += 4)
+    {
+        auto w = brickFeedback[i + 3];
+        glm::ivec3 brick(brickFeedback[i], brickFeedback[i + 1], brickFeedback[i + 2]);
+        if(w <= 0.0f || glm::any(glm::lessThan(brick, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(brick, pageTableSize)))
+            continue;
+
+        size_t index = (size_t(brick.z)*pageTableSize.y + brick.y)*pageTableSize.x + brick.x;
+        if(w > 0.75f)
+            missingBricks.push_back(index);
+        else
+            brickCache.touch(index);
+    }
+
+    // Upload the loaded bricks within the byte budget of a frame.
+    std::vector<BrickLoader::LoadedBrick> loadedBricks;
+    brickLoader.takeLoadedBricks(std::max(size_t(1), brickUploadBudget / getVirtualSlotSize()), loadedBricks);
+    for(auto &loaded : loadedBricks)
+    {
+        if(brickCache.touch(loaded.brick) != BrickCache::NoSlot)
+            continue;
+
+        size_t evictedBrick;
+        auto slot = brickCache.allocate(loaded.brick, evictedBrick);
+        if(slot == BrickCache::NoSlot)
+            break;
+
+        if(evictedBrick != BrickCache::NoBrick)
+        {
+            float emptyPage[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            auto evicted = getVirtualBrickCoord(evictedBrick);
+            device->writeImage3D(computePageTable, evicted.x, evicted.y, evicted.z, 1, 1, 1, sizeof(emptyPage), sizeof(emptyPage), emptyPage);
+        }
+
+        uploadVirtualBrick(loaded.brick, slot, loaded.data.get());
+    }
+
+    // Request the missing bricks, and order every request by the distance to the camera.
+    // The requests whose brick left the frustum are cancelled.
+    FrustumCorners frustum;
+    camera->getWorldFrustumCorners(frustum);
+    auto cameraPosition = camera->getPosition();
+    auto volumeSize = glm::vec3(xSlice.size, ySlice.size, zSlice.size);
+    auto boxExtent = cubeImageBox.max - cubeImageBox.min;
+    auto priority = [&](size_t brick, uint64_t lastRequestFrame) {
+        if(virtualFrame - lastRequestFrame > RequestLifetime)
+            return -1.0f;
+
+        auto brickStart = glm::vec3(getVirtualBrickCoord(brick)*VirtualBrickSize);
+        auto brickEnd = glm::min(brickStart + float(VirtualBrickSize), volumeSize);
+        AABox brickBox(cubeImageBox.min + brickStart / volumeSize*boxExtent, cubeImageBox.min + brickEnd / volumeSize*boxExtent);
+        if(!isBoxInFrustum(frustum, brickBox))
+            return -1.0f;
+        return glm::length((brickBox.min + brickBox.max)*0.5f - cameraPosition);
+    };
+
+    for(auto brick : missingBricks)
+    {
+        if(brickCache.touch(brick) == BrickCache::NoSlot)
+            brickLoader.request(brick, priority(brick, virtualFrame), virtualFrame);
+    }
+    brickLoader.prioritize(priority);
+    return true;
+}
+
+size_t Application::getVirtualSlotSize() const
+{
+    return size_t(VirtualBrickSize + 2)*(VirtualBrickSize + 2)*(VirtualBrickSize + 2)*getCubeElementSize();
+}
+
+glm::ivec3 Application::getVirtualBrickCoord(size_t brick) const
+{
+    return glm::ivec3(brick % pageTableSize.x, brick / pageTableSize.x % pageTableSize.y, brick / (size_t(pageTableSize.x)*pageTableSize.y));
+}
+
+std::unique_ptr<uint8_t[]> Application::mapVirtualBrick(const DataScalePtr &scale, int plane, double minValue, double maxValue, size_t brick)
+{
+    // Map the brick with its apron, clamped to the viewed box.
+    auto brickCoord = getVirtualBrickCoord(brick);
+    auto planeSlices = getPlaneSlices(plane);
+    glm::ivec3 boxStart(xSlice.start, ySlice.start, planeSlices.start);
+    glm::ivec3 boxEnd = boxStart + glm::ivec3(xSlice.size, ySlice.size, zSlice.size);
+    glm::ivec3 apronStart = boxStart + brickCoord*VirtualBrickSize - 1;
+    glm::ivec3 regionStart = glm::max(apronStart, boxStart);
+    glm::ivec3 regionEnd = glm::min(apronStart + VirtualBrickSize + 2, boxEnd);
+    glm::ivec3 regionSize = regionEnd - regionStart;
+    SliceRange x(regionStart.x, regionSize.x), y(regionStart.y, regionSize.y), z(regionStart.z, regionSize.z);
+
+    CubeStatistics brickRanges;
+    brickRanges.setRegionRange(x, y, z, minValue, maxValue);
+    auto mappedData = mapCubeRegion(scale, x, y, z, &brickRanges);
+
+    // The apron outside of the box repeats the voxels of its faces.
+    const int SlotSize = VirtualBrickSize + 2;
+    auto elementSize = getCubeElementSize();
+    std::unique_ptr<uint8_t[]> slotData(new uint8_t[getVirtualSlotSize()]);
+    for(int k = 0; k < SlotSize; ++k)
+    {
+        int sourceZ = glm::clamp(apronStart.z + k, regionStart.z, regionEnd.z - 1) - regionStart.z;
+        for(int j = 0; j < SlotSize; ++j)
+        {
+            int sourceY = glm::clamp(apronStart.y + j, regionStart.y, regionEnd.y - 1) - regionStart.y;
+            for(int i = 0; i < SlotSize; ++i)
+            {
+                int sourceX = glm::clamp(apronStart.x + i, regionStart.x, regionEnd.x - 1) - regionStart.x;
+                size_t source = (size_t(sourceZ)*regionSize.y + sourceY)*regionSize.x + sourceX;
+                memcpy(&slotData[((size_t(k)*SlotSize + j)*SlotSize + i)*elementSize], &mappedData[source*elementSize], elementSize);
+            }
+        }
+    }
+
+    return slotData;
+}
+
+void Application::uploadVirtualBrick(size_t brick, uint32_t slot, const uint8_t *slotData)
+{
+    const int SlotSize = VirtualBrickSize + 2;
+    auto elementSize = getCubeElementSize();
+    auto brickCoord = getVirtualBrickCoord(brick);
+    glm::ivec3 slotCoord(slot % atlasSlotCount.x, slot / atlasSlotCount.x % atlasSlotCount.y, slot / (atlasSlotCount.x*atlasSlotCount.y));
+
+    auto device = computePlatform->getComputeDevice(0);
+    device->writeImage3D(computeBrickAtlas, slotCoord.x*SlotSize, slotCoord.y*SlotSize, slotCoord.z*SlotSize, SlotSize, SlotSize, SlotSize,
+        SlotSize*elementSize, SlotSize*SlotSize*elementSize, slotData);
+
+    float page[4] = {float(slotCoord.x), float(slotCoord.y), float(slotCoord.z), 1.0f};
+    device->writeImage3D(computePageTable, brickCoord.x, brickCoord.y, brickCoord.z, 1, 1, 1, sizeof(page), sizeof(page), page);
+}
+
+void Application::rememberPlaneRange(const DataScalePtr &scale, int plane)
+{
+    // Only called when no background thread is mapping.
+    double minValue, maxValue;
+    scale->getRange(minValue, maxValue);
+    cubeStatistics.setRegionRange(xSlice, ySlice, getPlaneSlices(plane), minValue, maxValue);
+}
+
+void Application::startPlanePrefetch(int plane)
+{
+    finishPlanePrefetch();
+
+    // The prefetching thread owns the cube file and its own copy of the data scale, until it is joined.
+    prefetchedPlane = plane;
+    prefetchedDataScale = dataScale->copy();
+    prefetchedCubeBuffer.reset();
+    planePrefetchReady = false;
+    planePrefetchThread = std::thread([this]() {
+        if(deviceScaleMapping)
+        {
+            prefetchedCubeBuffer = createRawCubeBuffer(prefetchedPlane, prefetchedMinValue, prefetchedMaxValue);
+        }
+        else
+        {
+            auto planeData = mapCubePlane(prefetchedDataScale, prefetchedPlane);
+            prefetchedCubeBuffer = createCubeBuffer(planeData.get());
+        }
+        planePrefetchReady = true;
+    });
+}
+
+void Application::finishPlanePrefetch()
+{
+    if(planePrefetchThread.joinable())
+        planePrefetchThread.join();
+}
+
+void Application::discardPlanePrefetch()
+{
+    finishPlanePrefetch();
+    if(prefetchedCubeBuffer)
+        prefetchedCubeBuffer->destroy();
+
+    prefetchedPlane = -1;
+    prefetchedCubeBuffer.reset();
+    prefetchedDataScale.reset();
+    planePrefetchReady = false;
+}
+
+void Application::startRescale(const DataScalePtr &scale)
+{
+    // Only the last scale that is requested during a rescale is mapped after it.
+    if(rescaleThread.joinable())
+    {
+        queuedDataScale = scale;
+        return;
+    }
+
+    if(scale == dataScale)
+        return;
+
+    // The prefetched plane has the old scale, and its thread reads the same cube.
+    discardPlanePrefetch();
+
+    // The new scale is owned by the rescaling thread until it is joined.
+    rescaleDataScale = scale;
+    rescaleReady = false;
+    rescaleStartTime = SDL_GetTicks();
+    int plane = cubePlane;
+    rescaleThread = std::thread([this, plane]() {
+        rescaledData = mapCubePlane(rescaleDataScale, plane);
+        rescaleReady = true;
+    });
+}
+
+void Application::finishRescale()
+{
+    if(!rescaleThread.joinable())
+        return;
+
+    rescaleThread.join();
+    if(previewing)
+    {
+        finishPreviewRefinement();
+        return;
+    }
+
+    // Every slab is written before the next frame, so the old volume is displayed until then.
+    uploadCubeData(rescaledData.get());
+    rescaledData.reset();
+    dataScale = rescaleDataScale;
+    rescaleDataScale.reset();
+    rescaleReady = false;
+    rememberPlaneRange(dataScale, cubePlane);
+    printf("Data scale mapping: %u ms\n", SDL_GetTicks() - rescaleStartTime);
+}
+
+void Application::setCubePlane(int plane)
+{
+    if(cubePlaneCount <= 1)
+        return;
+
+    int direction = plane < cubePlane ? -1 : 1;
+    plane = (plane % cubePlaneCount + cubePlaneCount) % cubePlaneCount;
+    if(plane == cubePlane)
+        return;
+
+    if(computeBrickAtlas)
+    {
+        cubePlane = plane;
+        resetVirtualVolume();
+        return;
+    }
+
+    // A pending data scale is used for the new plane.
+    finishRescale();
+    if(queuedDataScale)
+    {
+        dataScale = queuedDataScale;
+        queuedDataScale.reset();
+    }
+
+    // Use the prefetched plane, or map it now.
+    finishPlanePrefetch();
+    if(plane == prefetchedPlane && prefetchedCubeBuffer && deviceScaleMapping)
+    {
+        replaceRawCubeBuffer(prefetchedCubeBuffer, prefetchedMinValue, prefetchedMaxValue);
+    }
+    else if(plane == prefetchedPlane && prefetchedCubeBuffer)
+    {
+        computeCubeBuffer->destroy();
+        computeCubeBuffer = prefetchedCubeBuffer;
+        dataScale = prefetchedDataScale;
+        volumeLevelsDirty = true;
+    }
+    else if(deviceScaleMapping)
+    {
+        double minValue, maxValue;
+        auto rawCube = createRawCubeBuffer(plane, minValue, maxValue);
+        replaceRawCubeBuffer(rawCube, minValue, maxValue);
+    }
+    else
+    {
+        auto planeData = mapCubePlane(dataScale, plane);
+        computeCubeBuffer->destroy();
+        computeCubeBuffer = createCubeBuffer(planeData.get());
+        volumeLevelsDirty = true;
+    }
+
+    rememberPlaneRange(dataScale, plane);
+
+    cubePlane = plane;
+    prefetchedPlane = -1;
+    prefetchedCubeBuffer.reset();
+    prefetchedDataScale.reset();
+
+    // Prefetch the plane that follows in the same direction.
+    startPlanePrefetch((plane + direction + cubePlaneCount) % cubePlaneCount);
+}
+
+/**
+ * A box of the cube.
+ */
+struct CubeRegion
+{
+    SliceRange x, y, z;
+};
+
+inline SliceRange intersectSliceRanges(SliceRange a, SliceRange b)
+{
+    int start = std::max(a.start, b.start);
+    int end = std::min(a.start + a.size, b.start + b.size);
+    return SliceRange(start, std::max(0, end - start));
+}
+
+// Splits the part of a box that is outside of an inner box into slabs along z, then y, then x.
+inline void computeExposedRegions(const CubeRegion &box, const CubeRegion &inner, std::vector<CubeRegion> &regions)
+{
+    int innerZEnd = inner.z.start + inner.z.size;
+    int innerYEnd = inner.y.start + inner.y.size;
+    int innerXEnd = inner.x.start + inner.x.size;
+    if(inner.z.start > box.z.start)
+        regions.push_back(CubeRegion{box.x, box.y, SliceRange(box.z.start, inner.z.start - box.z.start)});
+    if(innerZEnd < box.z.start + box.z.size)
+        regions.push_back(CubeRegion{box.x, box.y, SliceRange(innerZEnd, box.z.start + box.z.size - innerZEnd)});
+    if(inner.y.start > box.y.start)
+        regions.push_back(CubeRegion{box.x, SliceRange(box.y.start, inner.y.start - box.y.start), inner.z});
+    if(innerYEnd < box.y.start + box.y.size)
+        regions.push_back(CubeRegion{box.x, SliceRange(innerYEnd, box.y.start + box.y.size - innerYEnd), inner.z});
+    if(inner.x.start > box.x.start)
+        regions.push_back(CubeRegion{SliceRange(box.x.start, inner.x.start - box.x.start), inner.y, inner.z});
+    if(innerXEnd < box.x.start + box.x.size)
+        regions.push_back(CubeRegion{SliceRange(innerXEnd, box.x.start + box.x.size - innerXEnd), inner.y, inner.z});
+}
+
+void Application::setSliceRanges(SliceRange newX, SliceRange newY, SliceRange newZ)
+{
+    newX.clampToRange(0, cubeFile->getWidth());
+    newY.clampToRange(0, cubeFile->getHeight());
+    newZ.clampToRange(0, cubeFile->getDepth());
+    if(newX.size <= 0 || newY.size <= 0 || newZ.size <= 0)
+        return;
+    if(newX == xSlice && newY == ySlice && newZ == zSlice)
+        return;
+
+    // The virtual volume only has the bricks of the old box.
+    if(computeBrickAtlas)
+    {
+        destroyVirtualVolume();
+        xSlice = newX;
+        ySlice = newY;
+        zSlice = newZ;
+        if(!createVirtualVolume())
+            fatalError("Failed to create the virtual volume");
+        printf("Slices: x %d+%d y %d+%d z %d+%d\n", xSlice.start, xSlice.size, ySlice.start, ySlice.size, zSlice.start, zSlice.size);
+        return;
+    }
+
+    // The background threads map the old box. A pending data scale is mapped again after the change.
+    finishRescale();
+    auto pendingDataScale = queuedDataScale;
+    queuedDataScale.reset();
+    discardPlanePrefetch();
+
+    // The z ranges of the regions are in the slices of the displayed plane.
+    CubeRegion oldBox{xSlice, ySlice, zSlice};
+    CubeRegion newBox{newX, newY, newZ};
+    CubeRegion overlap{intersectSliceRanges(oldBox.x, newX), intersectSliceRanges(oldBox.y, newY), intersectSliceRanges(oldBox.z, newZ)};
+    bool overlaps = overlap.x.size > 0 && overlap.y.size > 0 && overlap.z.size > 0;
+    bool containsOldBox = overlap.x == oldBox.x && overlap.y == oldBox.y && overlap.z == oldBox.z;
+    std::vector<CubeRegion> exposedRegions;
+    if(overlaps)
+        computeExposedRegions(newBox, overlap, exposedRegions);
+
+    double oldMin, oldMax;
+    dataScale->getRange(oldMin, oldMax);
+    xSlice = newX;
+    ySlice = newY;
+    zSlice = newZ;
+    int planeOffset = cubePlane*int(cubeFile->getDepth());
+
+    // The range of the new box is known from the statistics, or from the ranges of the old box and of the exposed regions.
+    // The raw cube keeps the converted exposed regions for the upload, so that they are only read once.
+    bool rawCube = computeRawCubeBuffer != nullptr;
+    std::vector<std::unique_ptr<float[]>> exposedRawData;
+    double newMin, newMax;
+    bool rangeKnown = cubeStatistics.getRegionRange(cubeFile, newX, newY, getPlaneSlices(cubePlane), newMin, newMax);
+    if(!rangeKnown && overlaps && containsOldBox)
+    {
+        newMin = oldMin;
+        newMax = oldMax;
+        for(auto &region : exposedRegions)
+        {
+            double regionMin, regionMax;
+            auto rawData = convertCubeRegion(region.x, region.y, SliceRange(planeOffset + region.z.start, region.z.size), regionMin, regionMax);
+            newMin = detail::minIgnoreNaN(newMin, regionMin);
+            newMax = detail::maxIgnoreNaN(newMax, regionMax);
+            if(rawCube)
+                exposedRawData.push_back(std::move(rawData));
+        }
+        rangeKnown = true;
+    }
+
+    // The mapped overlap is reused only when the range, and so the mapping, does not change.
+    // The raw cube of the device mapping is always reused, and mapped again.
+    bool incremental = overlaps && rangeKnown && (rawCube || (newMin == oldMin && newMax == oldMax));
+    auto newBuffer = incremental ? computePlatform->createImage3D(rawCube ? PixelFormat::R32F : cubeStorageFormat, newX.size, newY.size, newZ.size) : ComputeBufferPtr();
+    if(!newBuffer)
+    {
+        // Map the whole box again.
+        if(rangeKnown)
+            cubeStatistics.setRegionRange(xSlice, ySlice, getPlaneSlices(cubePlane), newMin, newMax);
+        if(rawCube)
+            computeRawCubeBuffer->destroy();
+        computeRawCubeBuffer.reset();
+        computeCubeBuffer->destroy();
+        computeCubeBuffer.reset();
+        performScaleMapping();
+    }
+    else
+    {
+        auto device = computePlatform->getComputeDevice(0);
+        auto &oldBuffer = rawCube ? computeRawCubeBuffer : computeCubeBuffer;
+        device->copyImage3D(oldBuffer, newBuffer,
+            overlap.x.start - oldBox.x.start, overlap.y.start - oldBox.y.start, overlap.z.start - oldBox.z.start,
+            overlap.x.start - newX.start, overlap.y.start - newY.start, overlap.z.start - newZ.start,
+            overlap.x.size, overlap.y.size, overlap.z.size);
+
+        // Only the exposed regions are read, mapped with the range of the whole box, and written.
+        CubeStatistics exposedRanges;
+        for(size_t i = 0; i < exposedRegions.size(); ++i)
+        {
+            auto &region = exposedRegions[i];
+            auto regionZ = SliceRange(planeOffset + region.z.start, region.z.size);
+            size_t x = region.x.start - newX.start;
+            size_t y = region.y.start - newY.start;
+            size_t z = region.z.start - newZ.start;
+            if(rawCube)
+            {
+                double regionMin, regionMax;
+                auto rawData = i < exposedRawData.size() ? std::move(exposedRawData[i]) : convertCubeRegion(region.x, region.y, regionZ, regionMin, regionMax);
+                device->writeImage3D(newBuffer, x, y, z, region.x.size, region.y.size, region.z.size,
+                    region.x.size*sizeof(float), region.x.size*region.y.size*sizeof(float), rawData.get());
+            }
+            else
+            {
+                auto elementSize = getCubeElementSize();
+                exposedRanges.setRegionRange(region.x, region.y, regionZ, newMin, newMax);
+                auto mappedData = mapCubeRegion(dataScale, region.x, region.y, regionZ, &exposedRanges);
+                device->writeImage3D(newBuffer, x, y, z, region.x.size, region.y.size, region.z.size,
+                    region.x.size*elementSize, region.x.size*region.y.size*elementSize, mappedData.get());
+            }
+        }
+
+        oldBuffer->destroy();
+        oldBuffer = newBuffer;
+        volumeLevelsDirty = true;
+        if(rawCube)
+        {
+            rawCubeMinValue = newMin;
+            rawCubeMaxValue = newMax;
+            computeCubeBuffer->destroy();
+            computeCubeBuffer.reset();
+            mapCubeInDevice(dataScale);
+        }
+
+        rememberPlaneRange(dataScale, cubePlane);
+        printCubeMemoryCost();
+        if(cubePlaneCount > 1)
+            startPlanePrefetch((cubePlane + 1) % cubePlaneCount);
+    }
+
+    printf("Slices: x %d+%d y %d+%d z %d+%d\n", xSlice.start, xSlice.size, ySlice.start, ySlice.size, zSlice.start, zSlice.size);
+    if(pendingDataScale)
+        startRescale(pendingDataScale);
 }
 
 void Application::shutdown()
 {
-    computeCubeBuffer->destroy();
+    if(rescaleThread.joinable())
+        rescaleThread.join();
+    if(refinedRawCubeBuffer)
+        refinedRawCubeBuffer->destroy();
+    cancelPlaneRangeRead();
+    if(rangeCubeFile)
+    {
+        rangeCubeFile->close();
+        delete rangeCubeFile;
+    }
+    finishPlanePrefetch();
+    if(prefetchedCubeBuffer)
+        prefetchedCubeBuffer->destroy();
+    if(computeCubeBuffer)
+        computeCubeBuffer->destroy();
+    destroyVirtualVolume();
+    if(computeRawCubeBuffer)
+        computeRawCubeBuffer->destroy();
+    if(computeBrickRanges)
+        computeBrickRanges->destroy();
+    for(auto &level : computeCubeLevels)
+        level->destroy();
     computeVolumeColorBuffer->destroy();
     raycastProgram->destroy();
     cubeMappingsFloatProgram->destroy();
@@ -472,6 +1881,7 @@ void Application::mainLoop()
     oldTime = SDL_GetTicks();
     lastFpsUpdateTime = oldTime;
     fpsCount = 0;
+    bool firstFrame = true;
 
 	while (!isQuitting)
 	{
@@ -487,6 +1897,11 @@ void Application::mainLoop()
 
         // Display the frame.
 		render();
+        if(firstFrame)
+        {
+            printf("Time to first frame: %u ms\n", SDL_GetTicks() - startupTime);
+            firstFrame = false;
+        }
 
         // Count the FPS.
         ++fpsCount;
@@ -546,6 +1961,29 @@ void Application::update(float delta)
     auto oldPosition = camera->getPosition();
     camera->setPosition(oldPosition + glm::rotate(newRotation, cameraVelocity*(delta*LinearSpeed)));
 
+    // Display the new data scale when it is mapped, and continue with the next one.
+    if(rescaleReady)
+    {
+        finishRescale();
+        if(queuedDataScale)
+        {
+            auto nextDataScale = queuedDataScale;
+            queuedDataScale.reset();
+            setDataScale(nextDataScale);
+        }
+        else if(cubePlaneCount > 1)
+        {
+            startPlanePrefetch((cubePlane + 1) % cubePlaneCount);
+        }
+    }
+
+    if(planeRangeReady)
+        finishPlaneRangeRead();
+
+    // Advance the animation only when the next plane is ready, so that a frame never waits for it.
+    if(playingPlanes && planePrefetchReady)
+        setCubePlane(cubePlane + 1);
+
     char buffer[256];
     auto newPosition = camera->getPosition();
     sprintf(buffer, "x: %f y: %f z: %f", newPosition.x, newPosition.y, newPosition.z);
@@ -575,11 +2013,23 @@ void Application::raycast()
     auto device = computePlatform->getComputeDevice(0);
 
     // Compute the max number of samples
-    auto w = xSlice.size;
-    auto h = ySlice.size;
-    auto d = zSlice.size;
+    auto cubeSize = getCubeBufferSize();
+    auto w = cubeSize.x;
+    auto h = cubeSize.y;
+    auto d = cubeSize.z;
     maxNumberOfSamples = ceil(sqrt(w*w + h*h + d*d) * lengthSamplingFactor);
 
+    // The coarser levels and the brick ranges follow the last mapping of the volume.
+    // The virtual volume uploads the bricks requested by the last frame instead.
+    bool virtualVolume = computeBrickAtlas != nullptr;
+    if(virtualVolume)
+    {
+        if(!updateVirtualVolume())
+            return;
+    }
+    else
+        updateVolumeLevels();
+
     // Acquire shared resources
     renderer->beginCompute();
     computePlatform->beginCompute();
@@ -587,9 +2037,9 @@ void Application::raycast()
     computeColorMap->acquireFromRenderer(device);
 
     // Setup the kernel
-    auto kernel = raycastProgram->createKernel("raycastVolume");
+    auto kernel = raycastProgram->createKernel(virtualVolume ? "raycastVirtualVolume" : "raycastVolume");
 
-    kernel->setBufferArg(0, computeCubeBuffer);
+    kernel->setBufferArg(0, virtualVolume ? computeBrickAtlas : computeCubeBuffer);
     kernel->setBufferArg(1, computeVolumeColorBuffer);
 
     // Pass the camera
@@ -615,12 +2065,34 @@ void Application::raycast()
     kernel->setFloatArg(21, colorBarWidget->getMinValue());
     kernel->setFloatArg(22, colorBarWidget->getMaxValue());
 
+    int arg = 23;
+    if(virtualVolume)
+    {
+        // Virtual volume, and the bricks that it requests.
+        kernel->setBufferArg(arg++, computePageTable);
+        kernel->setFloat4Arg(arg++, glm::vec4(xSlice.size, ySlice.size, zSlice.size, 0.0));
+        kernel->setIntArg(arg++, VirtualBrickSize);
+        kernel->setBufferArg(arg++, computeBrickFeedback);
+        kernel->setIntArg(arg++, brickFeedbackPhase);
+    }
+    else
+    {
+        // Empty space skipping, against the current filter range.
+        kernel->setBufferArg(arg++, computeBrickRanges);
+        kernel->setIntArg(arg++, brickSize);
+
+        // Level of detail, the missing levels are bound to the whole volume.
+        for(int i = 0; i < MaxVolumeLevels - 1; ++i)
+            kernel->setBufferArg(arg++, i < int(computeCubeLevels.size()) ? computeCubeLevels[i] : computeCubeBuffer);
+        kernel->setIntArg(arg++, int(computeCubeLevels.size()) + 1);
+    }
+
     // Color correction
-    kernel->setFloatArg(23, 1.0);
+    kernel->setFloatArg(arg++, 1.0);
 
     // Extra modes
-    kernel->setIntArg(24, averageSamples);
-    kernel->setFloat4Arg(25, sampleColorIntensity);
+    kernel->setIntArg(arg++, averageSamples);
+    kernel->setFloat4Arg(arg++, sampleColorIntensity);
 
     // Run the rendering kernel
     //printf("Render frame %d %d\n", minNumberOfSamples, maxNumberOfSamples);
@@ -704,6 +2176,9 @@ void Application::render()
 
 void Application::onKeyDown(const SDL_KeyboardEvent &event)
 {
+    const int SliceRangeStep = 10;
+    int lastZStart = int(cubeFile->getDepth()) - zSlice.size;
+
     switch(event.keysym.sym)
     {
     case SDLK_ESCAPE:
@@ -743,6 +2218,34 @@ void Application::onKeyDown(const SDL_KeyboardEvent &event)
         colorBarWidget->setMinValue(0.0f);
         colorBarWidget->setMaxValue(1.0f);
         break;
+    case SDLK_PAGEUP:
+        setCubePlane(cubePlane + 1);
+        break;
+    case SDLK_PAGEDOWN:
+        setCubePlane(cubePlane - 1);
+        break;
+    case SDLK_p:
+        // The virtual volume loads the bricks of each plane on demand, so there is no next plane to step into.
+        if(computeBrickAtlas)
+            printf("The planes are not played with a virtual volume, use page up and page down instead.\n");
+        else
+            playingPlanes = !playingPlanes;
+        break;
+    case SDLK_m:
+        selectNextDataScale();
+        break;
+    case SDLK_RIGHTBRACKET:
+        setSliceRanges(xSlice, ySlice, SliceRange(zSlice.start, zSlice.size + SliceRangeStep));
+        break;
+    case SDLK_LEFTBRACKET:
+        setSliceRanges(xSlice, ySlice, SliceRange(zSlice.start, zSlice.size - SliceRangeStep));
+        break;
+    case SDLK_PERIOD:
+        setSliceRanges(xSlice, ySlice, SliceRange(std::min(zSlice.start + SliceRangeStep, lastZStart), zSlice.size));
+        break;
+    case SDLK_COMMA:
+        setSliceRanges(xSlice, ySlice, SliceRange(std::max(zSlice.start - SliceRangeStep, 0), zSlice.size));
+        break;
     }
 }
 
@@ -3,11 +3,16 @@
 
 #include <SDL.h>
 #include <SDL_main.h>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include "SVR/Camera.hpp"
 #include "SVR/Logging.hpp"
 #include "SVR/Renderer.hpp"
 #include "SVR/ComputePlatform.hpp"
 #include "SVR/FitsFile.hpp"
+#include "SVR/CubeCache.hpp"
+#include "SVR/BrickCache.hpp"
 #include "SVR/AABox.hpp"
 #include "SVR/AstronomyMappings.hpp"
 
@@ -20,6 +25,7 @@
 
 #include "ColorMap.hpp"
 #include "DataScale.hpp"
+#include "BrickLoader.hpp"
 
 namespace SVR
 {
@@ -41,6 +47,7 @@ public:
 
     void setDataScale(const DataScalePtr &dataScale);
     void setDataScaleNamed(const std::string &name);
+    void selectNextDataScale();
 
 private:
     void initializeDictionaries();
@@ -48,6 +55,9 @@ private:
     bool createWindowAndContext();
 
     bool initializeScene();
+    FitsFile *openCube();
+    void useCachedCube();
+    void loadCubeStatistics();
     bool initializeTextures();
     bool initializeComputation();
     bool parseCommandLine(int argc, const char **argv);
@@ -68,6 +78,44 @@ private:
     void raycast();
     void update(float delta);
     void performScaleMapping();
+    bool startPreviewVolume();
+    void finishPreviewRefinement();
+    glm::ivec3 getCubeBufferSize() const;
+
+    SliceRange getPlaneSlices(int plane) const;
+    size_t getCubeElementSize() const;
+    void printCubeMemoryCost();
+    std::unique_ptr<uint8_t[]> mapCubePlane(const DataScalePtr &scale, int plane);
+    std::unique_ptr<uint8_t[]> mapCubeRegion(const DataScalePtr &scale, SliceRange x, SliceRange y, SliceRange z,
+        const CubeStatistics *statistics);
+    std::unique_ptr<float[]> sampleCubeRegion(FitsFile *cube, SliceRange x, SliceRange y, SliceRange z, int stride,
+        double &minValue, double &maxValue);
+    std::unique_ptr<float[]> convertCubeRegion(SliceRange x, SliceRange y, SliceRange z, double &minValue, double &maxValue);
+    ComputeBufferPtr createCubeBuffer(const uint8_t *data);
+    void uploadCubeData(const uint8_t *data);
+    ComputeBufferPtr createRawCubeBuffer(int plane, double &minValue, double &maxValue);
+    void replaceRawCubeBuffer(const ComputeBufferPtr &rawCube, double minValue, double maxValue);
+    void mapCubeInDevice(const DataScalePtr &scale);
+    void updateVolumeLevels();
+    bool createVirtualVolume();
+    void destroyVirtualVolume();
+    void resetVirtualVolume();
+    void startPlaneRangeRead(int plane);
+    void finishPlaneRangeRead();
+    void cancelPlaneRangeRead();
+    bool updateVirtualVolume();
+    size_t getVirtualSlotSize() const;
+    glm::ivec3 getVirtualBrickCoord(size_t brick) const;
+    std::unique_ptr<uint8_t[]> mapVirtualBrick(const DataScalePtr &scale, int plane, double minValue, double maxValue, size_t brick);
+    void uploadVirtualBrick(size_t brick, uint32_t slot, const uint8_t *slotData);
+    void rememberPlaneRange(const DataScalePtr &scale, int plane);
+    void setCubePlane(int plane);
+    void setSliceRanges(SliceRange x, SliceRange y, SliceRange z);
+    void startPlanePrefetch(int plane);
+    void finishPlanePrefetch();
+    void discardPlanePrefetch();
+    void startRescale(const DataScalePtr &scale);
+    void finishRescale();
 
     void onKeyDown(const SDL_KeyboardEvent &event);
     void onKeyUp(const SDL_KeyboardEvent &event);
@@ -135,11 +183,68 @@ private:
     ComputeBufferPtr computeVolumeColorBuffer;
     ComputeBufferPtr computeCubeBuffer;
 
+    // The format of the sampled volume: L8, R16 or R32F.
+    PixelFormat cubeStorageFormat;
+
+    // The physical values of the displayed plane, that are mapped in the device for each data scale.
+    bool deviceScaleMapping;
+    ComputeBufferPtr computeRawCubeBuffer;
+    double rawCubeMinValue, rawCubeMaxValue;
+
+    // The coarser levels of the mapped volume, for the level of detail of the raycast,
+    // and the range of each of their bricks, for skipping the empty space.
+    static const int MaxVolumeLevels = 4;
+    int volumeLevelCount;
+    int brickSize;
+    bool volumeLevelsDirty;
+    std::vector<ComputeBufferPtr> computeCubeLevels;
+    ComputeBufferPtr computeBrickRanges;
+
+    // The virtual volume keeps the requested bricks of the viewed box in a brick atlas.
+    // The raycast reports the missing bricks in the brick feedback, which the brick loader
+    // maps in background, nearest first. The loaded bricks are uploaded within a budget per frame.
+    static const int VirtualBrickSize = 32;
+    size_t virtualVolumeBudget;
+    size_t brickUploadBudget;
+    uint64_t virtualFrame;
+    BrickCache brickCache;
+    BrickLoader brickLoader;
+    ComputeBufferPtr computeBrickAtlas;
+    ComputeBufferPtr computePageTable;
+    ComputeBufferPtr computeBrickFeedback;
+    std::vector<float> brickFeedback;
+    int brickFeedbackPhase;
+    glm::ivec3 pageTableSize;
+    glm::ivec3 atlasSlotCount;
+    double virtualMinValue, virtualMaxValue;
+
+    // Without cube statistics, the virtual volume starts with the range of a strided sample of the
+    // plane, and a thread reads the exact range with its own instance of the cube.
+    FitsFile *rangeCubeFile;
+    std::thread planeRangeThread;
+    std::atomic<bool> planeRangeReady;
+    std::atomic<bool> planeRangeCancelled;
+    int rangedPlane;
+    double planeRangeMinValue, planeRangeMaxValue;
+
     CameraPtr camera;
 
     // Input data
     std::string cubeFileName;
+    std::string cubeListFileName;
+    std::string cubeGlobPattern;
     FitsFile *cubeFile;
+    FitsAccessMode cubeAccessMode;
+    int cubeHdu;
+    bool saveHduIndex;
+    bool saveStatistics;
+    FitsReadAhead cubeReadAhead;
+    bool cubeHugePages;
+
+    // Preprocessed cube cache
+    bool useCubeCache;
+    std::string cubeCacheDirectory;
+    CubeStatistics cubeStatistics;
 
     // Movement
     glm::vec3 cameraVelocity;
@@ -151,6 +256,35 @@ private:
     SliceRange ySlice;
     SliceRange zSlice;
 
+    // Plane of the axes after the third one, such as time or Stokes.
+    int cubePlane;
+    int cubePlaneCount;
+    bool playingPlanes;
+
+    // The next plane is mapped and uploaded in background.
+    std::thread planePrefetchThread;
+    std::atomic<bool> planePrefetchReady;
+    int prefetchedPlane;
+    DataScalePtr prefetchedDataScale;
+    ComputeBufferPtr prefetchedCubeBuffer;
+    double prefetchedMinValue, prefetchedMaxValue;
+
+    // A new data scale is mapped in background, while the old volume is displayed.
+    std::thread rescaleThread;
+    std::atomic<bool> rescaleReady;
+    DataScalePtr rescaleDataScale;
+    DataScalePtr queuedDataScale;
+    std::unique_ptr<uint8_t[]> rescaledData;
+    unsigned int rescaleStartTime;
+
+    // At start-up, a strided preview of the volume is displayed while the rescaling thread
+    // maps the whole volume with the same scale.
+    int previewSize;
+    bool previewing;
+    glm::ivec3 previewCubeSize;
+    ComputeBufferPtr refinedRawCubeBuffer;
+    double refinedMinValue, refinedMaxValue;
+    unsigned int startupTime;
 
     // UI
     ContainerWidgetPtr screenWidget;
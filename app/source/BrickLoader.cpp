@@ -0,0 +1,144 @@
+#include <algorithm>
+#include "BrickLoader.hpp"
+
+namespace SVR
+{
+
+static const size_t NoBrick = ~size_t(0);
+
+BrickLoader::BrickLoader()
+    : stopping(false), generation(0), loadingBrick(NoBrick), maxLoadedBricks(1)
+{
+}
+
+BrickLoader::~BrickLoader()
+{
+    stop();
+}
+
+void BrickLoader::start(size_t newMaxLoadedBricks)
+{
+    stop();
+    stopping = false;
+    maxLoadedBricks = std::max(size_t(1), newMaxLoadedBricks);
+    thread = std::thread([this]() {
+        run();
+    });
+}
+
+void BrickLoader::stop()
+{
+    if(!thread.joinable())
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+        requests.clear();
+        loadedBricks.clear();
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+void BrickLoader::setLoadFunction(const LoadFunction &newLoad)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    load = newLoad;
+    ++generation;
+    requests.clear();
+    loadedBricks.clear();
+    condition.notify_all();
+}
+
+void BrickLoader::request(size_t brick, float priority, uint64_t frame)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if(brick == loadingBrick)
+        return;
+    for(auto &loaded : loadedBricks)
+    {
+        if(loaded.brick == brick)
+            return;
+    }
+
+    auto it = requests.find(brick);
+    if(it != requests.end())
+    {
+        it->second.frame = frame;
+        return;
+    }
+
+    requests[brick] = Request{priority, frame};
+    condition.notify_all();
+}
+
+void BrickLoader::prioritize(const PriorityFunction &priority)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for(auto it = requests.begin(); it != requests.end(); )
+    {
+        it->second.priority = priority(it->first, it->second.frame);
+        if(it->second.priority < 0.0f)
+            it = requests.erase(it);
+        else
+            ++it;
+    }
+}
+
+void BrickLoader::takeLoadedBricks(size_t maxCount, std::vector<LoadedBrick> &bricks)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!loadedBricks.empty() && bricks.size() < maxCount)
+    {
+        bricks.push_back(std::move(loadedBricks.front()));
+        loadedBricks.pop_front();
+    }
+    condition.notify_all();
+}
+
+size_t BrickLoader::getRequestCount()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return requests.size();
+}
+
+void BrickLoader::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;)
+    {
+        condition.wait(lock, [this]() {
+            return stopping || (!requests.empty() && loadedBricks.size() < maxLoadedBricks);
+        });
+        if(stopping)
+            break;
+
+        // Load the request with the lowest priority value, without holding the lock.
+        auto best = requests.begin();
+        for(auto it = requests.begin(); it != requests.end(); ++it)
+        {
+            if(it->second.priority < best->second.priority)
+                best = it;
+        }
+
+        auto brick = best->first;
+        auto loadGeneration = generation;
+        auto loadFunction = load;
+        requests.erase(best);
+        loadingBrick = brick;
+
+        lock.unlock();
+        std::unique_ptr<uint8_t[]> data;
+        if(loadFunction)
+            data = loadFunction(brick);
+        lock.lock();
+
+        // The bricks of a cancelled function are discarded.
+        loadingBrick = NoBrick;
+        if(data && loadGeneration == generation && !stopping)
+            loadedBricks.push_back(LoadedBrick{brick, std::move(data)});
+    }
+}
+
+} // namespace SVR
@@ -0,0 +1,77 @@
+#ifndef _SVR_BRICK_LOADER_HPP_
+#define _SVR_BRICK_LOADER_HPP_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace SVR
+{
+
+/**
+ * Background loader of the bricks of a virtual volume. The requests are
+ * loaded from the lowest priority value, and the loaded bricks wait in a
+ * bounded queue until they are taken for the upload.
+ */
+class BrickLoader
+{
+public:
+    typedef std::function<std::unique_ptr<uint8_t[]> (size_t brick)> LoadFunction;
+
+    // Returns the new priority of a request, or a negative value to cancel it.
+    typedef std::function<float (size_t brick, uint64_t lastRequestFrame)> PriorityFunction;
+
+    struct LoadedBrick
+    {
+        size_t brick;
+        std::unique_ptr<uint8_t[]> data;
+    };
+
+    BrickLoader();
+    ~BrickLoader();
+
+    void start(size_t maxLoadedBricks);
+    void stop();
+
+    // The requests and the loaded bricks of the previous function are discarded.
+    void setLoadFunction(const LoadFunction &load);
+
+    // A brick that is requested again keeps its place until the next prioritize.
+    void request(size_t brick, float priority, uint64_t frame);
+    void prioritize(const PriorityFunction &priority);
+
+    void takeLoadedBricks(size_t maxCount, std::vector<LoadedBrick> &bricks);
+
+    size_t getRequestCount();
+
+private:
+    void run();
+
+    struct Request
+    {
+        float priority;
+        uint64_t frame;
+    };
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+
+    LoadFunction load;
+    uint64_t generation;
+    std::unordered_map<size_t, Request> requests;
+    size_t loadingBrick;
+    std::deque<LoadedBrick> loadedBricks;
+    size_t maxLoadedBricks;
+};
+
+} // namespace SVR
+
+#endif //_SVR_BRICK_LOADER_HPP_
@@ -2,6 +2,7 @@
 #define _SVR_DATASCALE_HPP_
 
 #include "SVR/AstronomyMappings.hpp"
+#include "SVR/ComputePlatform.hpp"
 #include "SVR/Interface.hpp"
 
 namespace SVR
@@ -13,15 +14,118 @@ DECLARE_INTERFACE(DataScale)
  */
 struct DataScale: public Interface
 {
-    virtual void mapFitsIntoFits(FitsFile *input,  FitsFile *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange()) = 0;
+    virtual void mapFitsIntoFits(FitsFile *input,  FitsFile *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange(),
+        const CubeStatistics *statistics=nullptr) = 0;
 
-    virtual void mapFitsIntoU8(FitsFile *input, uint8_t *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange()) = 0;
+    virtual void mapFitsIntoU8(FitsFile *input, uint8_t *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange(),
+        const CubeStatistics *statistics=nullptr) = 0;
+
+    virtual void mapFitsIntoU16(FitsFile *input, uint16_t *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange(),
+        const CubeStatistics *statistics=nullptr) = 0;
+
+    // The values are saturated into [0, 1] and NaN is stored as zero, as in the integer outputs.
+    virtual void mapFitsIntoFloat(FitsFile *input, float *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange(),
+        const CubeStatistics *statistics=nullptr) = 0;
+
+    // Maps an image of physical values into the mapped image, in the compute device.
+    virtual bool mapImageInDevice(ComputeDevice *device, const ComputeProgramPtr &program, const ComputeBufferPtr &rawCube,
+        const ComputeBufferPtr &mappedCube, size_t width, size_t height, size_t depth, double minValue, double maxValue) = 0;
 
     virtual double mapValue(double value) = 0;
     virtual double unmapValue(double value) = 0;
 
+    // The range of the last mapped region.
+    virtual void getRange(double &minValue, double &maxValue) const = 0;
+
+    // Sets up the mapping for a known range, without mapping any region.
+    virtual void setRange(double minValue, double maxValue) = 0;
+
+    // A copy of the scale, for mapping in another thread.
+    virtual DataScalePtr copy() const = 0;
 };
 
+/**
+ * Saturates mapped float values into [0, 1], and replaces NaN with zero.
+ */
+inline void saturateMappedValues(float *values, size_t count)
+{
+    const size_t ChunkSize = detail::ParallelChunkElements;
+    ThreadPool::getDefault().parallelFor((count + ChunkSize - 1) / ChunkSize, [&](size_t chunk) {
+        auto end = std::min(count, (chunk + 1)*ChunkSize);
+        for(size_t i = chunk*ChunkSize; i < end; ++i)
+            values[i] = isnan(values[i]) ? 0.0f : std::min(1.0f, std::max(0.0f, values[i]));
+    });
+}
+
+/**
+ * Kernels of data/kernels/cubeMappingsFloat.cl. The mapping parameters follow
+ * the raw and the mapped cube arguments.
+ */
+inline ComputeKernelPtr createMappingKernel(const ComputeProgramPtr &program, const LinearMapping &mapping)
+{
+    auto kernel = program->createKernel("cubeLinearMapping");
+    if(kernel)
+        kernel->setFloatArg(2, mapping.invMaxValue);
+    return kernel;
+}
+
+inline ComputeKernelPtr createMappingKernel(const ComputeProgramPtr &program, const LogMapping &mapping)
+{
+    auto kernel = program->createKernel("cubeLogMapping");
+    if(kernel)
+    {
+        kernel->setFloatArg(2, mapping.exponent);
+        kernel->setFloatArg(3, mapping.numberOfColors);
+        kernel->setFloatArg(4, mapping.norm);
+        kernel->setFloatArg(5, mapping.invMaxValue);
+    }
+    return kernel;
+}
+
+inline ComputeKernelPtr createMappingKernel(const ComputeProgramPtr &program, const SquareMapping &mapping)
+{
+    auto kernel = program->createKernel("cubeSquareMapping");
+    if(kernel)
+    {
+        kernel->setFloatArg(2, mapping.invMaxValue);
+        kernel->setFloatArg(3, mapping.norm);
+    }
+    return kernel;
+}
+
+inline ComputeKernelPtr createMappingKernel(const ComputeProgramPtr &program, const SquareRootMapping &mapping)
+{
+    auto kernel = program->createKernel("cubeSqrtMapping");
+    if(kernel)
+    {
+        kernel->setFloatArg(2, mapping.invMaxValue);
+        kernel->setFloatArg(3, mapping.norm);
+    }
+    return kernel;
+}
+
+inline ComputeKernelPtr createMappingKernel(const ComputeProgramPtr &program, const SinhMapping &mapping)
+{
+    auto kernel = program->createKernel("cubeSinhMapping");
+    if(kernel)
+    {
+        kernel->setFloatArg(2, mapping.invMaxValue);
+        kernel->setFloatArg(3, mapping.norm);
+    }
+    return kernel;
+}
+
+inline ComputeKernelPtr createMappingKernel(const ComputeProgramPtr &program, const ASinhMapping &mapping)
+{
+    auto kernel = program->createKernel("cubeASinhMapping");
+    if(kernel)
+    {
+        kernel->setFloatArg(2, mapping.invMaxValue);
+        kernel->setFloatArg(3, mapping.norm);
+    }
+    return kernel;
+}
+
 /**
  * Data scale used in astronomy
  */
@@ -29,14 +133,44 @@ template<typename AstronomyMapping>
 class AstronomyDataScale: public DataScale
 {
 public:
-    virtual void mapFitsIntoFits(FitsFile *input,  FitsFile *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange())
+    virtual void mapFitsIntoFits(FitsFile *input,  FitsFile *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange(),
+        const CubeStatistics *statistics=nullptr)
+    {
+        ::SVR::mapFitsIntoFits(mapping, input, output, x, y, z, statistics);
+    }
+
+    virtual void mapFitsIntoU8(FitsFile *input, uint8_t *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange(),
+        const CubeStatistics *statistics=nullptr)
+    {
+        ::SVR::mapFitsInto(mapping, input, output, x, y, z, statistics);
+    }
+
+    virtual void mapFitsIntoU16(FitsFile *input, uint16_t *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange(),
+        const CubeStatistics *statistics=nullptr)
     {
-        ::SVR::mapFitsIntoFits(mapping, input, output, x, y, z);
+        ::SVR::mapFitsInto(mapping, input, output, x, y, z, statistics);
     }
 
-    virtual void mapFitsIntoU8(FitsFile *input, uint8_t *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange())
+    virtual void mapFitsIntoFloat(FitsFile *input, float *output, SliceRange x=SliceRange(), SliceRange y=SliceRange(), SliceRange z=SliceRange(),
+        const CubeStatistics *statistics=nullptr)
     {
-        ::SVR::mapFitsInto(mapping, input, output, x, y, z);
+        ::SVR::mapFitsInto(mapping, input, output, x, y, z, statistics);
+        if(x.size > 0 && y.size > 0 && z.size > 0)
+            saturateMappedValues(output, size_t(x.size)*y.size*z.size);
+    }
+
+    virtual bool mapImageInDevice(ComputeDevice *device, const ComputeProgramPtr &program, const ComputeBufferPtr &rawCube,
+        const ComputeBufferPtr &mappedCube, size_t width, size_t height, size_t depth, double minValue, double maxValue)
+    {
+        mapping.setup(minValue, maxValue);
+        auto kernel = createMappingKernel(program, mapping);
+        if(!kernel)
+            return false;
+
+        kernel->setBufferArg(0, rawCube);
+        kernel->setBufferArg(1, mappedCube);
+        device->runGlobalKernel3D(kernel, width, height, depth);
+        return true;
     }
 
     virtual double mapValue(double value)
@@ -49,6 +183,22 @@ public:
         return mapping.unmap(value);
     }
 
+    virtual void getRange(double &minValue, double &maxValue) const
+    {
+        minValue = mapping.minValue;
+        maxValue = mapping.maxValue;
+    }
+
+    virtual void setRange(double minValue, double maxValue)
+    {
+        mapping.setup(minValue, maxValue);
+    }
+
+    virtual DataScalePtr copy() const
+    {
+        return std::make_shared<AstronomyDataScale<AstronomyMapping>> (*this);
+    }
+
 private:
     AstronomyMapping mapping;
 };
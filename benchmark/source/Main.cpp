@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include "SVR/AstronomyMappings.hpp"
+#include "SVR/FitsFile.hpp"
+#include "SVR/SimdKernels.hpp"
+
+using namespace SVR;
+
+std::string cubeFileName;
+FitsAccessMode accessMode = FitsAccessMode::Mapped;
+SliceRange xSlice, ySlice, zSlice;
+int repetitions = 1;
+bool keepPageCache = false;
+
+void printHelp()
+{
+    printf(
+"svrbench [options] -cube cubeFile\n"
+"-cube      <filename>  The data cube to map\n"
+"-windowed              Only map the cube regions that are read.\n"
+"-streamed              Read the cube in blocks with pread, instead of mapping it.\n"
+"-streamedDirect        Streamed, bypassing the page cache with O_DIRECT.\n"
+"-repeat    <int>       Number of runs of each read ahead mode.\n"
+"-keepPageCache         Do not drop the cube from the page cache between runs.\n"
+"-xSlice  <start> <size>       X axis slice.\n"
+"-ySlice  <start> <size>       Y axis slice.\n"
+"-zSlice  <start> <size>       Z axis slice.\n"
+"The SVR_SIMD environment variable limits the kernels to scalar, sse4.1, avx2 or avx512.\n"
+    );
+}
+
+bool parseCommandLine(int argc, const char **argv)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "-cube") && argv[++i])
+        {
+            cubeFileName = argv[i];
+        }
+        else if(!strcmp(argv[i], "-windowed"))
+        {
+            accessMode = FitsAccessMode::Windowed;
+        }
+        else if(!strcmp(argv[i], "-streamed"))
+        {
+            accessMode = FitsAccessMode::Streamed;
+        }
+        else if(!strcmp(argv[i], "-streamedDirect"))
+        {
+            accessMode = FitsAccessMode::StreamedDirect;
+        }
+        else if(!strcmp(argv[i], "-repeat") && argv[++i])
+        {
+            repetitions = atoi(argv[i]);
+        }
+        else if(!strcmp(argv[i], "-keepPageCache"))
+        {
+            keepPageCache = true;
+        }
+        else if(!strcmp(argv[i], "-xSlice") && (++i) + 2 <= argc)
+        {
+            xSlice = SliceRange(atoi(argv[i]), atoi(argv[i+1]));
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-ySlice") && (++i) + 2 <= argc)
+        {
+            ySlice = SliceRange(atoi(argv[i]), atoi(argv[i+1]));
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-zSlice") && (++i) + 2 <= argc)
+        {
+            zSlice = SliceRange(atoi(argv[i]), atoi(argv[i+1]));
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-h"))
+        {
+            printHelp();
+            exit(0);
+        }
+    }
+
+    return !cubeFileName.empty();
+}
+
+void clampSlice(SliceRange &slice, size_t size)
+{
+    if(!slice.isValid())
+        slice.setWholeSize(size);
+    else
+        slice.clampToRange(0, size);
+}
+
+void runMapping(FitsReadAhead readAhead, const char *name)
+{
+    auto cube = FitsFile::open(cubeFileName.c_str(), false, accessMode);
+    if(!cube)
+        return;
+
+    clampSlice(xSlice, cube->getWidth());
+    clampSlice(ySlice, cube->getHeight());
+    clampSlice(zSlice, cube->getDepth());
+
+    // Start from a cold page cache, so that the major faults are visible.
+    if(!keepPageCache)
+        cube->adviseAccess(MemoryAccessHint::DontNeed);
+
+    cube->setReadAhead(readAhead);
+    // Fault in the output, so that only the cube faults are measured.
+    auto outputSize = size_t(xSlice.size)*ySlice.size*zSlice.size;
+    std::unique_ptr<uint8_t[]> output(new uint8_t[outputSize]);
+    memset(output.get(), 0, outputSize);
+
+    auto usageBefore = cube->getMemoryUsage();
+    auto startTime = std::chrono::steady_clock::now();
+
+    LinearMapping mapping;
+    mapFitsInto(mapping, cube, output.get(), xSlice, ySlice, zSlice);
+
+    auto endTime = std::chrono::steady_clock::now();
+    auto usageAfter = cube->getMemoryUsage();
+
+    auto milliseconds = std::chrono::duration<double, std::milli> (endTime - startTime).count();
+    printf("%-10s %10.1f ms %10ld %10ld\n", name, milliseconds,
+        usageAfter.minorPageFaults - usageBefore.minorPageFaults,
+        usageAfter.majorPageFaults - usageBefore.majorPageFaults);
+
+    cube->close();
+    delete cube;
+}
+
+int main(int argc, const char **argv)
+{
+    if(!parseCommandLine(argc, argv))
+    {
+        printHelp();
+        return -1;
+    }
+
+    printf("kernels: %s\n", getSimdKernels().name);
+
+    // The faults of the whole process, which include the mapping workers and the prefetching thread.
+    printf("%-10s %13s %10s %10s\n", "read ahead", "time", "minor", "major");
+    for(int i = 0; i < repetitions; ++i)
+    {
+        runMapping(FitsReadAhead::None, "none");
+        runMapping(FitsReadAhead::Hints, "hints");
+        runMapping(FitsReadAhead::Prefetch, "prefetch");
+    }
+
+    return 0;
+}
@@ -2,10 +2,16 @@
 #define _SVR_ASTRONOMY_MAPPINGS_HPP_
 
 #include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <vector>
 #include <math.h>
+#include "SVR/CubeStatistics.hpp"
 #include "SVR/FitsFile.hpp"
 #include "SVR/Endianness.hpp"
 #include "SVR/ChannelTypes.hpp"
+#include "SVR/SimdKernels.hpp"
+#include "SVR/ThreadPool.hpp"
 
 namespace SVR
 {
@@ -206,6 +212,30 @@ struct ASinhMapping : SimpleMapping
     }
 };
 
+/**
+ * Identity mapping, that keeps the physical values. It is used for
+ * converting a cube into floats, and for getting its range.
+ */
+struct PhysicalMapping : SimpleMapping
+{
+    void setup(double minValue, double maxValue)
+    {
+        this->minValue = minValue;
+        this->maxValue = maxValue;
+        this->invMaxValue = 1.0 / maxValue;
+    }
+
+    double map(double v)
+    {
+        return v;
+    }
+
+    double unmap(double v)
+    {
+        return v;
+    }
+};
+
 namespace detail
 {
 template<typename T>
@@ -234,107 +264,558 @@ T maxIgnoreNaN(T a, T b)
 		return b;
 }
 
-template<typename FromType, typename Mapping, typename ToType>
-void mapFromTypeInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z)
+/**
+ * Converts raw FITS values into physical values, using BSCALE and BZERO.
+ * Integer BLANK values are converted into NaN.
+ */
+template<typename FromType, bool Scaled, bool Blank>
+struct PhysicalValue
+{
+    PhysicalValue(const FitsHeaderKeywords &keywords)
+        : bscale(keywords.bscale), bzero(keywords.bzero), blank(FromType(keywords.blank)) {}
+
+    double operator()(FromType raw) const
+    {
+        if(Blank && raw == blank)
+            return NAN;
+        if(Scaled)
+            return raw*bscale + bzero;
+        return raw;
+    }
+
+    double bscale;
+    double bzero;
+    FromType blank;
+};
+
+/**
+ * Reads a raw value, in the FITS big endian or in the native byte order.
+ */
+template<typename FromType, bool BigEndian>
+inline FromType loadRawValue(const FromType &value)
+{
+    return BigEndian ? swapBytes<FromType> (value) : value;
+}
+
+template<typename FromType>
+bool hasBlankValue(const FitsHeaderKeywords &keywords)
+{
+    return std::is_integral<FromType>::value && keywords.hasBlank;
+}
+
+/**
+ * Converts a mapped value in the [0, 1] range into the destination type.
+ * Integer destinations are saturated, and NaN is converted into zero.
+ */
+template<typename ToType>
+ToType normalizedValue(double value)
+{
+    auto scaled = value*normalizationConstant<ToType> ();
+    if(!std::is_integral<ToType>::value)
+        return ToType(scaled);
+
+    if(isnan(scaled))
+        return 0;
+    scaled = std::max(scaled, double(std::numeric_limits<ToType>::min()));
+    scaled = std::min(scaled, double(std::numeric_limits<ToType>::max()));
+    return ToType(scaled);
+}
+
+/**
+ * The rows of each block are split in chunks of a fixed size, that are
+ * processed in parallel. The chunks do not depend on the number of threads,
+ * and their ranges are merged in order, so the results are deterministic.
+ */
+const size_t ParallelChunkElements = 1 << 16;
+
+inline int rowsPerParallelChunk(size_t rowElements)
 {
-    int minX = x.start;
-    int maxX = minX + x.size;
-    int minY = y.start;
-    int maxY = minY + y.size;
-    int minZ = z.start;
-    int maxZ = minZ + z.size;
+    return int(std::max(size_t(1), ParallelChunkElements / std::max(size_t(1), rowElements)));
+}
 
+template<typename Body>
+void parallelRowChunks(int rowCount, size_t rowElements, const Body &body)
+{
+    int rowsPerChunk = rowsPerParallelChunk(rowElements);
+    size_t chunkCount = (rowCount + rowsPerChunk - 1) / rowsPerChunk;
+    ThreadPool::getDefault().parallelFor(chunkCount, [&](size_t chunk) {
+        int firstRow = int(chunk)*rowsPerChunk;
+        body(firstRow, std::min(rowsPerChunk, rowCount - firstRow));
+    });
+}
+
+template<typename Body>
+void parallelRowChunksRange(int rowCount, size_t rowElements, double &minValue, double &maxValue, const Body &body)
+{
+    int rowsPerChunk = rowsPerParallelChunk(rowElements);
+    size_t chunkCount = (rowCount + rowsPerChunk - 1) / rowsPerChunk;
+    std::vector<double> chunkMin(chunkCount, NAN);
+    std::vector<double> chunkMax(chunkCount, NAN);
+    ThreadPool::getDefault().parallelFor(chunkCount, [&](size_t chunk) {
+        int firstRow = int(chunk)*rowsPerChunk;
+        body(firstRow, std::min(rowsPerChunk, rowCount - firstRow), chunkMin[chunk], chunkMax[chunk]);
+    });
+
+    for(size_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        minValue = minIgnoreNaN(minValue, chunkMin[chunk]);
+        maxValue = maxIgnoreNaN(maxValue, chunkMax[chunk]);
+    }
+}
+
+/**
+ * Computes the range of the physical values of a region in double precision,
+ * unless the statistics already have it.
+ */
+template<typename FromType, bool BigEndian, typename Converter>
+void computePhysicalRange(const Converter &converter, FitsFile *input, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics, double &minValue, double &maxValue)
+{
     int sourcePitch = input->getWidth();
-    int sourceSlicePitch = sourcePitch*input->getHeight();
-
-    auto sourceStart = reinterpret_cast<const FromType*> (input->getImageData()) +
-                minZ*sourceSlicePitch + minY*sourcePitch + minX;
-    auto normConstant = normalizationConstant<ToType> ();
-
-    // Compute min and max
-    FromType minValue, maxValue;
-    minValue = maxValue = (swapBytes<FromType> (*sourceStart));
-    auto sourceSlice = sourceStart;
-    for(int z = minZ; z < maxZ; ++z, sourceSlice += sourceSlicePitch)
-    {
-        auto sourceRow = sourceSlice;
-        for(int y = minY; y < maxY; ++y, sourceRow += sourcePitch)
-        {
-            auto sourceElement = sourceRow;
-            for(int x = minX; x < maxX; ++x, ++sourceElement)
+    int columnCount = x.size;
+    minValue = maxValue = NAN;
+    if(statistics && statistics->getRegionRange(input, x, y, z, minValue, maxValue))
+        return;
+
+    input->readRowBlocks(x, y, z, [&](const char *rows, int, int, int rowCount) {
+        parallelRowChunksRange(rowCount, columnCount, minValue, maxValue, [&](int firstRow, int chunkRowCount, double &chunkMin, double &chunkMax) {
+            auto sourceRow = reinterpret_cast<const FromType*> (rows) + firstRow*sourcePitch;
+            for(int row = 0; row < chunkRowCount; ++row, sourceRow += sourcePitch)
             {
-                auto value = swapBytes<FromType> (*sourceElement);
-                minValue = minIgnoreNaN(minValue, value);
-                maxValue = maxIgnoreNaN(maxValue, value);
+                auto sourceElement = sourceRow;
+                for(int column = 0; column < columnCount; ++column, ++sourceElement)
+                {
+                    auto value = converter(loadRawValue<FromType, BigEndian> (*sourceElement));
+                    chunkMin = minIgnoreNaN(chunkMin, value);
+                    chunkMax = maxIgnoreNaN(chunkMax, value);
+                }
             }
-        }
-    }
+        });
+    });
+}
 
+template<typename FromType, bool BigEndian, typename Converter, typename Mapping, typename ToType>
+void mapPhysicalFromTypeInto(const Converter &converter, Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics)
+{
+    int sourcePitch = input->getWidth();
+    int columnCount = x.size;
+
+    double minValue, maxValue;
+    computePhysicalRange<FromType, BigEndian> (converter, input, x, y, z, statistics, minValue, maxValue);
     mapping.setup(minValue, maxValue);
 
-    sourceSlice = sourceStart;
-    for(int z = minZ; z < maxZ; ++z, sourceSlice += sourceSlicePitch)
+    // The blocks come in the order of the destination, and each chunk maps its own rows.
+    input->readRowBlocks(x, y, z, [&](const char *rows, int, int, int rowCount) {
+        parallelRowChunks(rowCount, columnCount, [&](int firstRow, int chunkRowCount) {
+            Mapping chunkMapping = mapping;
+            auto sourceRow = reinterpret_cast<const FromType*> (rows) + firstRow*sourcePitch;
+            auto chunkDest = dest + size_t(firstRow)*columnCount;
+            for(int row = 0; row < chunkRowCount; ++row, sourceRow += sourcePitch)
+            {
+                auto sourceElement = sourceRow;
+                for(int column = 0; column < columnCount; ++column, ++sourceElement)
+                {
+                    *chunkDest++ = normalizedValue<ToType> (chunkMapping.map(converter(loadRawValue<FromType, BigEndian> (*sourceElement))));
+                }
+            }
+        });
+        dest += size_t(rowCount)*columnCount;
+    });
+}
+
+/**
+ * The formats whose raw values are exact in single precision are converted
+ * by the vector kernels, when they are not scaled.
+ */
+template<typename FromType>
+struct SimdRowConverter : std::false_type {};
+
+template<>
+struct SimdRowConverter<uint8_t> : std::true_type
+{
+    static void apply(const SimdKernels &kernels, const char *row, float *dest, size_t count, const PhysicalConversion &conversion)
+    {
+        kernels.convertUInt8(reinterpret_cast<const uint8_t*> (row), dest, count, conversion);
+    }
+};
+
+template<>
+struct SimdRowConverter<int16_t> : std::true_type
+{
+    static void apply(const SimdKernels &kernels, const char *row, float *dest, size_t count, const PhysicalConversion &conversion)
+    {
+        kernels.convertInt16(reinterpret_cast<const int16_t*> (row), dest, count, conversion);
+    }
+};
+
+template<>
+struct SimdRowConverter<float> : std::true_type
+{
+    static void apply(const SimdKernels &kernels, const char *row, float *dest, size_t count, const PhysicalConversion &conversion)
+    {
+        kernels.convertFloat(reinterpret_cast<const float*> (row), dest, count, conversion);
+    }
+};
+
+/**
+ * Maps a row of physical values. Only the linear mapping into integers has a
+ * vector kernel, the other mappings are applied in double precision.
+ */
+template<typename Mapping, typename ToType>
+void mapPhysicalRow(const SimdKernels &, Mapping &mapping, const float *values, ToType *dest, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        dest[i] = normalizedValue<ToType> (mapping.map(values[i]));
+}
+
+inline void mapPhysicalRow(const SimdKernels &kernels, LinearMapping &mapping, const float *values, uint8_t *dest, size_t count)
+{
+    kernels.scaleToUInt8(values, count, float(mapping.invMaxValue*normalizationConstant<uint8_t> ()), dest);
+}
+
+inline void mapPhysicalRow(const SimdKernels &kernels, LinearMapping &mapping, const float *values, uint16_t *dest, size_t count)
+{
+    kernels.scaleToUInt16(values, count, float(mapping.invMaxValue*normalizationConstant<uint16_t> ()), dest);
+}
+
+/**
+ * 8 and 16 bit values are mapped with a table of every raw value, indexed by
+ * the stored bits, so the mapping functions are only evaluated once per value.
+ */
+template<typename FromType>
+struct HasMappingTable : std::integral_constant<bool, std::is_integral<FromType>::value && sizeof(FromType) <= 2> {};
+
+/**
+ * Building the table maps every raw value, so it only pays off for regions
+ * with more elements than the table, such as whole slabs of 16 bit values.
+ */
+template<typename FromType>
+inline bool useMappingTable(const SliceRange &x, const SliceRange &y, const SliceRange &z)
+{
+    typedef typename std::make_unsigned<FromType>::type RawBits;
+    return size_t(x.size)*size_t(y.size)*size_t(z.size) > size_t(std::numeric_limits<RawBits>::max()) + 1;
+}
+
+template<typename FromType, bool BigEndian, bool SwapOutput, typename Mapping, typename ToType>
+void buildMappingTable(Mapping &mapping, const FitsHeaderKeywords &keywords, std::vector<ToType> &table)
+{
+    typedef typename std::make_unsigned<FromType>::type RawBits;
+    PhysicalValue<FromType, true, false> converter(keywords);
+    bool blank = hasBlankValue<FromType> (keywords);
+    auto blankValue = FromType(keywords.blank);
+
+    table.resize(size_t(std::numeric_limits<RawBits>::max()) + 1);
+    for(size_t bits = 0; bits < table.size(); ++bits)
     {
-        auto sourceRow = sourceSlice;
-        for(int y = minY; y < maxY; ++y, sourceRow += sourcePitch)
-        {
-            auto sourceElement = sourceRow;
-            for(int x = minX; x < maxX; ++x, ++sourceElement)
+        auto raw = loadRawValue<FromType, BigEndian> (FromType(RawBits(bits)));
+        auto value = blank && raw == blankValue ? NAN : converter(raw);
+        auto mapped = normalizedValue<ToType> (mapping.map(value));
+        table[bits] = SwapOutput ? swapBytes<ToType> (mapped) : mapped;
+    }
+}
+
+template<typename FromType, bool BigEndian, typename Mapping, typename ToType>
+void mapTableFromTypeInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z)
+{
+    typedef typename std::make_unsigned<FromType>::type RawBits;
+    std::vector<ToType> table;
+    buildMappingTable<FromType, BigEndian, false> (mapping, input->getKeywords(), table);
+
+    size_t sourcePitch = input->getWidth();
+    size_t columnCount = x.size;
+    input->readRowBlocks(x, y, z, [&](const char *rows, int, int, int rowCount) {
+        parallelRowChunks(rowCount, columnCount, [&](int firstRow, int chunkRowCount) {
+            auto sourceRow = reinterpret_cast<const RawBits*> (rows) + firstRow*sourcePitch;
+            auto chunkDest = dest + size_t(firstRow)*columnCount;
+            for(int row = 0; row < chunkRowCount; ++row, sourceRow += sourcePitch)
             {
-                *dest++ = ToType(mapping.map(swapBytes<FromType> (*sourceElement)) * normConstant);
+                for(size_t column = 0; column < columnCount; ++column)
+                    *chunkDest++ = table[sourceRow[column]];
             }
-        }
+        });
+        dest += size_t(rowCount)*columnCount;
+    });
+}
+
+template<typename FromType, bool BigEndian, typename Mapping, typename ToType>
+void mapSimdRowsInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z, std::false_type)
+{
+    auto &kernels = getSimdKernels();
+    PhysicalConversion conversion(input->getKeywords(), BigEndian);
+    size_t rowPitch = input->getWidth()*sizeof(FromType);
+    size_t columnCount = x.size;
+    input->readRowBlocks(x, y, z, [&](const char *rows, int, int, int rowCount) {
+        parallelRowChunks(rowCount, columnCount, [&](int firstRow, int chunkRowCount) {
+            std::vector<float> rowValues(columnCount);
+            Mapping chunkMapping = mapping;
+            auto sourceRow = rows + firstRow*rowPitch;
+            auto chunkDest = dest + size_t(firstRow)*columnCount;
+            for(int row = 0; row < chunkRowCount; ++row, sourceRow += rowPitch, chunkDest += columnCount)
+            {
+                SimdRowConverter<FromType>::apply(kernels, sourceRow, rowValues.data(), columnCount, conversion);
+                mapPhysicalRow(kernels, chunkMapping, rowValues.data(), chunkDest, columnCount);
+            }
+        });
+        dest += size_t(rowCount)*columnCount;
+    });
+}
+
+template<typename FromType, bool BigEndian, typename Mapping, typename ToType>
+void mapSimdRowsInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z, std::true_type)
+{
+    if(useMappingTable<FromType> (x, y, z))
+        mapTableFromTypeInto<FromType, BigEndian> (mapping, input, dest, x, y, z);
+    else
+        mapSimdRowsInto<FromType, BigEndian> (mapping, input, dest, x, y, z, std::false_type());
+}
+
+template<typename FromType, bool BigEndian, typename Mapping, typename ToType>
+void mapSimdFromTypeInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics)
+{
+    auto &kernels = getSimdKernels();
+    PhysicalConversion conversion(input->getKeywords(), BigEndian);
+    size_t rowPitch = input->getWidth()*sizeof(FromType);
+    size_t columnCount = x.size;
+
+    // Compute min and max, unless they are already known.
+    double minValue, maxValue;
+    minValue = maxValue = NAN;
+    if(!statistics || !statistics->getRegionRange(input, x, y, z, minValue, maxValue))
+    {
+        input->readRowBlocks(x, y, z, [&](const char *rows, int, int, int rowCount) {
+            parallelRowChunksRange(rowCount, columnCount, minValue, maxValue, [&](int firstRow, int chunkRowCount, double &chunkMin, double &chunkMax) {
+                std::vector<float> rowValues(columnCount);
+                float rangeMin = NAN;
+                float rangeMax = NAN;
+                auto sourceRow = rows + firstRow*rowPitch;
+                for(int row = 0; row < chunkRowCount; ++row, sourceRow += rowPitch)
+                {
+                    SimdRowConverter<FromType>::apply(kernels, sourceRow, rowValues.data(), columnCount, conversion);
+                    kernels.computeRange(rowValues.data(), columnCount, rangeMin, rangeMax);
+                }
+
+                chunkMin = rangeMin;
+                chunkMax = rangeMax;
+            });
+        });
     }
+
+    mapping.setup(minValue, maxValue);
+    mapSimdRowsInto<FromType, BigEndian> (mapping, input, dest, x, y, z, typename HasMappingTable<FromType>::type());
 }
 
-template<typename FromType, typename ToType, typename Mapping>
-void mapFromTypeToTypeInto(Mapping &mapping, FitsFile *input, FitsFile *output, SliceRange x, SliceRange y, SliceRange z)
+template<typename FromType, bool BigEndian, typename Mapping, typename ToType>
+void mapOrderedFromTypeInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics, std::false_type)
+{
+    // Select the conversion into physical values at compile time.
+    auto &keywords = input->getKeywords();
+    if(keywords.hasScaling())
+    {
+        if(hasBlankValue<FromType> (keywords))
+            mapPhysicalFromTypeInto<FromType, BigEndian> (PhysicalValue<FromType, true, true> (keywords), mapping, input, dest, x, y, z, statistics);
+        else
+            mapPhysicalFromTypeInto<FromType, BigEndian> (PhysicalValue<FromType, true, false> (keywords), mapping, input, dest, x, y, z, statistics);
+    }
+    else
+    {
+        if(hasBlankValue<FromType> (keywords))
+            mapPhysicalFromTypeInto<FromType, BigEndian> (PhysicalValue<FromType, false, true> (keywords), mapping, input, dest, x, y, z, statistics);
+        else
+            mapPhysicalFromTypeInto<FromType, BigEndian> (PhysicalValue<FromType, false, false> (keywords), mapping, input, dest, x, y, z, statistics);
+    }
+}
+
+template<typename FromType, bool BigEndian, typename Converter, typename Mapping, typename ToType>
+void mapScaledTableFromTypeInto(const Converter &converter, Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics)
+{
+    double minValue, maxValue;
+    computePhysicalRange<FromType, BigEndian> (converter, input, x, y, z, statistics, minValue, maxValue);
+    mapping.setup(minValue, maxValue);
+    mapTableFromTypeInto<FromType, BigEndian> (mapping, input, dest, x, y, z);
+}
+
+template<typename FromType, bool BigEndian, typename Mapping, typename ToType>
+void mapScaledFromTypeInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics, std::false_type)
+{
+    mapOrderedFromTypeInto<FromType, BigEndian> (mapping, input, dest, x, y, z, statistics, std::false_type());
+}
+
+template<typename FromType, bool BigEndian, typename Mapping, typename ToType>
+void mapScaledFromTypeInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics, std::true_type)
+{
+    // The table applies BSCALE, BZERO and BLANK in double precision, like the range pass.
+    auto &keywords = input->getKeywords();
+    if(!useMappingTable<FromType> (x, y, z))
+        mapOrderedFromTypeInto<FromType, BigEndian> (mapping, input, dest, x, y, z, statistics, std::false_type());
+    else if(hasBlankValue<FromType> (keywords))
+        mapScaledTableFromTypeInto<FromType, BigEndian> (PhysicalValue<FromType, true, true> (keywords), mapping, input, dest, x, y, z, statistics);
+    else
+        mapScaledTableFromTypeInto<FromType, BigEndian> (PhysicalValue<FromType, true, false> (keywords), mapping, input, dest, x, y, z, statistics);
+}
+
+template<typename FromType, bool BigEndian, typename Mapping, typename ToType>
+void mapOrderedFromTypeInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics, std::true_type)
+{
+    // BSCALE and BZERO are applied in double precision, so that the range is
+    // the one of the mapped values. The single precision kernels are exact
+    // for the other 8 and 16 bit values.
+    if(input->getKeywords().hasScaling())
+        mapScaledFromTypeInto<FromType, BigEndian> (mapping, input, dest, x, y, z, statistics, typename HasMappingTable<FromType>::type());
+    else
+        mapSimdFromTypeInto<FromType, BigEndian> (mapping, input, dest, x, y, z, statistics);
+}
+
+template<typename FromType, bool BigEndian, typename Converter, typename Mapping, typename ToType>
+void mapWholeSlicesInto(const Converter &, Mapping &mapping, FitsFile *input, ToType *dest, std::true_type)
+{
+    typedef typename std::make_unsigned<FromType>::type RawBits;
+    std::vector<ToType> table;
+    buildMappingTable<FromType, BigEndian, true> (mapping, input->getKeywords(), table);
+
+    size_t sliceCount = input->getNumberOfElements() / std::max(size_t(1), input->getWidth()*input->getHeight());
+    size_t rowElements = std::max(size_t(1), input->getWidth());
+    input->readRowBlocks(SliceRange(0, input->getWidth()), SliceRange(0, input->getHeight()), SliceRange(0, sliceCount),
+        [&](const char *rows, int, int, int rowCount) {
+        parallelRowChunks(rowCount, rowElements, [&](int firstRow, int chunkRowCount) {
+            auto src = reinterpret_cast<const RawBits*> (rows) + firstRow*rowElements;
+            auto chunkDest = dest + firstRow*rowElements;
+            auto chunkElements = chunkRowCount*rowElements;
+            for(size_t i = 0; i < chunkElements; ++i)
+                chunkDest[i] = table[src[i]];
+        });
+        dest += rowCount*rowElements;
+    });
+}
+
+template<typename FromType, bool BigEndian, typename Converter, typename Mapping, typename ToType>
+void mapWholeSlicesInto(const Converter &converter, Mapping &mapping, FitsFile *input, ToType *dest, std::false_type)
+{
+    size_t sliceCount = input->getNumberOfElements() / std::max(size_t(1), input->getWidth()*input->getHeight());
+    size_t rowElements = std::max(size_t(1), input->getWidth());
+    input->readRowBlocks(SliceRange(0, input->getWidth()), SliceRange(0, input->getHeight()), SliceRange(0, sliceCount),
+        [&](const char *rows, int, int, int rowCount) {
+        parallelRowChunks(rowCount, rowElements, [&](int firstRow, int chunkRowCount) {
+            Mapping chunkMapping = mapping;
+            auto src = reinterpret_cast<const FromType*> (rows) + firstRow*rowElements;
+            auto chunkDest = dest + firstRow*rowElements;
+            auto chunkElements = chunkRowCount*rowElements;
+            for(size_t i = 0; i < chunkElements; ++i)
+                *chunkDest++ = swapBytes<ToType> (normalizedValue<ToType> (chunkMapping.map(converter(loadRawValue<FromType, BigEndian> (*src++)))));
+        });
+        dest += rowCount*rowElements;
+    });
+}
+
+template<typename FromType, bool BigEndian, typename ToType, typename Converter, typename Mapping>
+void mapPhysicalFromTypeToTypeInto(const Converter &converter, Mapping &mapping, FitsFile *input, FitsFile *output,
+    const CubeStatistics *statistics)
 {
     auto numberOfElements = input->getNumberOfElements();
-    auto src = reinterpret_cast<const FromType*> (input->getImageData());
     auto dest = reinterpret_cast<ToType*> (output->getImageData());
-    auto normConstant = normalizationConstant<ToType> ();
     assert(input->getNumberOfElements() == output->getNumberOfElements());
 
-    // Compute min and max
-    FromType minValue, maxValue;
-    minValue = maxValue = (swapBytes<FromType> (*src++));
-    for(size_t i = 1; i < numberOfElements; ++i)
+    // The data is read in blocks of whole slices.
+    size_t sliceElements = std::max(size_t(1), input->getWidth()*input->getHeight());
+    size_t sliceCount = numberOfElements / sliceElements;
+    SliceRange wholeX(0, input->getWidth());
+    SliceRange wholeY(0, input->getHeight());
+    SliceRange wholeZ(0, sliceCount);
+    size_t rowElements = std::max(size_t(1), input->getWidth());
+
+    // Compute min and max, unless they are already known.
+    double minValue, maxValue;
+    minValue = maxValue = NAN;
+    if(!statistics || !statistics->getRegionRange(input, wholeX, wholeY, wholeZ, minValue, maxValue))
     {
-        auto value = swapBytes<FromType> (*src++);
-        minValue = std::min(minValue, value);
-        maxValue = std::max(maxValue, value);
+        input->readRowBlocks(wholeX, wholeY, wholeZ, [&](const char *rows, int, int, int rowCount) {
+            parallelRowChunksRange(rowCount, rowElements, minValue, maxValue, [&](int firstRow, int chunkRowCount, double &chunkMin, double &chunkMax) {
+                auto src = reinterpret_cast<const FromType*> (rows) + firstRow*rowElements;
+                auto chunkElements = chunkRowCount*rowElements;
+                for(size_t i = 0; i < chunkElements; ++i)
+                {
+                    auto value = converter(loadRawValue<FromType, BigEndian> (*src++));
+                    chunkMin = minIgnoreNaN(chunkMin, value);
+                    chunkMax = maxIgnoreNaN(chunkMax, value);
+                }
+            });
+        });
     }
 
     mapping.setup(minValue, maxValue);
+    mapWholeSlicesInto<FromType, BigEndian> (converter, mapping, input, dest, typename HasMappingTable<FromType>::type());
+}
 
-    src = reinterpret_cast<const FromType*> (input->getImageData());
-    for(size_t i = 0; i < numberOfElements; ++i)
-        *dest++ = swapBytes<ToType> (ToType(mapping.map(swapBytes<FromType> (*src++)) * normConstant));
+template<typename FromType, typename Mapping, typename ToType>
+void mapFromTypeInto(Mapping &mapping, FitsFile *input, ToType *dest, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics)
+{
+    typename SimdRowConverter<FromType>::type simd;
+    if(input->isNativeByteOrder())
+        mapOrderedFromTypeInto<FromType, false> (mapping, input, dest, x, y, z, statistics, simd);
+    else
+        mapOrderedFromTypeInto<FromType, true> (mapping, input, dest, x, y, z, statistics, simd);
+}
+
+template<typename FromType, bool BigEndian, typename ToType, typename Mapping>
+void mapOrderedFromTypeToTypeInto(Mapping &mapping, FitsFile *input, FitsFile *output, const CubeStatistics *statistics)
+{
+    auto &keywords = input->getKeywords();
+    if(keywords.hasScaling())
+    {
+        if(hasBlankValue<FromType> (keywords))
+            mapPhysicalFromTypeToTypeInto<FromType, BigEndian, ToType> (PhysicalValue<FromType, true, true> (keywords), mapping, input, output, statistics);
+        else
+            mapPhysicalFromTypeToTypeInto<FromType, BigEndian, ToType> (PhysicalValue<FromType, true, false> (keywords), mapping, input, output, statistics);
+    }
+    else
+    {
+        if(hasBlankValue<FromType> (keywords))
+            mapPhysicalFromTypeToTypeInto<FromType, BigEndian, ToType> (PhysicalValue<FromType, false, true> (keywords), mapping, input, output, statistics);
+        else
+            mapPhysicalFromTypeToTypeInto<FromType, BigEndian, ToType> (PhysicalValue<FromType, false, false> (keywords), mapping, input, output, statistics);
+    }
+}
+
+template<typename FromType, typename ToType, typename Mapping>
+void mapFromTypeToTypeInto(Mapping &mapping, FitsFile *input, FitsFile *output, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics)
+{
+    if(input->isNativeByteOrder())
+        mapOrderedFromTypeToTypeInto<FromType, false, ToType> (mapping, input, output, statistics);
+    else
+        mapOrderedFromTypeToTypeInto<FromType, true, ToType> (mapping, input, output, statistics);
 }
 
 template<typename FromType, typename Mapping>
-void mapFromTypeInto(Mapping &mapping, FitsFile *input, FitsFile *output, SliceRange x, SliceRange y, SliceRange z)
+void mapFromTypeInto(Mapping &mapping, FitsFile *input, FitsFile *output, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics)
 {
     switch(output->getFormat())
     {
     case FitsFormat::UInt8:
-        mapFromTypeToTypeInto<FromType, unsigned char> (mapping, input, output, x, y, z);
+        mapFromTypeToTypeInto<FromType, unsigned char> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Int16:
-        mapFromTypeToTypeInto<FromType, int16_t> (mapping, input, output, x, y, z);
+        mapFromTypeToTypeInto<FromType, int16_t> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Int32:
-        mapFromTypeToTypeInto<FromType, int32_t> (mapping, input, output, x, y, z);
+        mapFromTypeToTypeInto<FromType, int32_t> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Int64:
-        mapFromTypeToTypeInto<FromType, int64_t> (mapping, input, output, x, y, z);
+        mapFromTypeToTypeInto<FromType, int64_t> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Float:
-        mapFromTypeToTypeInto<FromType, float> (mapping, input, output, x, y, z);
+        mapFromTypeToTypeInto<FromType, float> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Double:
-        mapFromTypeToTypeInto<FromType, double> (mapping, input, output, x, y, z);
+        mapFromTypeToTypeInto<FromType, double> (mapping, input, output, x, y, z, statistics);
         break;
     }
 }
@@ -344,53 +825,55 @@ void mapFromTypeInto(Mapping &mapping, FitsFile *input, FitsFile *output, SliceR
 } // namespace detail
 
 template<typename Mapping>
-void mapFitsIntoFits(Mapping &mapping, FitsFile *input, FitsFile *output, SliceRange x, SliceRange y, SliceRange z)
+void mapFitsIntoFits(Mapping &mapping, FitsFile *input, FitsFile *output, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics=nullptr)
 {
     switch(input->getFormat())
     {
     case FitsFormat::UInt8:
-        detail::mapFromTypeInto<unsigned char> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<unsigned char> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Int16:
-        detail::mapFromTypeInto<int16_t> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<int16_t> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Int32:
-        detail::mapFromTypeInto<int32_t> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<int32_t> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Int64:
-        detail::mapFromTypeInto<int64_t> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<int64_t> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Float:
-        detail::mapFromTypeInto<float> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<float> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Double:
-        detail::mapFromTypeInto<double> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<double> (mapping, input, output, x, y, z, statistics);
         break;
     }
 }
 
 template<typename Mapping, typename Output>
-void mapFitsInto(Mapping &mapping, FitsFile *input, Output output, SliceRange x, SliceRange y, SliceRange z)
+void mapFitsInto(Mapping &mapping, FitsFile *input, Output output, SliceRange x, SliceRange y, SliceRange z,
+    const CubeStatistics *statistics=nullptr)
 {
     switch(input->getFormat())
     {
     case FitsFormat::UInt8:
-        detail::mapFromTypeInto<unsigned char> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<unsigned char> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Int16:
-        detail::mapFromTypeInto<int16_t> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<int16_t> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Int32:
-        detail::mapFromTypeInto<int32_t> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<int32_t> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Int64:
-        detail::mapFromTypeInto<int64_t> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<int64_t> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Float:
-        detail::mapFromTypeInto<float> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<float> (mapping, input, output, x, y, z, statistics);
         break;
     case FitsFormat::Double:
-        detail::mapFromTypeInto<double> (mapping, input, output, x, y, z);
+        detail::mapFromTypeInto<double> (mapping, input, output, x, y, z, statistics);
         break;
     }
 }
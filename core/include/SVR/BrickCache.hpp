@@ -0,0 +1,74 @@
+#ifndef _SVR_BRICK_CACHE_HPP_
+#define _SVR_BRICK_CACHE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "SVR/Common.hpp"
+
+namespace SVR
+{
+
+/**
+ * Least recently used assignment of the bricks of a virtual volume to the
+ * slots of a brick atlas. Only the bookkeeping is done here, the caller
+ * uploads the bricks and updates the page table.
+ */
+class SVR_EXPORT BrickCache
+{
+public:
+    static const uint32_t NoSlot = ~uint32_t(0);
+    static const size_t NoBrick = ~size_t(0);
+
+    BrickCache();
+
+    // Evicts every brick.
+    void reset(size_t brickCount, size_t slotCount);
+
+    // The bricks used in the current frame are never evicted during it.
+    void beginFrame();
+
+    // The slot of a resident brick, that is marked as used. NoSlot when the brick is missing.
+    uint32_t touch(size_t brick);
+
+    // Assigns the least recently used slot to a missing brick. The brick that
+    // was in that slot is returned in evictedBrick, or NoBrick. NoSlot when
+    // every slot is used in the current frame.
+    uint32_t allocate(size_t brick, size_t &evictedBrick);
+
+    size_t getBrickCount() const
+    {
+        return brickSlots.size();
+    }
+
+    size_t getSlotCount() const
+    {
+        return slotBricks.size();
+    }
+
+    size_t getResidentCount() const
+    {
+        return residentCount;
+    }
+
+private:
+    void unlink(uint32_t slot);
+    void pushFront(uint32_t slot);
+
+    std::vector<uint32_t> brickSlots;
+    std::vector<size_t> slotBricks;
+    std::vector<uint64_t> slotFrames;
+
+    // Slots from the most to the least recently used.
+    std::vector<uint32_t> previousSlot;
+    std::vector<uint32_t> nextSlot;
+    uint32_t firstSlot;
+    uint32_t lastSlot;
+
+    uint64_t frame;
+    size_t residentCount;
+};
+
+} // namespace SVR
+
+#endif //_SVR_BRICK_CACHE_HPP_
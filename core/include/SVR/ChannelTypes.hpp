@@ -19,6 +19,15 @@ struct NormalizationConstant<uint8_t>
     }
 };
 
+template<>
+struct NormalizationConstant<uint16_t>
+{
+    static double apply()
+    {
+        return 65535.0;
+    }
+};
+
 template<>
 struct NormalizationConstant<int16_t>
 {
@@ -5,6 +5,7 @@
 
 namespace SVR
 {
+DECLARE_INTERFACE(ComputeBuffer);
 DECLARE_INTERFACE(ComputeKernel);
 
 /**
@@ -14,7 +15,20 @@ struct ComputeDevice: Interface
 {
     virtual void runGlobalKernel1D(const ComputeKernelPtr &kernel, size_t globalWorkSize) = 0;
     virtual void runGlobalKernel2D(const ComputeKernelPtr &kernel, size_t globalWorkWidth, size_t globalWorkHeight) = 0;
-    virtual void runGlobalKernel2D(const ComputeKernelPtr &kernel, size_t globalWorkWidth, size_t globalWorkHeight, size_t globalWorkDepth) = 0;
+    virtual void runGlobalKernel3D(const ComputeKernelPtr &kernel, size_t globalWorkWidth, size_t globalWorkHeight, size_t globalWorkDepth) = 0;
+
+    // Writes a box of a 3D image. The data can be reused when it returns.
+    virtual void writeImage3D(const ComputeBufferPtr &image, size_t x, size_t y, size_t z, size_t width, size_t height, size_t depth,
+        size_t rowPitch, size_t slicePitch, const void *data) = 0;
+
+    // Reads a rectangle of a 2D image, after the queued commands are finished.
+    virtual void readImage2D(const ComputeBufferPtr &image, size_t x, size_t y, size_t width, size_t height,
+        size_t rowPitch, void *data) = 0;
+
+    // Copies a box between two 3D images of the same format, in the device.
+    virtual void copyImage3D(const ComputeBufferPtr &source, const ComputeBufferPtr &destination,
+        size_t sourceX, size_t sourceY, size_t sourceZ, size_t destinationX, size_t destinationY, size_t destinationZ,
+        size_t width, size_t height, size_t depth) = 0;
 };
 
 } // namespace SVR
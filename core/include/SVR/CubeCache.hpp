@@ -0,0 +1,38 @@
+#ifndef _SVR_CUBE_CACHE_HPP_
+#define _SVR_CUBE_CACHE_HPP_
+
+#include <string>
+#include "SVR/Common.hpp"
+#include "SVR/CubeStatistics.hpp"
+
+namespace SVR
+{
+
+/**
+ * On disk cache of cubes that are already converted into physical values,
+ * in the byte order of the host. The cached cubes are regular FITS files
+ * with an additional BYTEORDR keyword.
+ */
+class SVR_EXPORT CubeCache
+{
+public:
+    CubeCache(const std::string &directory=getDefaultDirectory());
+
+    static std::string getDefaultDirectory();
+
+    // Identifies the selected HDU of a file by its path, size, modification time and header.
+    std::string computeKey(const std::string &fitsFileName, FitsFile *fits) const;
+
+    FitsFile *open(const std::string &key, CubeStatistics &statistics, FitsAccessMode accessMode=FitsAccessMode::Mapped);
+    FitsFile *store(const std::string &key, FitsFile *source, CubeStatistics &statistics, FitsAccessMode accessMode=FitsAccessMode::Mapped);
+
+private:
+    std::string getCubeFileName(const std::string &key) const;
+    std::string getStatisticsFileName(const std::string &key) const;
+
+    std::string directory;
+};
+
+} // namespace SVR
+
+#endif //_SVR_CUBE_CACHE_HPP_
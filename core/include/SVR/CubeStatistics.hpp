@@ -0,0 +1,88 @@
+#ifndef _SVR_CUBE_STATISTICS_HPP_
+#define _SVR_CUBE_STATISTICS_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SVR/Common.hpp"
+#include "SVR/FitsFile.hpp"
+
+namespace SVR
+{
+
+/**
+ * Statistics of the physical values of a cube. They are computed once,
+ * and stored in a sidecar file next to the cube.
+ */
+struct SVR_EXPORT CubeStatistics
+{
+    static const size_t HistogramBinCount = 256;
+    static const int DefaultBrickSize = 32;
+
+    CubeStatistics()
+        : minValue(0.0), maxValue(0.0), nanCount(0), meanValue(0.0), standardDeviation(0.0),
+          brickSize(0), brickCountX(0), brickCountY(0), brickCountZ(0) {}
+
+    bool isEmpty() const
+    {
+        return sliceMinValue.empty();
+    }
+
+    // The range of a region is only known when it covers whole slices or whole bricks, or when it was already mapped.
+    bool getRegionRange(FitsFile *cube, SliceRange x, SliceRange y, SliceRange z, double &regionMin, double &regionMax) const;
+
+    // Remembers the range of a mapped region. It is not saved.
+    void setRegionRange(SliceRange x, SliceRange y, SliceRange z, double regionMin, double regionMax);
+
+    bool load(const std::string &fileName, const std::string &key);
+    bool save(const std::string &fileName, const std::string &key) const;
+
+    static std::string sidecarFileNameFor(const std::string &fitsFileName);
+
+    double minValue;
+    double maxValue;
+
+    // NaN and BLANK values.
+    uint64_t nanCount;
+
+    // Of the values that are not NaN.
+    double meanValue;
+    double standardDeviation;
+
+    // Fixed size bins in the [minValue, maxValue] range.
+    std::vector<uint64_t> histogram;
+
+    // Statistics of each slice, including the slices of the higher axes.
+    std::vector<double> sliceMinValue;
+    std::vector<double> sliceMaxValue;
+    std::vector<double> sliceMeanValue;
+    std::vector<double> sliceStandardDeviation;
+    std::vector<uint64_t> sliceNanCount;
+
+    // Range of each brick of brickSize^3 elements, indexed by (z*brickCountY + y)*brickCountX + x.
+    // The bricks cover the slices of the higher axes too, and they are NaN when they only have NaN.
+    int brickSize;
+    size_t brickCountX, brickCountY, brickCountZ;
+    std::vector<double> brickMinValue;
+    std::vector<double> brickMaxValue;
+
+    struct RegionRange
+    {
+        SliceRange x, y, z;
+        double minValue;
+        double maxValue;
+    };
+
+    std::vector<RegionRange> regionRanges;
+};
+
+// Identifies the selected HDU of a file by its path, size, modification time and header.
+SVR_EXPORT std::string computeCubeKey(const std::string &fitsFileName, FitsFile *fits);
+
+// Reads the whole cube in a parallel pass. The histogram bins need the range, so they take a second pass.
+SVR_EXPORT void computeCubeStatistics(FitsFile *cube, CubeStatistics &statistics,
+    size_t histogramBinCount=CubeStatistics::HistogramBinCount, int brickSize=CubeStatistics::DefaultBrickSize);
+
+} // namespace SVR
+
+#endif //_SVR_CUBE_STATISTICS_HPP_
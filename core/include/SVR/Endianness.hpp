@@ -103,6 +103,15 @@ T swapBytes(const T &source)
     return detail::SwapBytes<T>::apply(source);
 }
 
+/**
+ * Is the host using the little endian byte order?
+ */
+inline bool isHostLittleEndian()
+{
+    const uint16_t value = 1;
+    return *reinterpret_cast<const uint8_t*> (&value) == 1;
+}
+
 } // SVR
 
 #endif //_SVR_ENDIANNESS_HPP_
@@ -0,0 +1,134 @@
+#ifndef _SVR_FITS_COMPRESSED_IMAGE_HPP_
+#define _SVR_FITS_COMPRESSED_IMAGE_HPP_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "SVR/FitsFile.hpp"
+
+namespace SVR
+{
+
+/**
+ * Tile compression algorithms.
+ */
+enum class FitsCompression
+{
+    Unsupported = 0,
+    Rice,
+    Gzip,
+    ShuffledGzip,
+};
+
+/**
+ * Quantization of floating point tiles.
+ */
+enum class FitsQuantization
+{
+    None = 0,
+    NoDither,
+    SubtractiveDither1,
+    SubtractiveDither2,
+};
+
+/**
+ * A column of the binary table with the compressed tiles.
+ */
+struct FitsTableColumn
+{
+    FitsTableColumn()
+        : offset(0), type(0), arrayType(0), repeat(0) {}
+
+    bool isValid() const
+    {
+        return type != 0;
+    }
+
+    size_t offset;
+    char type;
+
+    // Element type of variable length arrays.
+    char arrayType;
+    size_t repeat;
+};
+
+/**
+ * Tile compressed image, stored in a binary table as in fpack.
+ * Tiles are decompressed on demand into the FITS byte order.
+ */
+class FitsCompressedImage
+{
+public:
+    FitsCompressedImage(MemoryMappedFile *memoryFile, size_t dataOffset, const FitsHeader &header);
+    ~FitsCompressedImage();
+
+    static bool isCompressedImage(const FitsHeader &header);
+
+    bool isSupported() const;
+    FitsFormat getFormat() const;
+    const std::vector<size_t> &getAxis() const;
+    size_t getNumberOfTiles() const;
+
+    char *decodeRegion(const SliceRange &x, const SliceRange &y, const SliceRange &z);
+    char *decodeAll();
+
+private:
+    void readTableLayout(const FitsHeader &header);
+    void readCompressionParameters(const FitsHeader &header);
+
+    template<typename Function>
+    void forEachTileRow(size_t tileIndex, const Function &function) const;
+    size_t getTileElementCount(size_t tileIndex) const;
+    void decodeTiles(const std::vector<size_t> &tiles);
+    void decodeTile(size_t tileIndex);
+
+    bool readHeapArray(const char *row, const FitsTableColumn &column, const char **data, size_t *size);
+    double readTableNumber(const char *row, const FitsTableColumn &column, double absentValue);
+
+    void storeRawTile(size_t tileIndex, const char *tileData);
+    void storeIntegerTile(size_t tileIndex, const char *row, const int32_t *values);
+
+    MemoryMappedFile *memoryFile;
+    MemoryMappedWindow tableWindow;
+    size_t dataOffset;
+    const char *tableData;
+
+    // Binary table layout.
+    size_t rowSize;
+    size_t rowCount;
+    size_t heapOffset;
+    size_t heapSize;
+    FitsTableColumn compressedDataColumn;
+    FitsTableColumn gzipCompressedDataColumn;
+    FitsTableColumn uncompressedDataColumn;
+    FitsTableColumn scaleColumn;
+    FitsTableColumn zeroColumn;
+    FitsTableColumn blankColumn;
+
+    // Image and tile description.
+    FitsFormat format;
+    std::vector<size_t> axis;
+    std::vector<size_t> tileSize;
+    std::vector<size_t> tileCount;
+    size_t elementSize;
+
+    FitsCompression compression;
+    size_t riceBlockSize;
+    size_t riceBytesPerPixel;
+
+    FitsQuantization quantization;
+    double scale;
+    double zero;
+    int64_t blank;
+    bool hasBlank;
+    int ditherOffset;
+
+    // Decompressed image.
+    std::mutex decodeMutex;
+    std::unique_ptr<char[]> imageData;
+    std::vector<bool> decodedTiles;
+};
+
+} // namespace SVR
+
+#endif //_SVR_FITS_COMPRESSED_IMAGE_HPP_
@@ -1,11 +1,14 @@
 #ifndef _SVR_FITS_FILE_HPP_
 #define _SVR_FITS_FILE_HPP_
 
+#include <deque>
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
 #include <assert.h>
 
+#include "SVR/FitsHeader.hpp"
 #include "SVR/MemoryMappedFile.hpp"
 
 namespace SVR
@@ -24,6 +27,39 @@ enum class FitsFormat
     Double = -64,
 };
 
+/**
+ * How the FITS file contents are accessed.
+ */
+enum class FitsAccessMode
+{
+    // The whole file is memory mapped.
+    Mapped = 0,
+
+    // Only the regions that are being read are memory mapped.
+    Windowed,
+
+    // Regions are read in blocks with pread. Headers are memory mapped.
+    Streamed,
+
+    // Streamed, bypassing the page cache with O_DIRECT when it is supported.
+    StreamedDirect,
+};
+
+/**
+ * How the regions that are read are announced to the system.
+ */
+enum class FitsReadAhead
+{
+    // The system default read ahead.
+    None = 0,
+
+    // Access pattern hints for each region.
+    Hints,
+
+    // Hints, and a thread that reads ahead of the consumer.
+    Prefetch,
+};
+
 struct SliceRange
 {
     SliceRange(int start=-1, int size=-1)
@@ -47,13 +83,49 @@ struct SliceRange
         if(start + size > rangeEnd)
             size -= start + size - rangeEnd;
     }
-    
+
+    bool operator==(const SliceRange &other) const
+    {
+        return start == other.start && size == other.size;
+    }
+
     int start;
     int size;
 };
 
 typedef std::map<std::string, std::string> FitsHeaderProperties;
 
+class FitsCompressedImage;
+class ThreadPool;
+
+/**
+ * Location and layout of a FITS header data unit.
+ */
+struct FitsHdu
+{
+    FitsHdu()
+        : headerOffset(0), dataOffset(0), dataSize(0), format(FitsFormat::UInt8), compressed(false) {}
+
+    bool isImage() const
+    {
+        return !axis.empty() && (extension.empty() || extension == "IMAGE" || compressed);
+    }
+
+    size_t headerOffset;
+    size_t dataOffset;
+    size_t dataSize;
+    FitsFormat format;
+    std::vector<size_t> axis;
+
+    // The XTENSION value. Empty for the primary HDU.
+    std::string extension;
+
+    // Tile compressed image. The format and axis are the ones of the image.
+    bool compressed;
+};
+
+typedef std::vector<FitsHdu> FitsHduIndex;
+
 /**
  * Fits file
  */
@@ -70,32 +142,105 @@ public:
     size_t getHeight() const;
     size_t getDepth() const;
     size_t getNumberOfElements() const;
+
+    // The 3D planes along the axes after the third one, such as time or Stokes.
+    // The slices of plane p start at the slice p*depth.
+    size_t getPlaneCount() const;
     FitsFormat getFormat() const;
+    size_t getElementSize() const;
 
-    const FitsHeaderProperties &getHeaderProperties() const;
-    char *getImageData();
+    // Files written by SVR may use the byte order of the host, instead of big endian.
+    bool isNativeByteOrder() const;
 
-    static FitsFile *open(const char *fileName, bool canWrite=false);
-    static FitsFile *create(const char *fileName, FitsHeaderProperties properties, size_t dataSize);
+    const FitsHeader &getHeader() const;
+    const FitsHeaderKeywords &getKeywords() const;
+    char *getImageData();
+    char *mapRegion(SliceRange x, SliceRange y, SliceRange z);
+
+    MemoryUsage getMemoryUsage();
+
+    // Access pattern hints for the data unit.
+    void adviseAccess(MemoryAccessHint hint);
+    void setReadAhead(FitsReadAhead newReadAhead);
+
+    // Brackets a pass over a region, that is read in increasing slice order.
+    void beginRegionRead(SliceRange x, SliceRange y, SliceRange z);
+    void advanceRegionRead(int slice);
+    void endRegionRead();
+
+    // Reads a region in blocks of rows, in increasing slice and row order.
+    // The rows start at the x.start column, and are separated by the width of the image.
+    typedef std::function<void (const char *rows, int slice, int firstRow, int rowCount)> RowBlockConsumer;
+    void readRowBlocks(SliceRange x, SliceRange y, SliceRange z, const RowBlockConsumer &consumer);
+    bool isStreamed() const;
+
+    // Virtual cubes are made of one 2D file per slice. They do not have contiguous image data.
+    bool isVirtual() const;
+
+    // Writes the slices concurrently. Each written slice is flushed in background.
+    typedef std::function<void (size_t slice, char *sliceData)> SliceWriter;
+    void writeSlices(const SliceWriter &writer, ThreadPool *pool=nullptr);
+
+    size_t getHduCount() const;
+    const FitsHdu &getHdu(size_t index) const;
+    size_t getSelectedHdu() const;
+    bool selectHdu(size_t index);
+
+    bool saveHduIndex(const std::string &fileName) const;
+    // The index is only loaded for the size and the modification time of the file that it was saved for.
+    static bool loadHduIndex(const std::string &fileName, size_t fitsFileSize, uint64_t fitsModificationTime, FitsHduIndex &index);
+    static std::string hduIndexFileNameFor(const std::string &fitsFileName);
+
+    static FitsFile *open(const char *fileName, bool canWrite=false, FitsAccessMode accessMode=FitsAccessMode::Mapped);
+    static FitsFile *openSlices(const std::vector<std::string> &sliceFileNames, FitsAccessMode accessMode=FitsAccessMode::Mapped);
+    static FitsFile *create(const char *fileName, FitsHeaderProperties properties, size_t dataSize,
+        const MemoryMappedCreateOptions &options=MemoryMappedCreateOptions());
     void close();
 
     std::string getPropertyIfAbsent(const std::string &name, const std::string &absentValue);
 
 private:
-    void readHeader();
+    bool readHeader();
     void loadHeaderData();
+    void buildHduIndex();
+    FitsFile *getSliceFile(size_t slice);
+    void closeSliceFiles();
+    void computeRegionElements(const SliceRange &x, const SliceRange &y, const SliceRange &z,
+        size_t &firstElement, size_t &lastElement) const;
 
-    void writeHeader();
+    void writeHeader(FitsHeaderProperties &properties);
     void writeHeaderLine(const std::string &key, const std::string &value);
 
-    std::pair<std::string, std::string> readHeaderLine();
-
     MemoryMappedFile *memoryFile;
+    MemoryMappedWindow headerWindow;
+    MemoryMappedWindow dataWindow;
+    size_t headerOffset;
+    size_t dataOffset;
     char *imageData;
     char *position;
-    FitsHeaderProperties headerProperties;
+    FitsHeader header;
     std::vector<size_t> axis;
     FitsFormat format;
+    bool nativeByteOrder;
+    FitsCompressedImage *compressedImage;
+    bool streamed;
+
+    FitsHduIndex hduIndex;
+    size_t selectedHdu;
+    uint64_t modificationTime;
+
+    // Region that is being read.
+    FitsReadAhead readAhead;
+    size_t regionReadOffset;
+    size_t regionReadSize;
+    int regionReadFirstSlice;
+    size_t regionReadSlicePitch;
+
+    // Slice files of a virtual cube, which are opened on demand.
+    std::vector<std::string> sliceFileNames;
+    std::vector<FitsFile*> sliceFiles;
+    std::deque<size_t> openSliceFiles;
+    FitsAccessMode sliceAccessMode;
 };
 
 } // namespace SVR
@@ -0,0 +1,133 @@
+#ifndef _SVR_FITS_HEADER_HPP_
+#define _SVR_FITS_HEADER_HPP_
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace SVR
+{
+
+/**
+ * Non owning view of a string inside of a FITS header card.
+ */
+struct FitsHeaderString
+{
+    FitsHeaderString(const char *data=nullptr, size_t size=0)
+        : data(data), size(size) {}
+
+    bool empty() const
+    {
+        return size == 0;
+    }
+
+    std::string str() const
+    {
+        return std::string(data, data + size);
+    }
+
+    int compare(const char *other, size_t otherSize) const
+    {
+        auto result = memcmp(data, other, std::min(size, otherSize));
+        if(result != 0)
+            return result;
+        return size < otherSize ? -1 : (size > otherSize ? 1 : 0);
+    }
+
+    bool operator<(const FitsHeaderString &other) const
+    {
+        return compare(other.data, other.size) < 0;
+    }
+
+    bool operator==(const char *other) const
+    {
+        return compare(other, strlen(other)) == 0;
+    }
+
+    bool operator!=(const char *other) const
+    {
+        return !(*this == other);
+    }
+
+    const char *data;
+    size_t size;
+};
+
+/**
+ * A single 80 byte FITS header card.
+ */
+struct FitsHeaderCard
+{
+    FitsHeaderString key;
+    FitsHeaderString value;
+};
+
+/**
+ * The header keywords that are decoded once when parsing.
+ */
+struct FitsHeaderKeywords
+{
+    FitsHeaderKeywords()
+        : bitpix(0), bscale(1.0), bzero(0.0), hasBlank(false), blank(0) {}
+
+    bool hasScaling() const
+    {
+        return bscale != 1.0 || bzero != 0.0;
+    }
+
+    int bitpix;
+    std::vector<size_t> axis;
+
+    // Physical value scaling.
+    double bscale;
+    double bzero;
+    bool hasBlank;
+    int64_t blank;
+
+    // World coordinate system, one element per axis.
+    std::vector<double> referencePixel;
+    std::vector<double> referenceValue;
+    std::vector<double> pixelDelta;
+};
+
+/**
+ * FITS header made of views into the cards of a mapped file.
+ */
+class FitsHeader
+{
+public:
+    typedef std::vector<FitsHeaderCard>::const_iterator const_iterator;
+
+    static const size_t CardSize = 80;
+
+    static bool isEndCard(const char *card);
+
+    void clear();
+    void parse(const char *cards, size_t cardCount);
+
+    size_t size() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    const FitsHeaderCard *find(const char *key) const;
+    bool contains(const char *key) const;
+
+    std::string getString(const char *key, const std::string &absentValue=std::string()) const;
+    int64_t getInteger(const char *key, int64_t absentValue=0) const;
+    double getDouble(const char *key, double absentValue=0.0) const;
+
+    const FitsHeaderKeywords &getKeywords() const;
+
+private:
+    static FitsHeaderCard parseCard(const char *card);
+    void decodeKeywords();
+
+    std::vector<FitsHeaderCard> cards;
+    FitsHeaderKeywords keywords;
+};
+
+} // namespace SVR
+
+#endif //_SVR_FITS_HEADER_HPP_
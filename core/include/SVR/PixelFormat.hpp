@@ -17,6 +17,7 @@ enum class PixelFormat
     RGBA8,
 
     L16,
+    R16,
 
     R32F,
     RG32F,
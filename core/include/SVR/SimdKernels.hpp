@@ -0,0 +1,71 @@
+#ifndef _SVR_SIMD_KERNELS_HPP_
+#define _SVR_SIMD_KERNELS_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "SVR/Common.hpp"
+#include "SVR/FitsHeader.hpp"
+
+namespace SVR
+{
+
+/**
+ * Instruction sets of the vector kernels.
+ */
+enum class SimdLevel
+{
+    Scalar = 0,
+    SSE41,
+    AVX2,
+    AVX512,
+};
+
+/**
+ * Conversion of raw values into physical values, in single precision.
+ */
+struct PhysicalConversion
+{
+    PhysicalConversion(const FitsHeaderKeywords &keywords, bool bigEndian)
+        : scale(float(keywords.bscale)), zero(float(keywords.bzero)), blank(keywords.blank),
+          scaled(keywords.hasScaling()), hasBlank(keywords.hasBlank), bigEndian(bigEndian) {}
+
+    float scale;
+    float zero;
+    int64_t blank;
+    bool scaled;
+    bool hasBlank;
+    bool bigEndian;
+};
+
+/**
+ * Vector kernels of the conversion and mapping loops.
+ * Every implementation gives the same results as the scalar one.
+ */
+struct SimdKernels
+{
+    SimdLevel level;
+    const char *name;
+
+    // Raw values into physical values. BLANK values are converted into NaN.
+    void (*convertUInt8)(const uint8_t *source, float *dest, size_t count, const PhysicalConversion &conversion);
+    void (*convertInt16)(const int16_t *source, float *dest, size_t count, const PhysicalConversion &conversion);
+    void (*convertFloat)(const float *source, float *dest, size_t count, const PhysicalConversion &conversion);
+
+    // Extends the range with the values that are not NaN. The range starts as NaN.
+    void (*computeRange)(const float *values, size_t count, float &minValue, float &maxValue);
+
+    // Saturated values*scale, with NaN into zero.
+    void (*scaleToUInt8)(const float *values, size_t count, float scale, uint8_t *dest);
+    void (*scaleToUInt16)(const float *values, size_t count, float scale, uint16_t *dest);
+};
+
+// The best kernels for the host. The SVR_SIMD environment variable can
+// limit them to scalar, sse4.1, avx2 or avx512.
+SVR_EXPORT const SimdKernels &getSimdKernels();
+
+// The kernels of an instruction set, or null when the host does not support it.
+SVR_EXPORT const SimdKernels *getSimdKernels(SimdLevel level);
+
+} // namespace SVR
+
+#endif //_SVR_SIMD_KERNELS_HPP_
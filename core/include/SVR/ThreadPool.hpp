@@ -0,0 +1,50 @@
+#ifndef _SVR_THREAD_POOL_HPP_
+#define _SVR_THREAD_POOL_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "SVR/Common.hpp"
+
+namespace SVR
+{
+
+/**
+ * Fixed size pool of worker threads.
+ */
+class SVR_EXPORT ThreadPool
+{
+public:
+    typedef std::function<void ()> Task;
+    typedef std::function<void (size_t)> IndexedTask;
+
+    ThreadPool(size_t threadCount=0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t getThreadCount() const;
+
+    // Runs body(i) for every i in [0, count) and waits for the completion.
+    void parallelFor(size_t count, const IndexedTask &body);
+
+    static ThreadPool &getDefault();
+
+private:
+    void enqueue(const Task &task);
+    void workerMain();
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable pendingTasksCondition;
+    std::deque<Task> pendingTasks;
+    bool quitting;
+};
+
+} // namespace SVR
+
+#endif //_SVR_THREAD_POOL_HPP_
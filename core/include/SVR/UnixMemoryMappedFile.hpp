@@ -1,8 +1,105 @@
 #ifndef _SVR_UNIX_MEMORY_MAPPED_FILE_HPP_
 #define _SVR_UNIX_MEMORY_MAPPED_FILE_HPP_
 
+#include <stddef.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace SVR
 {
+class MemoryMappedFile;
+
+/**
+ * Memory usage of a memory mapped file.
+ */
+struct MemoryUsage
+{
+    MemoryUsage()
+        : mappedSize(0), residentSize(0), minorPageFaults(0), majorPageFaults(0) {}
+
+    size_t mappedSize;
+    size_t residentSize;
+
+    // Page faults taken by the whole process.
+    long minorPageFaults;
+    long majorPageFaults;
+};
+
+/**
+ * Expected access pattern of a range of a memory mapped file.
+ */
+enum class MemoryAccessHint
+{
+    Normal = 0,
+    Sequential,
+    Random,
+
+    // Start reading the range in background.
+    WillNeed,
+
+    // The range is not going to be used soon, so it can be evicted.
+    DontNeed,
+
+    // Use huge pages when the system supports them for the mapping.
+    HugePages,
+};
+
+/**
+ * A contiguous range of bytes of a file.
+ */
+struct FileRange
+{
+    FileRange(size_t offset=0, size_t size=0)
+        : offset(offset), size(size) {}
+
+    size_t offset;
+    size_t size;
+};
+
+/**
+ * Options for creating a new memory mapped file.
+ */
+struct MemoryMappedCreateOptions
+{
+    MemoryMappedCreateOptions()
+        : preallocate(true), populate(false) {}
+
+    // Reserve the disk blocks up front, instead of leaving a sparse file.
+    bool preallocate;
+
+    // Fault in the whole mapping when it is created.
+    bool populate;
+};
+
+/**
+ * A page aligned window into a portion of a memory mapped file.
+ */
+class MemoryMappedWindow
+{
+public:
+    MemoryMappedWindow();
+    ~MemoryMappedWindow();
+
+    MemoryMappedWindow(const MemoryMappedWindow &) = delete;
+    MemoryMappedWindow &operator=(const MemoryMappedWindow &) = delete;
+
+    bool contains(size_t offset, size_t size) const;
+    char *getDataAt(size_t offset) const;
+    size_t getMappedSize() const;
+
+    void unmap();
+
+private:
+    friend class MemoryMappedFile;
+
+    MemoryMappedFile *file;
+    char *data;
+    size_t offset;
+    size_t size;
+};
 
 /**
  * This class is used to represent a memory mapped file.
@@ -10,23 +107,67 @@ namespace SVR
 class MemoryMappedFile
 {
 public:
-    MemoryMappedFile(int fd, char *data, size_t size);
+    typedef std::function<void (size_t rangeIndex, const char *data)> RangeConsumer;
+
+    MemoryMappedFile(int fd, char *data, size_t size, bool canWrite);
     ~MemoryMappedFile();
 
-    static MemoryMappedFile *create(const char *filename, size_t size);
-    static MemoryMappedFile *open(const char *filename, bool canWrite);
+    static MemoryMappedFile *create(const char *filename, size_t size, const MemoryMappedCreateOptions &options=MemoryMappedCreateOptions());
+    static MemoryMappedFile *open(const char *filename, bool canWrite, bool windowed=false, bool directIO=false);
     void close();
 
     size_t getSize();
     char *getData();
 
+    bool isWindowed() const;
+    char *mapWindow(MemoryMappedWindow &window, size_t offset, size_t size);
+
+    MemoryUsage getMemoryUsage();
+
+    // Starts writing back a modified range without waiting for it.
+    void flushInBackground(size_t offset, size_t size);
+
+    void adviseAccess(MemoryAccessHint hint, size_t offset=0, size_t size=size_t(-1));
+
+    // A background thread keeps the pages up to distance bytes after the
+    // consumer position resident.
+    void startPrefetch(size_t offset, size_t size, size_t distance);
+    void advancePrefetch(size_t consumedOffset);
+    void stopPrefetch();
+
+    // Reads the ranges in order with pread, into a double buffered ring.
+    // The consumer gets a range while the next one is being read.
+    void streamRanges(const std::vector<FileRange> &ranges, const RangeConsumer &consumer);
+
 private:
+    friend class MemoryMappedWindow;
+
+    void unregisterWindow(MemoryMappedWindow *window);
+    void prefetchThreadMain();
+    const char *readRange(const FileRange &range, char *buffer, size_t bufferSize);
+
     int fd;
+
+    // Descriptor opened with O_DIRECT for streaming, or -1.
+    int directFd;
     char *data;
     size_t size;
+    bool canWrite;
+
+    std::mutex windowsMutex;
+    std::vector<MemoryMappedWindow*> windows;
+
+    // Background prefetching
+    std::thread prefetchThread;
+    std::mutex prefetchMutex;
+    std::condition_variable prefetchCondition;
+    size_t prefetchedOffset;
+    size_t prefetchEnd;
+    size_t prefetchDistance;
+    size_t consumedOffset;
+    bool prefetchStopping;
 };
 
 } // namespace ImageMapping
 
 #endif //_SVR_MAPPED_FILE_HPP_
-
@@ -0,0 +1,100 @@
+#include "SVR/BrickCache.hpp"
+
+namespace SVR
+{
+
+const uint32_t BrickCache::NoSlot;
+const size_t BrickCache::NoBrick;
+
+BrickCache::BrickCache()
+    : firstSlot(NoSlot), lastSlot(NoSlot), frame(0), residentCount(0)
+{
+}
+
+void BrickCache::reset(size_t brickCount, size_t slotCount)
+{
+    brickSlots.assign(brickCount, NoSlot);
+    slotBricks.assign(slotCount, NoBrick);
+    slotFrames.assign(slotCount, 0);
+    previousSlot.resize(slotCount);
+    nextSlot.resize(slotCount);
+    residentCount = 0;
+    frame = 1;
+
+    // The free slots start as the least recently used, in order.
+    firstSlot = lastSlot = NoSlot;
+    for(size_t i = slotCount; i > 0; --i)
+        pushFront(uint32_t(i - 1));
+}
+
+void BrickCache::beginFrame()
+{
+    ++frame;
+}
+
+uint32_t BrickCache::touch(size_t brick)
+{
+    if(brick >= brickSlots.size())
+        return NoSlot;
+
+    auto slot = brickSlots[brick];
+    if(slot == NoSlot)
+        return NoSlot;
+
+    unlink(slot);
+    pushFront(slot);
+    slotFrames[slot] = frame;
+    return slot;
+}
+
+uint32_t BrickCache::allocate(size_t brick, size_t &evictedBrick)
+{
+    evictedBrick = NoBrick;
+    if(brick >= brickSlots.size())
+        return NoSlot;
+    if(brickSlots[brick] != NoSlot)
+        return touch(brick);
+
+    auto slot = lastSlot;
+    if(slot == NoSlot || slotFrames[slot] == frame)
+        return NoSlot;
+
+    evictedBrick = slotBricks[slot];
+    if(evictedBrick != NoBrick)
+        brickSlots[evictedBrick] = NoSlot;
+    else
+        ++residentCount;
+
+    slotBricks[slot] = brick;
+    brickSlots[brick] = slot;
+    unlink(slot);
+    pushFront(slot);
+    slotFrames[slot] = frame;
+    return slot;
+}
+
+void BrickCache::unlink(uint32_t slot)
+{
+    if(previousSlot[slot] != NoSlot)
+        nextSlot[previousSlot[slot]] = nextSlot[slot];
+    else
+        firstSlot = nextSlot[slot];
+
+    if(nextSlot[slot] != NoSlot)
+        previousSlot[nextSlot[slot]] = previousSlot[slot];
+    else
+        lastSlot = previousSlot[slot];
+}
+
+void BrickCache::pushFront(uint32_t slot)
+{
+    previousSlot[slot] = NoSlot;
+    nextSlot[slot] = firstSlot;
+    if(firstSlot != NoSlot)
+        previousSlot[firstSlot] = slot;
+    else
+        lastSlot = slot;
+    firstSlot = slot;
+}
+
+} // namespace SVR
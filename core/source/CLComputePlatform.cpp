@@ -56,6 +56,11 @@ inline cl_channel_order computeMapPixelFormatOrder(PixelFormat format)
     case PixelFormat::RGBA8:
         return CL_RGBA;
 
+    case PixelFormat::L16:
+        return CL_LUMINANCE;
+    case PixelFormat::R16:
+        return CL_R;
+
     case PixelFormat::R32F:
         return CL_R;
     case PixelFormat::RG32F:
@@ -79,6 +84,10 @@ inline cl_channel_type computeMapPixelFormatDataType(PixelFormat format)
     case PixelFormat::RGBA8:
         return CL_UNORM_INT8;
 
+    case PixelFormat::L16:
+    case PixelFormat::R16:
+        return CL_UNORM_INT16;
+
     case PixelFormat::R32F:
     case PixelFormat::RG32F:
     case PixelFormat::RGBA32F:
@@ -152,7 +161,15 @@ public:
 
     virtual void runGlobalKernel1D(const ComputeKernelPtr &kernel, size_t globalWorkSize);
     virtual void runGlobalKernel2D(const ComputeKernelPtr &kernel, size_t globalWorkWidth, size_t globalWorkHeight);
-    virtual void runGlobalKernel2D(const ComputeKernelPtr &kernel, size_t globalWorkWidth, size_t globalWorkHeight, size_t globalWorkDepth);
+    virtual void runGlobalKernel3D(const ComputeKernelPtr &kernel, size_t globalWorkWidth, size_t globalWorkHeight, size_t globalWorkDepth);
+
+    virtual void writeImage3D(const ComputeBufferPtr &image, size_t x, size_t y, size_t z, size_t width, size_t height, size_t depth,
+        size_t rowPitch, size_t slicePitch, const void *data);
+    virtual void readImage2D(const ComputeBufferPtr &image, size_t x, size_t y, size_t width, size_t height,
+        size_t rowPitch, void *data);
+    virtual void copyImage3D(const ComputeBufferPtr &source, const ComputeBufferPtr &destination,
+        size_t sourceX, size_t sourceY, size_t sourceZ, size_t destinationX, size_t destinationY, size_t destinationZ,
+        size_t width, size_t height, size_t depth);
 
 private:
     cl_context context;
@@ -380,10 +397,12 @@ void CLComputeDevice::runGlobalKernel2D(const ComputeKernelPtr &kernel, size_t g
     };
 
     auto clKernel = std::static_pointer_cast<CLComputeKernel> (kernel);
-    clEnqueueNDRangeKernel(commandQueue, clKernel->getKernel(), 2, nullptr, sizes, nullptr, 0, nullptr, nullptr);
+    auto error = clEnqueueNDRangeKernel(commandQueue, clKernel->getKernel(), 2, nullptr, sizes, nullptr, 0, nullptr, nullptr);
+    if(error != CL_SUCCESS)
+        logError("Failed to run a compute kernel.");
 }
 
-void CLComputeDevice::runGlobalKernel2D(const ComputeKernelPtr &kernel, size_t globalWorkWidth, size_t globalWorkHeight, size_t globalWorkDepth)
+void CLComputeDevice::runGlobalKernel3D(const ComputeKernelPtr &kernel, size_t globalWorkWidth, size_t globalWorkHeight, size_t globalWorkDepth)
 {
     size_t sizes[] = {
         globalWorkWidth,
@@ -392,7 +411,46 @@ void CLComputeDevice::runGlobalKernel2D(const ComputeKernelPtr &kernel, size_t g
     };
 
     auto clKernel = std::static_pointer_cast<CLComputeKernel> (kernel);
-    clEnqueueNDRangeKernel(commandQueue, clKernel->getKernel(), 2, nullptr, sizes, nullptr, 0, nullptr, nullptr);
+    clEnqueueNDRangeKernel(commandQueue, clKernel->getKernel(), 3, nullptr, sizes, nullptr, 0, nullptr, nullptr);
+}
+
+void CLComputeDevice::writeImage3D(const ComputeBufferPtr &image, size_t x, size_t y, size_t z, size_t width, size_t height, size_t depth,
+    size_t rowPitch, size_t slicePitch, const void *data)
+{
+    size_t origin[] = {x, y, z};
+    size_t region[] = {width, height, depth};
+
+    auto clImage = std::static_pointer_cast<CLComputeBuffer> (image);
+    auto error = clEnqueueWriteImage(commandQueue, clImage->getMem(), CL_TRUE, origin, region, rowPitch, slicePitch, data, 0, nullptr, nullptr);
+    if(error != CL_SUCCESS)
+        logError("Failed to write a compute image.");
+}
+
+void CLComputeDevice::readImage2D(const ComputeBufferPtr &image, size_t x, size_t y, size_t width, size_t height,
+    size_t rowPitch, void *data)
+{
+    size_t origin[] = {x, y, 0};
+    size_t region[] = {width, height, 1};
+
+    auto clImage = std::static_pointer_cast<CLComputeBuffer> (image);
+    auto error = clEnqueueReadImage(commandQueue, clImage->getMem(), CL_TRUE, origin, region, rowPitch, 0, data, 0, nullptr, nullptr);
+    if(error != CL_SUCCESS)
+        logError("Failed to read a compute image.");
+}
+
+void CLComputeDevice::copyImage3D(const ComputeBufferPtr &source, const ComputeBufferPtr &destination,
+    size_t sourceX, size_t sourceY, size_t sourceZ, size_t destinationX, size_t destinationY, size_t destinationZ,
+    size_t width, size_t height, size_t depth)
+{
+    size_t sourceOrigin[] = {sourceX, sourceY, sourceZ};
+    size_t destinationOrigin[] = {destinationX, destinationY, destinationZ};
+    size_t region[] = {width, height, depth};
+
+    auto clSource = std::static_pointer_cast<CLComputeBuffer> (source);
+    auto clDestination = std::static_pointer_cast<CLComputeBuffer> (destination);
+    auto error = clEnqueueCopyImage(commandQueue, clSource->getMem(), clDestination->getMem(), sourceOrigin, destinationOrigin, region, 0, nullptr, nullptr);
+    if(error != CL_SUCCESS)
+        logError("Failed to copy a compute image.");
 }
 
 /**
@@ -747,7 +805,7 @@ ComputeBufferPtr CLComputePlatform::createImage2D(PixelFormat format, size_t wid
     auto imageFormat = computeMapPixelFormat(format);
     cl_image_desc desc;
     memset(&desc, 0, sizeof(desc));
-    desc.image_type = CL_MEM_OBJECT_IMAGE1D;
+    desc.image_type = CL_MEM_OBJECT_IMAGE2D;
     desc.image_width = width;
     desc.image_height = height;
     desc.image_depth = 1;
@@ -0,0 +1,228 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "SVR/CubeCache.hpp"
+#include "SVR/AstronomyMappings.hpp"
+#include "SVR/Logging.hpp"
+
+namespace SVR
+{
+
+static bool createDirectories(const std::string &path)
+{
+    for(size_t i = 1; i <= path.size(); ++i)
+    {
+        if(i != path.size() && path[i] != '/')
+            continue;
+
+        auto parent = path.substr(0, i);
+        if(mkdir(parent.c_str(), 0755) < 0 && errno != EEXIST)
+            return false;
+    }
+
+    return true;
+}
+
+template<typename FromType, typename ToType, typename Converter>
+void convertSlice(const Converter &converter, const FromType *source, ToType *dest, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        dest[i] = ToType(converter(swapBytes<FromType> (source[i])));
+}
+
+template<typename FromType, typename ToType, typename Converter>
+void convertCube(const Converter &converter, FitsFile *source, FitsFile *output)
+{
+    auto sourceData = reinterpret_cast<const FromType*> (source->getImageData());
+    auto sliceElements = source->getWidth()*source->getHeight();
+    output->writeSlices([&](size_t slice, char *sliceData) {
+        convertSlice(converter, sourceData + slice*sliceElements, reinterpret_cast<ToType*> (sliceData),
+            sliceElements);
+    });
+}
+
+template<typename FromType, typename ToType>
+void convertCube(FitsFile *source, FitsFile *output)
+{
+    // BSCALE, BZERO and BLANK are applied once, when building the cache.
+    auto &keywords = source->getKeywords();
+    bool blank = detail::hasBlankValue<FromType> (keywords);
+    if(keywords.hasScaling())
+    {
+        if(blank)
+            convertCube<FromType, ToType> (detail::PhysicalValue<FromType, true, true> (keywords), source, output);
+        else
+            convertCube<FromType, ToType> (detail::PhysicalValue<FromType, true, false> (keywords), source, output);
+    }
+    else
+    {
+        if(blank)
+            convertCube<FromType, ToType> (detail::PhysicalValue<FromType, false, true> (keywords), source, output);
+        else
+            convertCube<FromType, ToType> (detail::PhysicalValue<FromType, false, false> (keywords), source, output);
+    }
+}
+
+template<typename ToType>
+void convertCube(FitsFile *source, FitsFile *output)
+{
+    switch(source->getFormat())
+    {
+    case FitsFormat::UInt8:
+        convertCube<uint8_t, ToType> (source, output);
+        break;
+    case FitsFormat::Int16:
+        convertCube<int16_t, ToType> (source, output);
+        break;
+    case FitsFormat::Int32:
+        convertCube<int32_t, ToType> (source, output);
+        break;
+    case FitsFormat::Int64:
+        convertCube<int64_t, ToType> (source, output);
+        break;
+    case FitsFormat::Float:
+        convertCube<float, ToType> (source, output);
+        break;
+    case FitsFormat::Double:
+        convertCube<double, ToType> (source, output);
+        break;
+    }
+}
+
+CubeCache::CubeCache(const std::string &directory)
+    : directory(directory)
+{
+}
+
+std::string CubeCache::getDefaultDirectory()
+{
+    auto cacheDirectory = getenv("SVR_CACHE_DIR");
+    if(cacheDirectory)
+        return cacheDirectory;
+
+    auto userCacheDirectory = getenv("XDG_CACHE_HOME");
+    if(userCacheDirectory)
+        return std::string(userCacheDirectory) + "/svr";
+
+    auto homeDirectory = getenv("HOME");
+    if(homeDirectory)
+        return std::string(homeDirectory) + "/.cache/svr";
+
+    return ".svrcache";
+}
+
+std::string CubeCache::computeKey(const std::string &fitsFileName, FitsFile *fits) const
+{
+    return computeCubeKey(fitsFileName, fits);
+}
+
+std::string CubeCache::getCubeFileName(const std::string &key) const
+{
+    return directory + "/" + key + ".fits";
+}
+
+std::string CubeCache::getStatisticsFileName(const std::string &key) const
+{
+    return directory + "/" + key + ".stats";
+}
+
+FitsFile *CubeCache::open(const std::string &key, CubeStatistics &statistics, FitsAccessMode accessMode)
+{
+    // The statistics are written last, so they mark a complete entry.
+    if(key.empty() || !statistics.load(getStatisticsFileName(key), key))
+        return nullptr;
+
+    auto cube = FitsFile::open(getCubeFileName(key).c_str(), false, accessMode);
+    if(cube && !cube->isNativeByteOrder())
+    {
+        delete cube;
+        return nullptr;
+    }
+
+    return cube;
+}
+
+FitsFile *CubeCache::store(const std::string &key, FitsFile *source, CubeStatistics &statistics, FitsAccessMode accessMode)
+{
+    // Virtual cubes are not copied, because that is what they avoid.
+    if(key.empty() || source->isNativeByteOrder() || source->isVirtual())
+        return nullptr;
+
+    if(!createDirectories(directory))
+    {
+        logError("Failed to create the cube cache directory");
+        return nullptr;
+    }
+
+    // Double precision is only kept for double cubes.
+    auto outputFormat = source->getFormat() == FitsFormat::Double ? FitsFormat::Double : FitsFormat::Float;
+
+    char buffer[64];
+    FitsHeaderProperties properties;
+    properties["SIMPLE"] = "T";
+    properties["BITPIX"] = std::to_string(int(outputFormat));
+    properties["NAXIS"] = std::to_string(source->getAxisCount());
+    properties["BYTEORDR"] = isHostLittleEndian() ? "'LITTLE'" : "'BIG'";
+
+    auto &keywords = source->getKeywords();
+    for(size_t i = 0; i < source->getAxisCount(); ++i)
+    {
+        auto axisSuffix = std::to_string(i + 1);
+        properties["NAXIS" + axisSuffix] = std::to_string(source->getAxis(i));
+        if(i < keywords.pixelDelta.size())
+        {
+            sprintf(buffer, "%.17g", keywords.referencePixel[i]);
+            properties["CRPIX" + axisSuffix] = buffer;
+            sprintf(buffer, "%.17g", keywords.referenceValue[i]);
+            properties["CRVAL" + axisSuffix] = buffer;
+            sprintf(buffer, "%.17g", keywords.pixelDelta[i]);
+            properties["CDELT" + axisSuffix] = buffer;
+        }
+    }
+
+    // Write into a temporary file, that is renamed when it is complete.
+    auto cubeFileName = getCubeFileName(key);
+    auto temporaryFileName = cubeFileName + ".tmp";
+    auto outputElementSize = abs(int(outputFormat)) / 8;
+    auto output = FitsFile::create(temporaryFileName.c_str(), properties, source->getNumberOfElements()*outputElementSize);
+    if(!output)
+        return nullptr;
+
+    if(outputFormat == FitsFormat::Double)
+        convertCube<double> (source, output);
+    else
+        convertCube<float> (source, output);
+
+    output->close();
+    delete output;
+
+    if(rename(temporaryFileName.c_str(), cubeFileName.c_str()) < 0)
+    {
+        logError("Failed to store a cube in the cache");
+        remove(temporaryFileName.c_str());
+        return nullptr;
+    }
+
+    // The statistics are computed from the cached physical values, and saved last.
+    auto cube = FitsFile::open(cubeFileName.c_str(), false, accessMode);
+    if(!cube)
+        return nullptr;
+
+    computeCubeStatistics(cube, statistics);
+    if(!statistics.save(getStatisticsFileName(key), key))
+    {
+        logError("Failed to store the statistics of a cube in the cache");
+        cube->close();
+        delete cube;
+        remove(cubeFileName.c_str());
+        return nullptr;
+    }
+
+    return cube;
+}
+
+} // namespace SVR
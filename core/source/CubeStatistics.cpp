@@ -0,0 +1,486 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "SVR/CubeStatistics.hpp"
+#include "SVR/AstronomyMappings.hpp"
+
+namespace SVR
+{
+
+const int CubeStatisticsVersion = 3;
+
+inline uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+    // FNV-1a
+    auto bytes = reinterpret_cast<const uint8_t*> (data);
+    for(size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+inline uint64_t hashString(uint64_t hash, const std::string &string)
+{
+    return hashBytes(hash, string.c_str(), string.size() + 1);
+}
+
+/**
+ * Count, mean and sum of squared deviations of the values that are not NaN.
+ * They are merged in a fixed order, so the results do not depend on the threads.
+ */
+struct ValueMoments
+{
+    ValueMoments()
+        : count(0), nanCount(0), mean(0.0), m2(0.0), minValue(NAN), maxValue(NAN) {}
+
+    void merge(const ValueMoments &other)
+    {
+        nanCount += other.nanCount;
+        if(!other.count)
+            return;
+
+        if(!count)
+        {
+            count = other.count;
+            mean = other.mean;
+            m2 = other.m2;
+            minValue = other.minValue;
+            maxValue = other.maxValue;
+            return;
+        }
+
+        double total = double(count + other.count);
+        double delta = other.mean - mean;
+        mean += delta*double(other.count) / total;
+        m2 += other.m2 + delta*delta*double(count)*double(other.count) / total;
+        count += other.count;
+        minValue = std::min(minValue, other.minValue);
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    double getMean() const
+    {
+        return count ? mean : NAN;
+    }
+
+    double getStandardDeviation() const
+    {
+        return count ? sqrt(std::max(0.0, m2) / double(count)) : NAN;
+    }
+
+    uint64_t count;
+    uint64_t nanCount;
+    double mean;
+    double m2;
+    double minValue;
+    double maxValue;
+};
+
+inline bool isBrickAligned(SliceRange range, size_t axisSize, int brickSize)
+{
+    size_t end = range.start + range.size;
+    return range.start >= 0 && range.size > 0 && end <= axisSize &&
+        range.start % brickSize == 0 && (end % brickSize == 0 || end == axisSize);
+}
+
+template<typename FromType, bool BigEndian, typename Converter>
+void computeCubeStatistics(const Converter &converter, FitsFile *cube, CubeStatistics &statistics,
+    size_t histogramBinCount, int brickSize)
+{
+    size_t width = std::max(size_t(1), cube->getWidth());
+    size_t sliceElements = std::max(size_t(1), cube->getWidth()*cube->getHeight());
+    size_t sliceCount = cube->getNumberOfElements() / sliceElements;
+    SliceRange wholeX(0, cube->getWidth());
+    SliceRange wholeY(0, cube->getHeight());
+    SliceRange wholeZ(0, sliceCount);
+
+    brickSize = std::max(1, brickSize);
+    statistics.brickSize = brickSize;
+    statistics.brickCountX = (cube->getWidth() + brickSize - 1) / brickSize;
+    statistics.brickCountY = (cube->getHeight() + brickSize - 1) / brickSize;
+    statistics.brickCountZ = (sliceCount + brickSize - 1) / brickSize;
+    auto brickCountX = statistics.brickCountX;
+    auto brickSliceCount = brickCountX*statistics.brickCountY;
+    statistics.brickMinValue.assign(brickSliceCount*statistics.brickCountZ, NAN);
+    statistics.brickMaxValue.assign(brickSliceCount*statistics.brickCountZ, NAN);
+
+    // Moments of each slice, and the range of each brick, in a single pass.
+    std::vector<ValueMoments> sliceMoments(sliceCount);
+    cube->readRowBlocks(wholeX, wholeY, wholeZ, [&](const char *rows, int slice, int firstRow, int rowCount) {
+        // Each task reads the rows of one row of bricks, so the tasks update different bricks.
+        int firstBrickRow = firstRow / brickSize;
+        int lastBrickRow = (firstRow + rowCount - 1) / brickSize;
+        std::vector<ValueMoments> taskMoments(lastBrickRow - firstBrickRow + 1);
+        ThreadPool::getDefault().parallelFor(taskMoments.size(), [&](size_t task) {
+            int brickRow = firstBrickRow + int(task);
+            int taskFirstRow = std::max(firstRow, brickRow*brickSize);
+            int taskEndRow = std::min(firstRow + rowCount, (brickRow + 1)*brickSize);
+            auto brickIndex = (slice / brickSize)*brickSliceCount + brickRow*brickCountX;
+            auto brickMin = &statistics.brickMinValue[brickIndex];
+            auto brickMax = &statistics.brickMaxValue[brickIndex];
+
+            // The sums are relative to the first value, for their precision.
+            auto &moments = taskMoments[task];
+            double shift = NAN;
+            double sum = 0.0;
+            double sumSquares = 0.0;
+            double taskMin = INFINITY;
+            double taskMax = -INFINITY;
+            for(int row = taskFirstRow; row < taskEndRow; ++row)
+            {
+                auto values = reinterpret_cast<const FromType*> (rows) + size_t(row - firstRow)*width;
+                for(size_t brick = 0; brick < brickCountX; ++brick)
+                {
+                    double rangeMin = INFINITY;
+                    double rangeMax = -INFINITY;
+                    auto columnEnd = std::min(width, (brick + 1)*brickSize);
+                    for(size_t column = brick*brickSize; column < columnEnd; ++column)
+                    {
+                        double value = converter(detail::loadRawValue<FromType, BigEndian> (values[column]));
+                        if(isnan(value))
+                        {
+                            ++moments.nanCount;
+                            continue;
+                        }
+
+                        if(isnan(shift))
+                            shift = value;
+                        auto deviation = value - shift;
+                        sum += deviation;
+                        sumSquares += deviation*deviation;
+                        ++moments.count;
+                        rangeMin = std::min(rangeMin, value);
+                        rangeMax = std::max(rangeMax, value);
+                    }
+
+                    if(rangeMin <= rangeMax)
+                    {
+                        brickMin[brick] = detail::minIgnoreNaN(brickMin[brick], rangeMin);
+                        brickMax[brick] = detail::maxIgnoreNaN(brickMax[brick], rangeMax);
+                        taskMin = std::min(taskMin, rangeMin);
+                        taskMax = std::max(taskMax, rangeMax);
+                    }
+                }
+            }
+
+            if(moments.count)
+            {
+                moments.mean = shift + sum / double(moments.count);
+                moments.m2 = sumSquares - sum*sum / double(moments.count);
+                moments.minValue = taskMin;
+                moments.maxValue = taskMax;
+            }
+        });
+
+        for(auto &moments : taskMoments)
+            sliceMoments[slice].merge(moments);
+    });
+
+    ValueMoments cubeMoments;
+    statistics.sliceMinValue.resize(sliceCount);
+    statistics.sliceMaxValue.resize(sliceCount);
+    statistics.sliceMeanValue.resize(sliceCount);
+    statistics.sliceStandardDeviation.resize(sliceCount);
+    statistics.sliceNanCount.resize(sliceCount);
+    for(size_t i = 0; i < sliceCount; ++i)
+    {
+        auto &moments = sliceMoments[i];
+        statistics.sliceMinValue[i] = moments.minValue;
+        statistics.sliceMaxValue[i] = moments.maxValue;
+        statistics.sliceMeanValue[i] = moments.getMean();
+        statistics.sliceStandardDeviation[i] = moments.getStandardDeviation();
+        statistics.sliceNanCount[i] = moments.nanCount;
+        cubeMoments.merge(moments);
+    }
+
+    statistics.minValue = cubeMoments.minValue;
+    statistics.maxValue = cubeMoments.maxValue;
+    statistics.meanValue = cubeMoments.getMean();
+    statistics.standardDeviation = cubeMoments.getStandardDeviation();
+    statistics.nanCount = cubeMoments.nanCount;
+
+    // Histogram, with a histogram for each chunk of rows.
+    auto binCount = histogramBinCount;
+    auto range = statistics.maxValue - statistics.minValue;
+    auto binScale = range > 0.0 ? binCount / range : 0.0;
+    statistics.histogram.assign(binCount, 0);
+    if(!binCount || cubeMoments.count == 0)
+        return;
+
+    cube->readRowBlocks(wholeX, wholeY, wholeZ, [&](const char *rows, int, int, int rowCount) {
+        int rowsPerChunk = detail::rowsPerParallelChunk(width);
+        size_t chunkCount = (rowCount + rowsPerChunk - 1) / rowsPerChunk;
+        std::vector<std::vector<uint64_t>> chunkHistograms(chunkCount);
+        ThreadPool::getDefault().parallelFor(chunkCount, [&](size_t chunk) {
+            auto &histogram = chunkHistograms[chunk];
+            histogram.assign(binCount, 0);
+            auto firstRow = chunk*rowsPerChunk;
+            auto values = reinterpret_cast<const FromType*> (rows) + firstRow*width;
+            auto count = std::min(size_t(rowsPerChunk), rowCount - firstRow)*width;
+            for(size_t i = 0; i < count; ++i)
+            {
+                auto value = converter(detail::loadRawValue<FromType, BigEndian> (values[i]));
+                if(isnan(value))
+                    continue;
+
+                auto bin = size_t((value - statistics.minValue)*binScale);
+                ++histogram[std::min(bin, binCount - 1)];
+            }
+        });
+
+        for(auto &histogram : chunkHistograms)
+        {
+            for(size_t bin = 0; bin < binCount; ++bin)
+                statistics.histogram[bin] += histogram[bin];
+        }
+    });
+}
+
+template<typename FromType, bool BigEndian>
+void computeCubeStatistics(FitsFile *cube, CubeStatistics &statistics, size_t histogramBinCount, int brickSize)
+{
+    auto &keywords = cube->getKeywords();
+    bool blank = detail::hasBlankValue<FromType> (keywords);
+    if(keywords.hasScaling())
+    {
+        if(blank)
+            computeCubeStatistics<FromType, BigEndian> (detail::PhysicalValue<FromType, true, true> (keywords), cube, statistics, histogramBinCount, brickSize);
+        else
+            computeCubeStatistics<FromType, BigEndian> (detail::PhysicalValue<FromType, true, false> (keywords), cube, statistics, histogramBinCount, brickSize);
+    }
+    else
+    {
+        if(blank)
+            computeCubeStatistics<FromType, BigEndian> (detail::PhysicalValue<FromType, false, true> (keywords), cube, statistics, histogramBinCount, brickSize);
+        else
+            computeCubeStatistics<FromType, BigEndian> (detail::PhysicalValue<FromType, false, false> (keywords), cube, statistics, histogramBinCount, brickSize);
+    }
+}
+
+template<typename FromType>
+void computeCubeStatistics(FitsFile *cube, CubeStatistics &statistics, size_t histogramBinCount, int brickSize)
+{
+    if(cube->isNativeByteOrder())
+        computeCubeStatistics<FromType, false> (cube, statistics, histogramBinCount, brickSize);
+    else
+        computeCubeStatistics<FromType, true> (cube, statistics, histogramBinCount, brickSize);
+}
+
+void computeCubeStatistics(FitsFile *cube, CubeStatistics &statistics, size_t histogramBinCount, int brickSize)
+{
+    switch(cube->getFormat())
+    {
+    case FitsFormat::UInt8:
+        computeCubeStatistics<uint8_t> (cube, statistics, histogramBinCount, brickSize);
+        break;
+    case FitsFormat::Int16:
+        computeCubeStatistics<int16_t> (cube, statistics, histogramBinCount, brickSize);
+        break;
+    case FitsFormat::Int32:
+        computeCubeStatistics<int32_t> (cube, statistics, histogramBinCount, brickSize);
+        break;
+    case FitsFormat::Int64:
+        computeCubeStatistics<int64_t> (cube, statistics, histogramBinCount, brickSize);
+        break;
+    case FitsFormat::Float:
+        computeCubeStatistics<float> (cube, statistics, histogramBinCount, brickSize);
+        break;
+    case FitsFormat::Double:
+        computeCubeStatistics<double> (cube, statistics, histogramBinCount, brickSize);
+        break;
+    }
+}
+
+std::string computeCubeKey(const std::string &fitsFileName, FitsFile *fits)
+{
+    char path[PATH_MAX];
+    struct stat fileStatus;
+    if(!realpath(fitsFileName.c_str(), path) || stat(path, &fileStatus) < 0)
+        return std::string();
+
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashString(hash, path);
+    hash = hashString(hash, std::to_string(fileStatus.st_size));
+    hash = hashString(hash, std::to_string(fileStatus.st_mtime));
+    hash = hashString(hash, std::to_string(fits->getSelectedHdu()));
+    for(auto &card : fits->getHeader())
+    {
+        hash = hashBytes(hash, card.key.data, card.key.size);
+        hash = hashBytes(hash, "=", 1);
+        hash = hashBytes(hash, card.value.data, card.value.size);
+    }
+
+    char key[32];
+    sprintf(key, "%016llx", (unsigned long long)hash);
+    return key;
+}
+
+bool CubeStatistics::getRegionRange(FitsFile *cube, SliceRange x, SliceRange y, SliceRange z, double &regionMin, double &regionMax) const
+{
+    for(auto &range : regionRanges)
+    {
+        if(range.x == x && range.y == y && range.z == z)
+        {
+            regionMin = range.minValue;
+            regionMax = range.maxValue;
+            return true;
+        }
+    }
+
+    bool wholeSlices = x.start == 0 && size_t(x.size) == cube->getWidth() &&
+        y.start == 0 && size_t(y.size) == cube->getHeight();
+    if(wholeSlices && z.start >= 0 && z.size > 0 && size_t(z.start + z.size) <= sliceMinValue.size())
+    {
+        regionMin = regionMax = NAN;
+        for(int slice = z.start; slice < z.start + z.size; ++slice)
+        {
+            regionMin = detail::minIgnoreNaN(regionMin, sliceMinValue[slice]);
+            regionMax = detail::maxIgnoreNaN(regionMax, sliceMaxValue[slice]);
+        }
+
+        return true;
+    }
+
+    // The last brick of each axis may be partial.
+    size_t sliceCount = cube->getNumberOfElements() / std::max(size_t(1), cube->getWidth()*cube->getHeight());
+    if(brickMinValue.empty() || !isBrickAligned(x, cube->getWidth(), brickSize) || !isBrickAligned(y, cube->getHeight(), brickSize) ||
+        !isBrickAligned(z, sliceCount, brickSize))
+        return false;
+
+    regionMin = regionMax = NAN;
+    for(int brickZ = z.start / brickSize; brickZ*brickSize < z.start + z.size; ++brickZ)
+    {
+        for(int brickY = y.start / brickSize; brickY*brickSize < y.start + y.size; ++brickY)
+        {
+            for(int brickX = x.start / brickSize; brickX*brickSize < x.start + x.size; ++brickX)
+            {
+                auto index = (brickZ*brickCountY + brickY)*brickCountX + brickX;
+                regionMin = detail::minIgnoreNaN(regionMin, brickMinValue[index]);
+                regionMax = detail::maxIgnoreNaN(regionMax, brickMaxValue[index]);
+            }
+        }
+    }
+
+    return true;
+}
+
+void CubeStatistics::setRegionRange(SliceRange x, SliceRange y, SliceRange z, double regionMin, double regionMax)
+{
+    for(auto &range : regionRanges)
+    {
+        if(range.x == x && range.y == y && range.z == z)
+        {
+            range.minValue = regionMin;
+            range.maxValue = regionMax;
+            return;
+        }
+    }
+
+    regionRanges.push_back(RegionRange{x, y, z, regionMin, regionMax});
+}
+
+std::string CubeStatistics::sidecarFileNameFor(const std::string &fitsFileName)
+{
+    return fitsFileName + ".svrstats";
+}
+
+bool CubeStatistics::load(const std::string &fileName, const std::string &key)
+{
+    FILE *f = fopen(fileName.c_str(), "r");
+    if(!f)
+        return false;
+
+    int version;
+    char storedKey[32];
+    unsigned long long storedNanCount, binCount, sliceCount, storedBrickCountX, storedBrickCountY, storedBrickCountZ;
+    if(fscanf(f, "SVRCUBESTATS %d %31s", &version, storedKey) != 2 || version != CubeStatisticsVersion || key != storedKey ||
+        fscanf(f, "%lf %lf %lf %lf %llu %llu %llu %d %llu %llu %llu", &minValue, &maxValue, &meanValue, &standardDeviation,
+        &storedNanCount, &binCount, &sliceCount, &brickSize, &storedBrickCountX, &storedBrickCountY, &storedBrickCountZ) != 11)
+    {
+        fclose(f);
+        return false;
+    }
+
+    nanCount = storedNanCount;
+    brickCountX = storedBrickCountX;
+    brickCountY = storedBrickCountY;
+    brickCountZ = storedBrickCountZ;
+    histogram.resize(binCount);
+    for(auto &bin : histogram)
+    {
+        unsigned long long count;
+        if(fscanf(f, "%llu", &count) != 1)
+        {
+            fclose(f);
+            return false;
+        }
+        bin = count;
+    }
+
+    sliceMinValue.resize(sliceCount);
+    sliceMaxValue.resize(sliceCount);
+    sliceMeanValue.resize(sliceCount);
+    sliceStandardDeviation.resize(sliceCount);
+    sliceNanCount.resize(sliceCount);
+    for(size_t i = 0; i < sliceCount; ++i)
+    {
+        unsigned long long storedSliceNanCount;
+        if(fscanf(f, "%lf %lf %lf %lf %llu", &sliceMinValue[i], &sliceMaxValue[i], &sliceMeanValue[i], &sliceStandardDeviation[i],
+            &storedSliceNanCount) != 5)
+        {
+            sliceMinValue.clear();
+            sliceMaxValue.clear();
+            fclose(f);
+            return false;
+        }
+        sliceNanCount[i] = storedSliceNanCount;
+    }
+
+    size_t brickCount = brickCountX*brickCountY*brickCountZ;
+    brickMinValue.resize(brickCount);
+    brickMaxValue.resize(brickCount);
+    for(size_t i = 0; i < brickCount; ++i)
+    {
+        if(fscanf(f, "%lf %lf", &brickMinValue[i], &brickMaxValue[i]) != 2)
+        {
+            sliceMinValue.clear();
+            sliceMaxValue.clear();
+            brickMinValue.clear();
+            brickMaxValue.clear();
+            fclose(f);
+            return false;
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+bool CubeStatistics::save(const std::string &fileName, const std::string &key) const
+{
+    FILE *f = fopen(fileName.c_str(), "w");
+    if(!f)
+        return false;
+
+    fprintf(f, "SVRCUBESTATS %d %s %.17g %.17g %.17g %.17g %llu %llu %llu %d %llu %llu %llu\n", CubeStatisticsVersion, key.c_str(),
+        minValue, maxValue, meanValue, standardDeviation,
+        (unsigned long long)nanCount, (unsigned long long)histogram.size(), (unsigned long long)sliceMinValue.size(),
+        brickSize, (unsigned long long)brickCountX, (unsigned long long)brickCountY, (unsigned long long)brickCountZ);
+    for(auto bin : histogram)
+        fprintf(f, "%llu\n", (unsigned long long)bin);
+    for(size_t i = 0; i < sliceMinValue.size(); ++i)
+    {
+        fprintf(f, "%.17g %.17g %.17g %.17g %llu\n", sliceMinValue[i], sliceMaxValue[i], sliceMeanValue[i], sliceStandardDeviation[i],
+            (unsigned long long)sliceNanCount[i]);
+    }
+    for(size_t i = 0; i < brickMinValue.size(); ++i)
+        fprintf(f, "%.17g %.17g\n", brickMinValue[i], brickMaxValue[i]);
+
+    fclose(f);
+    return true;
+}
+
+} // namespace SVR
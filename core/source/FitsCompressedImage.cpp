@@ -0,0 +1,767 @@
+#include <zlib.h>
+#include <limits>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SVR/FitsCompressedImage.hpp"
+#include "SVR/Endianness.hpp"
+#include "SVR/Logging.hpp"
+#include "SVR/ThreadPool.hpp"
+
+namespace SVR
+{
+
+// Quantization constants of the tiled image convention.
+const int DitherRandomCount = 10000;
+const int32_t DitherZeroValue = -2147483646;
+
+/**
+ * The pseudo random sequence that is used for the subtractive dithering.
+ */
+static const std::vector<float> &ditherRandomValues()
+{
+    static std::vector<float> values = []() {
+        std::vector<float> result(DitherRandomCount);
+        double a = 16807.0;
+        double m = 2147483647.0;
+        double seed = 1.0;
+        for(int i = 0; i < DitherRandomCount; ++i)
+        {
+            double temp = a*seed;
+            seed = temp - m*int(temp/m);
+            result[i] = float(seed/m);
+        }
+        return result;
+    }();
+    return values;
+}
+
+inline size_t tableTypeSize(char type)
+{
+    switch(type)
+    {
+    case 'L':
+    case 'B':
+    case 'A':
+        return 1;
+    case 'I':
+        return 2;
+    case 'J':
+    case 'E':
+        return 4;
+    case 'K':
+    case 'D':
+    case 'C':
+    case 'P':
+        return 8;
+    case 'M':
+    case 'Q':
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+template<typename T>
+inline T readBigEndian(const char *data)
+{
+    T value;
+    memcpy(&value, data, sizeof(T));
+    return swapBytes<T> (value);
+}
+
+template<typename T>
+inline void writeBigEndian(char *data, T value)
+{
+    value = swapBytes<T> (value);
+    memcpy(data, &value, sizeof(T));
+}
+
+inline int bitLength(uint64_t value)
+{
+    int result = 0;
+    for(; value; value >>= 1)
+        ++result;
+    return result;
+}
+
+/**
+ * Rice decoder with the parameters of fpack for each pixel size.
+ */
+template<typename ValueType, int FsBits, int FsMax>
+bool riceDecode(const uint8_t *input, size_t inputSize, int32_t *output, size_t count, size_t blockSize)
+{
+    typedef typename std::make_unsigned<ValueType>::type UnsignedValue;
+    const int ValueBits = sizeof(ValueType)*8;
+    auto end = input + inputSize;
+    if(inputSize < sizeof(ValueType) + 1)
+        return false;
+
+    // The first value is stored without compression.
+    UnsignedValue lastValue = 0;
+    for(size_t i = 0; i < sizeof(ValueType); ++i)
+        lastValue = UnsignedValue((lastValue << 8) | *input++);
+
+    uint64_t buffer = *input++;
+    int bitCount = 8;
+    auto fillBuffer = [&](int requiredBits) {
+        while(bitCount < requiredBits)
+        {
+            buffer = (buffer << 8) | (input < end ? *input++ : 0);
+            bitCount += 8;
+        }
+    };
+
+    for(size_t i = 0; i < count; )
+    {
+        // Read the split position of the block.
+        fillBuffer(FsBits);
+        bitCount -= FsBits;
+        int fs = int(buffer >> bitCount) - 1;
+        buffer &= (uint64_t(1) << bitCount) - 1;
+
+        auto blockEnd = std::min(i + blockSize, count);
+        if(fs < 0)
+        {
+            // Constant block.
+            for(; i < blockEnd; ++i)
+                output[i] = ValueType(lastValue);
+        }
+        else
+        {
+            for(; i < blockEnd; ++i)
+            {
+                uint64_t difference;
+                if(fs == FsMax)
+                {
+                    // High entropy block, with the differences stored directly.
+                    fillBuffer(ValueBits);
+                    bitCount -= ValueBits;
+                    difference = buffer >> bitCount;
+                }
+                else
+                {
+                    // Count the leading zeros of the unary high part.
+                    while(buffer == 0)
+                    {
+                        if(input >= end)
+                            return false;
+                        bitCount += 8;
+                        buffer = *input++;
+                    }
+
+                    int zeroCount = bitCount - bitLength(buffer);
+                    bitCount -= zeroCount + 1;
+                    buffer ^= uint64_t(1) << bitCount;
+
+                    fillBuffer(fs);
+                    bitCount -= fs;
+                    difference = (uint64_t(zeroCount) << fs) | (buffer >> bitCount);
+                }
+                buffer &= (uint64_t(1) << bitCount) - 1;
+
+                // Undo the mapping of the signed differences.
+                UnsignedValue mapped = UnsignedValue(difference);
+                mapped = (mapped & 1) ? UnsignedValue(~(mapped >> 1)) : UnsignedValue(mapped >> 1);
+                lastValue = UnsignedValue(mapped + lastValue);
+                output[i] = ValueType(lastValue);
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool gzipDecompress(const char *input, size_t inputSize, char *output, size_t outputSize)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    // Accept both gzip and zlib streams.
+    if(inflateInit2(&stream, 15 + 32) != Z_OK)
+        return false;
+
+    stream.next_in = (Bytef*)input;
+    stream.avail_in = uInt(inputSize);
+    stream.next_out = (Bytef*)output;
+    stream.avail_out = uInt(outputSize);
+    auto result = inflate(&stream, Z_FINISH);
+    auto decompressedSize = stream.total_out;
+    inflateEnd(&stream);
+    return (result == Z_STREAM_END || result == Z_BUF_ERROR) && decompressedSize == outputSize;
+}
+
+static void unshuffleBytes(char *data, size_t elementCount, size_t elementSize)
+{
+    // GZIP_2 stores the most significant bytes of all the elements first.
+    std::unique_ptr<char[]> shuffled(new char[elementCount*elementSize]);
+    memcpy(shuffled.get(), data, elementCount*elementSize);
+    for(size_t i = 0; i < elementCount; ++i)
+    {
+        for(size_t j = 0; j < elementSize; ++j)
+            data[i*elementSize + j] = shuffled[j*elementCount + i];
+    }
+}
+
+FitsCompressedImage::FitsCompressedImage(MemoryMappedFile *memoryFile, size_t dataOffset, const FitsHeader &header)
+    : memoryFile(memoryFile), dataOffset(dataOffset), tableData(nullptr),
+      rowSize(0), rowCount(0), heapOffset(0), heapSize(0),
+      format(FitsFormat::UInt8), elementSize(0),
+      compression(FitsCompression::Unsupported), riceBlockSize(32), riceBytesPerPixel(4),
+      quantization(FitsQuantization::None), scale(1.0), zero(0.0), blank(0), hasBlank(false), ditherOffset(1)
+{
+    readTableLayout(header);
+    readCompressionParameters(header);
+    if(!isSupported())
+        return;
+
+    size_t tableSize = rowSize*rowCount + heapSize;
+    tableData = memoryFile->mapWindow(tableWindow, dataOffset, tableSize);
+    decodedTiles.resize(getNumberOfTiles(), false);
+}
+
+FitsCompressedImage::~FitsCompressedImage()
+{
+    tableWindow.unmap();
+}
+
+bool FitsCompressedImage::isCompressedImage(const FitsHeader &header)
+{
+    return header.getString("ZIMAGE") == "T";
+}
+
+bool FitsCompressedImage::isSupported() const
+{
+    return compression != FitsCompression::Unsupported && !axis.empty() &&
+        compressedDataColumn.isValid() && rowCount == getNumberOfTiles();
+}
+
+FitsFormat FitsCompressedImage::getFormat() const
+{
+    return format;
+}
+
+const std::vector<size_t> &FitsCompressedImage::getAxis() const
+{
+    return axis;
+}
+
+size_t FitsCompressedImage::getNumberOfTiles() const
+{
+    size_t result = 1;
+    for(auto count : tileCount)
+        result *= count;
+    return result;
+}
+
+void FitsCompressedImage::readTableLayout(const FitsHeader &header)
+{
+    char key[32];
+    rowSize = header.getInteger("NAXIS1");
+    rowCount = header.getInteger("NAXIS2");
+    heapSize = header.getInteger("PCOUNT");
+    heapOffset = header.getInteger("THEAP", rowSize*rowCount);
+
+    size_t columnOffset = 0;
+    int fieldCount = int(header.getInteger("TFIELDS"));
+    for(int i = 1; i <= fieldCount; ++i)
+    {
+        sprintf(key, "TFORM%d", i);
+        auto form = header.getString(key);
+
+        // The form is an optional repeat count followed by the type.
+        FitsTableColumn column;
+        column.offset = columnOffset;
+        column.repeat = 1;
+        size_t position = 0;
+        if(!form.empty() && isdigit(form[0]))
+            column.repeat = strtoul(form.c_str(), nullptr, 10);
+        while(position < form.size() && isdigit(form[position]))
+            ++position;
+        if(position < form.size())
+            column.type = form[position];
+        if(position + 1 < form.size())
+            column.arrayType = form[position + 1];
+
+        if(column.type == 'X')
+            columnOffset += (column.repeat + 7) / 8;
+        else
+            columnOffset += column.repeat*tableTypeSize(column.type);
+
+        sprintf(key, "TTYPE%d", i);
+        auto name = header.getString(key);
+        if(name == "COMPRESSED_DATA")
+            compressedDataColumn = column;
+        else if(name == "GZIP_COMPRESSED_DATA")
+            gzipCompressedDataColumn = column;
+        else if(name == "UNCOMPRESSED_DATA")
+            uncompressedDataColumn = column;
+        else if(name == "ZSCALE")
+            scaleColumn = column;
+        else if(name == "ZZERO")
+            zeroColumn = column;
+        else if(name == "ZBLANK")
+            blankColumn = column;
+    }
+
+    if(columnOffset != rowSize)
+        logError("Compressed FITS table row size does not match its columns");
+}
+
+void FitsCompressedImage::readCompressionParameters(const FitsHeader &header)
+{
+    char key[32];
+    format = (FitsFormat)header.getInteger("ZBITPIX");
+    elementSize = abs(int(format)) / 8;
+
+    // Image size and tiling. Rows are the default tiles.
+    int axisCount = int(header.getInteger("ZNAXIS"));
+    for(int i = 1; i <= axisCount; ++i)
+    {
+        sprintf(key, "ZNAXIS%d", i);
+        auto axisSize = size_t(header.getInteger(key));
+        sprintf(key, "ZTILE%d", i);
+        auto tile = size_t(header.getInteger(key, i == 1 ? axisSize : 1));
+        if(axisSize == 0 || tile == 0)
+        {
+            axis.clear();
+            return;
+        }
+
+        axis.push_back(axisSize);
+        tileSize.push_back(tile);
+        tileCount.push_back((axisSize + tile - 1) / tile);
+    }
+
+    auto compressionType = header.getString("ZCMPTYPE");
+    if(compressionType == "RICE_1" || compressionType == "RICE_ONE")
+        compression = FitsCompression::Rice;
+    else if(compressionType == "GZIP_1")
+        compression = FitsCompression::Gzip;
+    else if(compressionType == "GZIP_2")
+        compression = FitsCompression::ShuffledGzip;
+    else
+        logError("Unsupported FITS tile compression");
+
+    // Algorithm parameters.
+    for(int i = 1; ; ++i)
+    {
+        sprintf(key, "ZNAME%d", i);
+        if(!header.contains(key))
+            break;
+
+        auto name = header.getString(key);
+        sprintf(key, "ZVAL%d", i);
+        if(name == "BLOCKSIZE")
+            riceBlockSize = header.getInteger(key, 32);
+        else if(name == "BYTEPIX")
+            riceBytesPerPixel = header.getInteger(key, 4);
+    }
+
+    if(compression == FitsCompression::Rice && riceBytesPerPixel != 1 && riceBytesPerPixel != 2 && riceBytesPerPixel != 4)
+    {
+        logError("Unsupported Rice pixel size");
+        compression = FitsCompression::Unsupported;
+    }
+
+    // Floating point tiles are quantized into integers.
+    if(format == FitsFormat::Float || format == FitsFormat::Double)
+    {
+        auto method = header.getString("ZQUANTIZ");
+        if(method == "SUBTRACTIVE_DITHER_1")
+            quantization = FitsQuantization::SubtractiveDither1;
+        else if(method == "SUBTRACTIVE_DITHER_2")
+            quantization = FitsQuantization::SubtractiveDither2;
+        else if(method == "NO_DITHER" || scaleColumn.isValid() || header.contains("ZSCALE"))
+            quantization = FitsQuantization::NoDither;
+
+        scale = header.getDouble("ZSCALE", 1.0);
+        zero = header.getDouble("ZZERO", 0.0);
+        ditherOffset = int(header.getInteger("ZDITHER0", 1));
+        hasBlank = header.contains("ZBLANK");
+        blank = header.getInteger("ZBLANK");
+    }
+}
+
+template<typename Function>
+void FitsCompressedImage::forEachTileRow(size_t tileIndex, const Function &function) const
+{
+    // Locate the tile in the tile grid.
+    auto axisCount = axis.size();
+    std::vector<size_t> origin(axisCount);
+    std::vector<size_t> extent(axisCount);
+    for(size_t i = 0; i < axisCount; ++i)
+    {
+        origin[i] = tileIndex % tileCount[i] * tileSize[i];
+        extent[i] = std::min(tileSize[i], axis[i] - origin[i]);
+        tileIndex /= tileCount[i];
+    }
+
+    size_t rowCount = 1;
+    for(size_t i = 1; i < axisCount; ++i)
+        rowCount *= extent[i];
+
+    // Rows are contiguous in the tile and in the image.
+    for(size_t row = 0; row < rowCount; ++row)
+    {
+        size_t imageOffset = 0;
+        size_t imagePitch = 1;
+        size_t rowRest = row;
+        for(size_t i = 0; i < axisCount; ++i)
+        {
+            size_t coordinate = origin[i];
+            if(i > 0)
+            {
+                coordinate += rowRest % extent[i];
+                rowRest /= extent[i];
+            }
+
+            imageOffset += coordinate*imagePitch;
+            imagePitch *= axis[i];
+        }
+
+        function(imageOffset, row*extent[0], extent[0]);
+    }
+}
+
+size_t FitsCompressedImage::getTileElementCount(size_t tileIndex) const
+{
+    size_t result = 1;
+    for(size_t i = 0; i < axis.size(); ++i)
+    {
+        size_t origin = tileIndex % tileCount[i] * tileSize[i];
+        result *= std::min(tileSize[i], axis[i] - origin);
+        tileIndex /= tileCount[i];
+    }
+
+    return result;
+}
+
+char *FitsCompressedImage::decodeRegion(const SliceRange &x, const SliceRange &y, const SliceRange &z)
+{
+    if(!isSupported())
+        return nullptr;
+
+    std::unique_lock<std::mutex> l(decodeMutex);
+    if(!imageData)
+    {
+        size_t elementCount = 1;
+        for(auto axisSize : axis)
+            elementCount *= axisSize;
+        imageData.reset(new char[elementCount*elementSize]);
+    }
+
+    // Find the pending tiles that intersect the region.
+    size_t first[3] = {0, 0, 0};
+    size_t last[3] = {0, 0, 0};
+    const SliceRange *ranges[3] = {&x, &y, &z};
+    for(size_t i = 0; i < 3; ++i)
+    {
+        if(i >= axis.size())
+            continue;
+
+        if(!ranges[i]->isValid() || ranges[i]->size == 0)
+            return imageData.get();
+
+        first[i] = ranges[i]->start / tileSize[i];
+        last[i] = std::min(size_t(ranges[i]->start + ranges[i]->size - 1) / tileSize[i], tileCount[i] - 1);
+    }
+
+    // The z range continues into the planes of the higher axes.
+    size_t planeCount = 1;
+    size_t higherTiles = 1;
+    for(size_t i = 3; i < tileCount.size(); ++i)
+    {
+        planeCount *= axis[i];
+        higherTiles *= tileCount[i];
+    }
+
+    size_t firstPlane = 0;
+    size_t lastPlane = 0;
+    if(axis.size() > 2)
+    {
+        size_t depth = axis[2];
+        size_t zEnd = z.start + z.size - 1;
+        firstPlane = std::min(size_t(z.start) / depth, planeCount - 1);
+        lastPlane = std::min(zEnd / depth, planeCount - 1);
+        if(firstPlane == lastPlane)
+        {
+            first[2] = (z.start - firstPlane*depth) / tileSize[2];
+            last[2] = std::min((zEnd - firstPlane*depth) / tileSize[2], tileCount[2] - 1);
+        }
+        else
+        {
+            first[2] = 0;
+            last[2] = tileCount[2] - 1;
+        }
+    }
+
+    std::vector<bool> selectedHigherTiles(higherTiles);
+    for(size_t plane = firstPlane; plane <= lastPlane; ++plane)
+    {
+        size_t w = 0;
+        size_t wPitch = 1;
+        size_t coordinates = plane;
+        for(size_t i = 3; i < axis.size(); ++i)
+        {
+            w += coordinates % axis[i] / tileSize[i] * wPitch;
+            wPitch *= tileCount[i];
+            coordinates /= axis[i];
+        }
+        selectedHigherTiles[w] = true;
+    }
+
+    std::vector<size_t> pendingTiles;
+    size_t tilePitchY = tileCount[0];
+    size_t tilePitchZ = tilePitchY*(axis.size() > 1 ? tileCount[1] : 1);
+    size_t tilePitchW = tilePitchZ*(axis.size() > 2 ? tileCount[2] : 1);
+    for(size_t w = 0; w < higherTiles; ++w)
+    {
+        if(!selectedHigherTiles[w])
+            continue;
+
+        for(size_t tz = first[2]; tz <= last[2]; ++tz)
+        {
+            for(size_t ty = first[1]; ty <= last[1]; ++ty)
+            {
+                for(size_t tx = first[0]; tx <= last[0]; ++tx)
+                {
+                    auto tile = w*tilePitchW + tz*tilePitchZ + ty*tilePitchY + tx;
+                    if(!decodedTiles[tile])
+                        pendingTiles.push_back(tile);
+                }
+            }
+        }
+    }
+
+    decodeTiles(pendingTiles);
+    return imageData.get();
+}
+
+char *FitsCompressedImage::decodeAll()
+{
+    SliceRange x(0, int(axis.size() > 0 ? axis[0] : 0));
+    SliceRange y(0, int(axis.size() > 1 ? axis[1] : 1));
+    size_t sliceCount = 1;
+    for(size_t i = 2; i < axis.size(); ++i)
+        sliceCount *= axis[i];
+
+    SliceRange z(0, int(sliceCount));
+    return decodeRegion(x, y, z);
+}
+
+void FitsCompressedImage::decodeTiles(const std::vector<size_t> &tiles)
+{
+    // The tiles are independent of each other.
+    ThreadPool::getDefault().parallelFor(tiles.size(), [&](size_t i) {
+        decodeTile(tiles[i]);
+    });
+
+    for(auto tile : tiles)
+        decodedTiles[tile] = true;
+}
+
+void FitsCompressedImage::decodeTile(size_t tileIndex)
+{
+    auto row = tableData + tileIndex*rowSize;
+    auto tileElementCount = getTileElementCount(tileIndex);
+
+    const char *compressedData;
+    size_t compressedSize;
+    if(!readHeapArray(row, compressedDataColumn, &compressedData, &compressedSize) || compressedSize == 0)
+    {
+        // Tiles that cannot be quantized are stored losslessly.
+        std::unique_ptr<char[]> tileData(new char[tileElementCount*elementSize]);
+        if(readHeapArray(row, gzipCompressedDataColumn, &compressedData, &compressedSize) && compressedSize > 0)
+        {
+            if(gzipDecompress(compressedData, compressedSize, tileData.get(), tileElementCount*elementSize))
+                storeRawTile(tileIndex, tileData.get());
+            else
+                logError("Failed to decompress a FITS tile");
+        }
+        else if(readHeapArray(row, uncompressedDataColumn, &compressedData, &compressedSize) &&
+            compressedSize == tileElementCount*elementSize)
+        {
+            storeRawTile(tileIndex, compressedData);
+        }
+        else
+        {
+            logError("Missing data for a FITS tile");
+        }
+        return;
+    }
+
+    auto input = reinterpret_cast<const uint8_t*> (compressedData);
+    bool quantized = quantization != FitsQuantization::None;
+    if(compression == FitsCompression::Rice)
+    {
+        bool decoded = false;
+        std::vector<int32_t> values(tileElementCount);
+        if(riceBytesPerPixel == 1)
+            decoded = riceDecode<uint8_t, 3, 6> (input, compressedSize, &values[0], tileElementCount, riceBlockSize);
+        else if(riceBytesPerPixel == 2)
+            decoded = riceDecode<int16_t, 4, 14> (input, compressedSize, &values[0], tileElementCount, riceBlockSize);
+        else
+            decoded = riceDecode<int32_t, 5, 25> (input, compressedSize, &values[0], tileElementCount, riceBlockSize);
+
+        if(decoded)
+            storeIntegerTile(tileIndex, row, &values[0]);
+        else
+            logError("Failed to decompress a FITS tile");
+        return;
+    }
+
+    // Quantized values are gzipped as 32 bit integers.
+    auto valueSize = quantized ? sizeof(int32_t) : elementSize;
+    std::unique_ptr<char[]> tileData(new char[tileElementCount*valueSize]);
+    if(!gzipDecompress(compressedData, compressedSize, tileData.get(), tileElementCount*valueSize))
+    {
+        logError("Failed to decompress a FITS tile");
+        return;
+    }
+
+    if(compression == FitsCompression::ShuffledGzip)
+        unshuffleBytes(tileData.get(), tileElementCount, valueSize);
+
+    if(!quantized)
+    {
+        storeRawTile(tileIndex, tileData.get());
+        return;
+    }
+
+    std::vector<int32_t> values(tileElementCount);
+    for(size_t i = 0; i < tileElementCount; ++i)
+        values[i] = readBigEndian<int32_t> (tileData.get() + i*sizeof(int32_t));
+    storeIntegerTile(tileIndex, row, &values[0]);
+}
+
+bool FitsCompressedImage::readHeapArray(const char *row, const FitsTableColumn &column, const char **data, size_t *size)
+{
+    if(!column.isValid() || (column.type != 'P' && column.type != 'Q'))
+        return false;
+
+    // Read the array descriptor.
+    size_t count, offset;
+    if(column.type == 'P')
+    {
+        count = uint32_t(readBigEndian<int32_t> (row + column.offset));
+        offset = uint32_t(readBigEndian<int32_t> (row + column.offset + 4));
+    }
+    else
+    {
+        count = readBigEndian<int64_t> (row + column.offset);
+        offset = readBigEndian<int64_t> (row + column.offset + 8);
+    }
+
+    *size = count*std::max(size_t(1), tableTypeSize(column.arrayType));
+    *data = tableData + heapOffset + offset;
+    return heapOffset + offset + *size <= rowSize*rowCount + heapSize;
+}
+
+double FitsCompressedImage::readTableNumber(const char *row, const FitsTableColumn &column, double absentValue)
+{
+    auto field = row + column.offset;
+    switch(column.type)
+    {
+    case 'I':
+        return readBigEndian<int16_t> (field);
+    case 'J':
+        return readBigEndian<int32_t> (field);
+    case 'K':
+        return double(readBigEndian<int64_t> (field));
+    case 'E':
+        return readBigEndian<float> (field);
+    case 'D':
+        return readBigEndian<double> (field);
+    default:
+        return absentValue;
+    }
+}
+
+void FitsCompressedImage::storeRawTile(size_t tileIndex, const char *tileData)
+{
+    // The tile data is already in the FITS byte order.
+    auto image = imageData.get();
+    forEachTileRow(tileIndex, [&](size_t imageOffset, size_t tileOffset, size_t rowLength) {
+        memcpy(image + imageOffset*elementSize, tileData + tileOffset*elementSize, rowLength*elementSize);
+    });
+}
+
+template<typename T, typename Function>
+inline void storeTileValues(char *image, const Function &valueAt, size_t imageOffset, size_t tileOffset, size_t rowLength)
+{
+    auto dest = image + imageOffset*sizeof(T);
+    for(size_t i = 0; i < rowLength; ++i, dest += sizeof(T))
+        writeBigEndian<T> (dest, T(valueAt(tileOffset + i)));
+}
+
+void FitsCompressedImage::storeIntegerTile(size_t tileIndex, const char *row, const int32_t *values)
+{
+    auto image = imageData.get();
+    if(quantization == FitsQuantization::None)
+    {
+        auto valueAt = [&](size_t i) { return values[i]; };
+        forEachTileRow(tileIndex, [&](size_t imageOffset, size_t tileOffset, size_t rowLength) {
+            switch(format)
+            {
+            case FitsFormat::UInt8:
+                storeTileValues<uint8_t> (image, valueAt, imageOffset, tileOffset, rowLength);
+                break;
+            case FitsFormat::Int16:
+                storeTileValues<int16_t> (image, valueAt, imageOffset, tileOffset, rowLength);
+                break;
+            case FitsFormat::Int64:
+                storeTileValues<int64_t> (image, valueAt, imageOffset, tileOffset, rowLength);
+                break;
+            default:
+                storeTileValues<int32_t> (image, valueAt, imageOffset, tileOffset, rowLength);
+                break;
+            }
+        });
+        return;
+    }
+
+    // Undo the quantization, with the tile parameters when they are present.
+    double tileScale = scaleColumn.isValid() ? readTableNumber(row, scaleColumn, scale) : scale;
+    double tileZero = zeroColumn.isValid() ? readTableNumber(row, zeroColumn, zero) : zero;
+    bool tileHasBlank = hasBlank || blankColumn.isValid();
+    int64_t tileBlank = blankColumn.isValid() ? int64_t(readTableNumber(row, blankColumn, double(blank))) : blank;
+
+    auto tileElementCount = getTileElementCount(tileIndex);
+    std::vector<double> physicalValues(tileElementCount);
+    auto &randomValues = ditherRandomValues();
+    int randomSeed = int((tileIndex + ditherOffset - 1) % DitherRandomCount);
+    int nextRandom = int(randomValues[randomSeed]*500);
+    for(size_t i = 0; i < tileElementCount; ++i)
+    {
+        auto value = values[i];
+        if(tileHasBlank && value == tileBlank)
+            physicalValues[i] = std::numeric_limits<double>::quiet_NaN();
+        else if(quantization == FitsQuantization::NoDither)
+            physicalValues[i] = value*tileScale + tileZero;
+        else if(quantization == FitsQuantization::SubtractiveDither2 && value == DitherZeroValue)
+            physicalValues[i] = 0.0;
+        else
+            physicalValues[i] = (value - randomValues[nextRandom] + 0.5)*tileScale + tileZero;
+
+        if(quantization == FitsQuantization::NoDither)
+            continue;
+
+        if(++nextRandom == DitherRandomCount)
+        {
+            if(++randomSeed == DitherRandomCount)
+                randomSeed = 0;
+            nextRandom = int(randomValues[randomSeed]*500);
+        }
+    }
+
+    auto valueAt = [&](size_t i) { return physicalValues[i]; };
+    forEachTileRow(tileIndex, [&](size_t imageOffset, size_t tileOffset, size_t rowLength) {
+        if(format == FitsFormat::Double)
+            storeTileValues<double> (image, valueAt, imageOffset, tileOffset, rowLength);
+        else
+            storeTileValues<float> (image, valueAt, imageOffset, tileOffset, rowLength);
+    });
+}
+
+} // namespace SVR
@@ -1,29 +1,51 @@
+#include <sys/stat.h>
+#include <algorithm>
 #include <set>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "SVR/FitsFile.hpp"
+#include "SVR/FitsCompressedImage.hpp"
+#include "SVR/Endianness.hpp"
+#include "SVR/Logging.hpp"
+#include "SVR/ThreadPool.hpp"
 
 namespace SVR
 {
 
-inline bool isWhite(int c)
-{
-    return c <= ' ';
-}
+const size_t FitsBlockSize = 2880;
+const size_t FitsCardSize = 80;
+const size_t FitsCardsPerBlock = FitsBlockSize / FitsCardSize;
+const int HduIndexVersion = 3;
+const size_t PrefetchDistance = 64 << 20;
+const size_t StreamBlockSize = 8 << 20;
+const size_t MaxOpenSliceFiles = 64;
 
 inline size_t computeHeaderSize(size_t numberOfProperties)
 {
     return ((numberOfProperties + 1) * 80 + 2880) / 2880 * 2880;
 }
 
+inline bool haveSameScaling(const FitsHeaderKeywords &a, const FitsHeaderKeywords &b)
+{
+    return a.bscale == b.bscale && a.bzero == b.bzero && a.hasBlank == b.hasBlank && (!a.hasBlank || a.blank == b.blank);
+}
+
 FitsFile::FitsFile(MemoryMappedFile *memoryFile)
-    : memoryFile(memoryFile)
+    : memoryFile(memoryFile), headerOffset(0), dataOffset(0), imageData(nullptr),
+      format(FitsFormat::UInt8), nativeByteOrder(false), compressedImage(nullptr), streamed(false), selectedHdu(0), modificationTime(0),
+      readAhead(FitsReadAhead::Hints), regionReadOffset(0), regionReadSize(0), regionReadFirstSlice(0), regionReadSlicePitch(0),
+      sliceAccessMode(FitsAccessMode::Mapped)
 {
     position = memoryFile->getData();
 }
 
 FitsFile::~FitsFile()
 {
+    closeSliceFiles();
+    delete compressedImage;
+    headerWindow.unmap();
+    dataWindow.unmap();
     delete memoryFile;
 }
 
@@ -32,6 +54,16 @@ FitsFormat FitsFile::getFormat() const
     return format;
 }
 
+size_t FitsFile::getElementSize() const
+{
+    return abs(int(format)) / 8;
+}
+
+bool FitsFile::isNativeByteOrder() const
+{
+    return nativeByteOrder;
+}
+
 size_t FitsFile::getAxisCount() const
 {
     return axis.size();
@@ -65,57 +97,553 @@ size_t FitsFile::getDepth() const
     return getAxis(2);
 }
 
-const FitsHeaderProperties &FitsFile::getHeaderProperties() const
+size_t FitsFile::getPlaneCount() const
 {
-    return headerProperties;
+    size_t result = 1;
+    for(size_t i = 3; i < axis.size(); ++i)
+        result *= axis[i];
+    return result;
+}
+
+const FitsHeader &FitsFile::getHeader() const
+{
+    return header;
+}
+
+const FitsHeaderKeywords &FitsFile::getKeywords() const
+{
+    return header.getKeywords();
 }
 
 char *FitsFile::getImageData()
 {
+    if(isVirtual())
+        return nullptr;
+
+    if(compressedImage)
+        return compressedImage->decodeAll();
+
+    // Windowed files have to map the whole data.
+    if(memoryFile->isWindowed())
+        return memoryFile->mapWindow(dataWindow, dataOffset, getNumberOfElements()*getElementSize());
     return imageData;
 }
 
-FitsFile *FitsFile::open(const char *fileName, bool canWrite)
+void FitsFile::computeRegionElements(const SliceRange &x, const SliceRange &y, const SliceRange &z,
+    size_t &firstElement, size_t &lastElement) const
+{
+    size_t pitch = getWidth();
+    size_t slicePitch = pitch*getHeight();
+    firstElement = z.start*slicePitch + y.start*pitch + x.start;
+    lastElement = firstElement;
+    if(x.size > 0 && y.size > 0 && z.size > 0)
+        lastElement = (z.start + z.size - 1)*slicePitch + (y.start + y.size - 1)*pitch + x.start + x.size;
+}
+
+char *FitsFile::mapRegion(SliceRange x, SliceRange y, SliceRange z)
+{
+    if(isVirtual())
+        return nullptr;
+
+    size_t firstElement, lastElement;
+    computeRegionElements(x, y, z, firstElement, lastElement);
+
+    // Only the tiles of the region are decompressed.
+    auto elementSize = getElementSize();
+    if(compressedImage)
+    {
+        auto decodedData = compressedImage->decodeRegion(x, y, z);
+        return decodedData ? decodedData + firstElement*elementSize : nullptr;
+    }
+
+    return memoryFile->mapWindow(dataWindow, dataOffset + firstElement*elementSize, (lastElement - firstElement)*elementSize);
+}
+
+MemoryUsage FitsFile::getMemoryUsage()
+{
+    auto usage = memoryFile->getMemoryUsage();
+    for(auto slice : openSliceFiles)
+    {
+        auto sliceUsage = sliceFiles[slice]->memoryFile->getMemoryUsage();
+        usage.mappedSize += sliceUsage.mappedSize;
+        usage.residentSize += sliceUsage.residentSize;
+    }
+
+    return usage;
+}
+
+void FitsFile::adviseAccess(MemoryAccessHint hint)
+{
+    if(!compressedImage && !isVirtual())
+        memoryFile->adviseAccess(hint, dataOffset, getNumberOfElements()*getElementSize());
+}
+
+void FitsFile::setReadAhead(FitsReadAhead newReadAhead)
+{
+    readAhead = newReadAhead;
+    for(auto slice : openSliceFiles)
+        sliceFiles[slice]->setReadAhead(readAhead);
+}
+
+void FitsFile::beginRegionRead(SliceRange x, SliceRange y, SliceRange z)
+{
+    // Decompressed images are already in memory.
+    if(compressedImage || readAhead == FitsReadAhead::None)
+        return;
+
+    size_t firstElement, lastElement;
+    computeRegionElements(x, y, z, firstElement, lastElement);
+    regionReadSize = 0;
+    if(lastElement <= firstElement)
+        return;
+
+    auto elementSize = getElementSize();
+    size_t pitch = getWidth();
+    size_t slicePitch = pitch*getHeight();
+    regionReadOffset = dataOffset + firstElement*elementSize;
+    regionReadSize = (lastElement - firstElement)*elementSize;
+    regionReadFirstSlice = z.start;
+    regionReadSlicePitch = slicePitch*elementSize;
+
+    // Whole slices are read sequentially. Sub regions jump between the
+    // slices, so only the rows of each slice are requested.
+    bool prefetch = readAhead == FitsReadAhead::Prefetch;
+    bool wholeRows = x.start == 0 && size_t(x.size) == pitch;
+    bool wholeSlices = wholeRows && y.start == 0 && size_t(y.size) == getHeight();
+    if(wholeSlices || (wholeRows && z.size == 1))
+    {
+        memoryFile->adviseAccess(MemoryAccessHint::Sequential, regionReadOffset, regionReadSize);
+    }
+    else if(!prefetch)
+    {
+        auto rowsSize = ((y.size - 1)*pitch + x.size)*elementSize;
+        for(int slice = 0; slice < z.size; ++slice)
+            memoryFile->adviseAccess(MemoryAccessHint::WillNeed, regionReadOffset + slice*regionReadSlicePitch, rowsSize);
+    }
+
+    if(prefetch)
+        memoryFile->startPrefetch(regionReadOffset, regionReadSize, PrefetchDistance);
+}
+
+void FitsFile::advanceRegionRead(int slice)
+{
+    if(readAhead == FitsReadAhead::Prefetch && !compressedImage)
+        memoryFile->advancePrefetch(regionReadOffset + (slice - regionReadFirstSlice)*regionReadSlicePitch);
+}
+
+void FitsFile::endRegionRead()
+{
+    if(compressedImage || readAhead == FitsReadAhead::None)
+        return;
+
+    memoryFile->stopPrefetch();
+    if(regionReadSize > 0)
+        memoryFile->adviseAccess(MemoryAccessHint::Normal, regionReadOffset, regionReadSize);
+}
+
+bool FitsFile::isStreamed() const
+{
+    return streamed && !compressedImage;
+}
+
+bool FitsFile::isVirtual() const
+{
+    return !sliceFileNames.empty();
+}
+
+FitsFile *FitsFile::getSliceFile(size_t slice)
+{
+    if(sliceFiles[slice])
+        return sliceFiles[slice];
+
+    // Keep a bounded number of slice files open.
+    if(openSliceFiles.size() >= MaxOpenSliceFiles)
+    {
+        auto oldest = openSliceFiles.front();
+        openSliceFiles.pop_front();
+        delete sliceFiles[oldest];
+        sliceFiles[oldest] = nullptr;
+    }
+
+    auto sliceFile = FitsFile::open(sliceFileNames[slice].c_str(), false, sliceAccessMode);
+    if(!sliceFile)
+        return nullptr;
+
+    // The scaling of the first slice is applied to every slice, so the others must have the same one.
+    if(!sliceFile->selectHdu(selectedHdu) || sliceFile->getWidth() != getWidth() ||
+        sliceFile->getHeight() != getHeight() || sliceFile->getFormat() != format ||
+        !haveSameScaling(sliceFile->getKeywords(), getKeywords()))
+    {
+        logError("A slice file does not match the first slice of the cube");
+        delete sliceFile;
+        return nullptr;
+    }
+
+    sliceFile->setReadAhead(readAhead);
+    sliceFiles[slice] = sliceFile;
+    openSliceFiles.push_back(slice);
+    return sliceFile;
+}
+
+void FitsFile::closeSliceFiles()
 {
-    auto memoryFile = MemoryMappedFile::open(fileName, canWrite);
+    for(auto slice : openSliceFiles)
+    {
+        delete sliceFiles[slice];
+        sliceFiles[slice] = nullptr;
+    }
+    openSliceFiles.clear();
+}
+
+void FitsFile::readRowBlocks(SliceRange x, SliceRange y, SliceRange z, const RowBlockConsumer &consumer)
+{
+    if(x.size <= 0 || y.size <= 0 || z.size <= 0)
+        return;
+
+    auto elementSize = getElementSize();
+    size_t pitch = getWidth();
+    size_t slicePitch = pitch*getHeight();
+
+    // Each slice of a virtual cube is read from its own file.
+    if(isVirtual())
+    {
+        std::vector<char> missingRows;
+        for(int slice = z.start; slice < z.start + z.size; ++slice)
+        {
+            auto sliceFile = getSliceFile(slice);
+            if(!sliceFile)
+            {
+                missingRows.resize(((y.size - 1)*pitch + x.size)*elementSize);
+                consumer(missingRows.data(), slice, y.start, y.size);
+                continue;
+            }
+
+            sliceFile->readRowBlocks(x, y, SliceRange(0, 1), [&](const char *rows, int, int firstRow, int rowCount) {
+                consumer(rows, slice, firstRow, rowCount);
+            });
+        }
+        return;
+    }
+
+    // Mapped regions are passed as one block per slice.
+    if(!isStreamed())
+    {
+        auto regionData = mapRegion(x, y, z);
+        if(!regionData)
+            return;
+
+        beginRegionRead(x, y, z);
+        for(int slice = 0; slice < z.size; ++slice)
+        {
+            advanceRegionRead(z.start + slice);
+            consumer(regionData + slice*slicePitch*elementSize, z.start + slice, y.start, y.size);
+        }
+        endRegionRead();
+        return;
+    }
+
+    // Split the slices in blocks of whole rows.
+    struct RowBlock
+    {
+        int slice;
+        int firstRow;
+        int rowCount;
+    };
+
+    int rowsPerBlock = int(std::max(size_t(1), std::min(StreamBlockSize / (pitch*elementSize), size_t(y.size))));
+    std::vector<FileRange> ranges;
+    std::vector<RowBlock> blocks;
+    for(int slice = z.start; slice < z.start + z.size; ++slice)
+    {
+        for(int row = y.start; row < y.start + y.size; row += rowsPerBlock)
+        {
+            auto rowCount = std::min(rowsPerBlock, y.start + y.size - row);
+            auto firstElement = slice*slicePitch + row*pitch + x.start;
+            ranges.push_back(FileRange(dataOffset + firstElement*elementSize, ((rowCount - 1)*pitch + x.size)*elementSize));
+            blocks.push_back(RowBlock{slice, row, rowCount});
+        }
+    }
+
+    memoryFile->streamRanges(ranges, [&](size_t index, const char *data) {
+        auto &block = blocks[index];
+        consumer(data, block.slice, block.firstRow, block.rowCount);
+    });
+}
+
+void FitsFile::writeSlices(const SliceWriter &writer, ThreadPool *pool)
+{
+    auto data = getImageData();
+    auto sliceElements = std::max(size_t(1), getWidth()*getHeight());
+    auto sliceCount = getNumberOfElements() / sliceElements;
+    auto sliceSize = sliceElements*getElementSize();
+    if(!pool)
+        pool = &ThreadPool::getDefault();
+
+    // The slices are disjoint, so they do not need any synchronization.
+    pool->parallelFor(sliceCount, [&](size_t slice) {
+        writer(slice, data + slice*sliceSize);
+        memoryFile->flushInBackground(dataOffset + slice*sliceSize, sliceSize);
+    });
+}
+
+FitsFile *FitsFile::open(const char *fileName, bool canWrite, FitsAccessMode accessMode)
+{
+    // Streamed files only map the headers.
+    bool streamed = accessMode == FitsAccessMode::Streamed || accessMode == FitsAccessMode::StreamedDirect;
+    bool windowed = accessMode == FitsAccessMode::Windowed || streamed;
+    auto memoryFile = MemoryMappedFile::open(fileName, canWrite, windowed, accessMode == FitsAccessMode::StreamedDirect);
     if(!memoryFile)
         return nullptr;
 
+    // Use the persisted HDU index when it is available.
+    struct stat fileStatus;
     auto fits = new FitsFile(memoryFile);
-    fits->readHeader();
-    // If we do not have an axis, read the next header.
-    if(fits->getPropertyIfAbsent("NAXIS", "0") == "0")
+    fits->streamed = streamed;
+    if(stat(fileName, &fileStatus) == 0)
+        fits->modificationTime = uint64_t(fileStatus.st_mtime);
+    if(!loadHduIndex(hduIndexFileNameFor(fileName), memoryFile->getSize(), fits->modificationTime, fits->hduIndex))
+        fits->buildHduIndex();
+
+    // Select the first HDU with an image.
+    size_t imageHdu = 0;
+    for(size_t i = 0; i < fits->hduIndex.size(); ++i)
+    {
+        if(fits->hduIndex[i].isImage())
+        {
+            imageHdu = i;
+            break;
+        }
+    }
+
+    if(!fits->selectHdu(imageHdu))
     {
-        fits->headerProperties.clear();
-        fits->readHeader();
+        logError("Failed to read a FITS header data unit");
+        delete fits;
+        return nullptr;
     }
 
+    return fits;
+}
+
+FitsFile *FitsFile::openSlices(const std::vector<std::string> &sliceFileNames, FitsAccessMode accessMode)
+{
+    if(sliceFileNames.empty())
+        return nullptr;
+
+    // The header of the first slice describes the cube.
+    auto fits = open(sliceFileNames[0].c_str(), false, accessMode);
+    if(!fits)
+        return nullptr;
+
+    fits->sliceFileNames = sliceFileNames;
+    fits->sliceFiles.resize(sliceFileNames.size());
+    fits->sliceAccessMode = accessMode;
     fits->loadHeaderData();
     return fits;
 }
 
-FitsFile *FitsFile::create(const char *fileName, FitsHeaderProperties properties, size_t dataSize)
+size_t FitsFile::getHduCount() const
+{
+    return hduIndex.size();
+}
+
+const FitsHdu &FitsFile::getHdu(size_t index) const
+{
+    return hduIndex[index];
+}
+
+size_t FitsFile::getSelectedHdu() const
+{
+    return selectedHdu;
+}
+
+bool FitsFile::selectHdu(size_t index)
+{
+    if(index >= hduIndex.size())
+        return false;
+
+    // Jump directly into the header of the HDU.
+    closeSliceFiles();
+    axis.clear();
+    headerOffset = hduIndex[index].headerOffset;
+    if(!readHeader())
+        return false;
+
+    delete compressedImage;
+    compressedImage = nullptr;
+    if(hduIndex[index].compressed)
+    {
+        compressedImage = new FitsCompressedImage(memoryFile, dataOffset, header);
+        if(!compressedImage->isSupported())
+        {
+            logError("Unsupported tile compressed FITS image");
+            delete compressedImage;
+            compressedImage = nullptr;
+            return false;
+        }
+    }
+
+    loadHeaderData();
+    selectedHdu = index;
+    return true;
+}
+
+void FitsFile::buildHduIndex()
+{
+    // Visit all of the headers in a single sequential pass.
+    hduIndex.clear();
+    headerOffset = 0;
+    while(headerOffset + FitsBlockSize <= memoryFile->getSize())
+    {
+        if(!readHeader())
+            break;
+
+        auto &keywords = header.getKeywords();
+        FitsHdu hdu;
+        hdu.headerOffset = headerOffset;
+        hdu.dataOffset = dataOffset;
+        hdu.format = (FitsFormat)keywords.bitpix;
+        hdu.axis = keywords.axis;
+        hdu.extension = header.getString("XTENSION");
+
+        // Compute the data unit size.
+        if(!hdu.axis.empty())
+        {
+            size_t numberOfElements = 1;
+            for(auto axisValue : hdu.axis)
+                numberOfElements *= axisValue;
+
+            size_t groupCount = header.getInteger("GCOUNT", 1);
+            size_t parameterCount = header.getInteger("PCOUNT", 0);
+            hdu.dataSize = abs(keywords.bitpix) / 8 * groupCount * (parameterCount + numberOfElements);
+        }
+
+        // Tile compressed images are described by the Z keywords.
+        if(FitsCompressedImage::isCompressedImage(header))
+        {
+            char key[32];
+            hdu.compressed = true;
+            hdu.format = (FitsFormat)header.getInteger("ZBITPIX");
+            hdu.axis.resize(header.getInteger("ZNAXIS"));
+            for(size_t i = 0; i < hdu.axis.size(); ++i)
+            {
+                sprintf(key, "ZNAXIS%d", int(i + 1));
+                hdu.axis[i] = header.getInteger(key);
+            }
+        }
+
+        hduIndex.push_back(hdu);
+        headerOffset = dataOffset + (hdu.dataSize + FitsBlockSize - 1) / FitsBlockSize * FitsBlockSize;
+    }
+
+    header.clear();
+}
+
+std::string FitsFile::hduIndexFileNameFor(const std::string &fitsFileName)
+{
+    return fitsFileName + ".hduidx";
+}
+
+bool FitsFile::saveHduIndex(const std::string &fileName) const
+{
+    FILE *f = fopen(fileName.c_str(), "w");
+    if(!f)
+        return false;
+
+    fprintf(f, "SVRHDUINDEX %d %llu %llu %llu\n", HduIndexVersion,
+        (unsigned long long)memoryFile->getSize(), (unsigned long long)modificationTime, (unsigned long long)hduIndex.size());
+    for(auto &hdu : hduIndex)
+    {
+        fprintf(f, "%llu %llu %llu %d %s %d %d", (unsigned long long)hdu.headerOffset,
+            (unsigned long long)hdu.dataOffset, (unsigned long long)hdu.dataSize,
+            int(hdu.format), hdu.extension.empty() ? "-" : hdu.extension.c_str(),
+            int(hdu.compressed), int(hdu.axis.size()));
+        for(auto axisValue : hdu.axis)
+            fprintf(f, " %llu", (unsigned long long)axisValue);
+        fprintf(f, "\n");
+    }
+
+    fclose(f);
+    return true;
+}
+
+bool FitsFile::loadHduIndex(const std::string &fileName, size_t fitsFileSize, uint64_t fitsModificationTime, FitsHduIndex &index)
+{
+    FILE *f = fopen(fileName.c_str(), "r");
+    if(!f)
+        return false;
+
+    // Check the index is for this version of the file.
+    int version;
+    unsigned long long fileSize, fileModificationTime, hduCount;
+    if(fscanf(f, "SVRHDUINDEX %d %llu %llu %llu", &version, &fileSize, &fileModificationTime, &hduCount) != 4 ||
+        version != HduIndexVersion || fileSize != fitsFileSize || fileModificationTime != fitsModificationTime)
+    {
+        fclose(f);
+        return false;
+    }
+
+    index.clear();
+    index.reserve(hduCount);
+    for(unsigned long long i = 0; i < hduCount; ++i)
+    {
+        char extension[72];
+        unsigned long long headerOffset, dataOffset, dataSize;
+        int format, compressed, numberOfAxis;
+        if(fscanf(f, "%llu %llu %llu %d %71s %d %d", &headerOffset, &dataOffset, &dataSize,
+            &format, extension, &compressed, &numberOfAxis) != 7)
+            break;
+
+        FitsHdu hdu;
+        hdu.headerOffset = headerOffset;
+        hdu.dataOffset = dataOffset;
+        hdu.dataSize = dataSize;
+        hdu.format = (FitsFormat)format;
+        hdu.compressed = compressed != 0;
+        if(strcmp(extension, "-"))
+            hdu.extension = extension;
+
+        for(int j = 0; j < numberOfAxis; ++j)
+        {
+            unsigned long long axisValue;
+            if(fscanf(f, "%llu", &axisValue) != 1)
+                break;
+            hdu.axis.push_back(axisValue);
+        }
+
+        index.push_back(hdu);
+    }
+
+    fclose(f);
+    if(index.size() != hduCount)
+    {
+        index.clear();
+        return false;
+    }
+
+    return true;
+}
+
+FitsFile *FitsFile::create(const char *fileName, FitsHeaderProperties properties, size_t dataSize,
+    const MemoryMappedCreateOptions &options)
 {
     size_t headerSize = computeHeaderSize(properties.size());
 
-    auto memoryFile = MemoryMappedFile::create(fileName, headerSize + dataSize);
+    auto memoryFile = MemoryMappedFile::create(fileName, headerSize + dataSize, options);
     if(!memoryFile)
         return nullptr;
 
+    // Write the header, and read it back.
     auto fits = new FitsFile(memoryFile);
-    fits->headerProperties = properties;
+    fits->writeHeader(properties);
+    fits->readHeader();
     fits->loadHeaderData();
-    fits->writeHeader();
-    fits->imageData = memoryFile->getData() + headerSize;
     return fits;
 }
 
 std::string FitsFile::getPropertyIfAbsent(const std::string &name, const std::string &absentValue)
 {
-    auto it = headerProperties.find(name);
-    if(it == headerProperties.end())
-        return absentValue;
-    return it->second;
+    return header.getString(name.c_str(), absentValue);
 }
 
 void FitsFile::close()
@@ -123,54 +651,67 @@ void FitsFile::close()
     memoryFile->close();
 }
 
-void FitsFile::readHeader()
+bool FitsFile::readHeader()
 {
-    char *headerStart = position;
-    position = headerStart;
-
-    for(;;)
+    // Map the header one block at time, until the END card is found.
+    char *headerData = nullptr;
+    size_t headerSize = 0;
+    for(bool foundEnd = false; !foundEnd; )
     {
-        auto keyValue = readHeaderLine();
-        if(keyValue.first == "END")
-            break;
-        headerProperties.insert(keyValue);
+        if(headerOffset + headerSize + FitsBlockSize > memoryFile->getSize())
+        {
+            logError("Truncated FITS header");
+            return false;
+        }
+
+        headerSize += FitsBlockSize;
+        headerData = memoryFile->mapWindow(headerWindow, headerOffset, headerSize);
+        auto block = headerData + headerSize - FitsBlockSize;
+        for(size_t i = 0; i < FitsCardsPerBlock && !foundEnd; ++i)
+            foundEnd = FitsHeader::isEndCard(block + i*FitsCardSize);
     }
 
-    auto headerSize = position - headerStart;
-    auto remainingHeader = 2880 - (headerSize % 2880);
-    position += remainingHeader;
-    imageData = position;
+    // Every header data unit starts with SIMPLE or XTENSION.
+    if(memcmp(headerData, "SIMPLE  ", 8) && memcmp(headerData, "XTENSION", 8))
+        return false;
+
+    // The cards are parsed when the whole header is mapped.
+    header.parse(headerData, headerSize / FitsCardSize);
+    dataOffset = headerOffset + headerSize;
+    imageData = memoryFile->isWindowed() ? nullptr : memoryFile->getData() + dataOffset;
+    return true;
 }
 
-void FitsFile::writeHeader()
+void FitsFile::writeHeader(FitsHeaderProperties &properties)
 {
     char buffer[32];
     std::set<std::string> specialProperties;
 
     // Clean the header.
-    auto headerSize = computeHeaderSize(headerProperties.size());
+    auto headerSize = computeHeaderSize(properties.size());
     position = memoryFile->getData();
     memset(position, ' ', headerSize);
 
     // Write the special properties first.
     specialProperties.insert("SIMPLE");
-    writeHeaderLine("SIMPLE", headerProperties["SIMPLE"]);
+    writeHeaderLine("SIMPLE", properties["SIMPLE"]);
 
     specialProperties.insert("NAXIS");
-    writeHeaderLine("NAXIS", headerProperties["NAXIS"]);
+    writeHeaderLine("NAXIS", properties["NAXIS"]);
 
-    for(size_t i = 1; i <= axis.size(); ++i)
+    int numberOfAxis = atoi(properties["NAXIS"].c_str());
+    for(int i = 1; i <= numberOfAxis; ++i)
     {
-        sprintf(buffer, "NAXIS%d", int(i));
+        sprintf(buffer, "NAXIS%d", i);
         specialProperties.insert(buffer);
-        writeHeaderLine(buffer, headerProperties[buffer]);
+        writeHeaderLine(buffer, properties[buffer]);
     }
 
     specialProperties.insert("BITPIX");
-    writeHeaderLine("BITPIX", headerProperties["BITPIX"]);
+    writeHeaderLine("BITPIX", properties["BITPIX"]);
 
     // Write the normal properties.
-    for(auto &prop : headerProperties)
+    for(auto &prop : properties)
     {
         auto it = specialProperties.find(prop.first);
         if(it == specialProperties.end())
@@ -182,54 +723,40 @@ void FitsFile::writeHeader()
 
 void FitsFile::writeHeaderLine(const std::string &key, const std::string &value)
 {
+    // Cards are padded with spaces, without a null terminator.
+    char card[FitsCardSize + 1];
+    int cardSize;
     if(value.empty())
-        sprintf(position, "%-8s", key.c_str());
+        cardSize = snprintf(card, sizeof(card), "%-8s", key.c_str());
     else
-        sprintf(position, "%-8s= %s", key.c_str(), value.c_str());
-    position += 80;
-}
-
-std::pair<std::string, std::string> FitsFile::readHeaderLine()
-{
-    std::string key, value;
+        cardSize = snprintf(card, sizeof(card), "%-8s= %s", key.c_str(), value.c_str());
 
-    // Read the key
-    for(int i = 0; i < 8; ++i)
-    {
-        if(!isWhite(position[i]))
-            key.push_back(position[i]);
-    }
-
-    // Read the value.
-    if(position[8] == '=' && position[9] == ' ')
-    {
-        for(int i = 10; i < 80; ++i)
-        {
-            char c = position[i];
-            if(c == '/')
-                break;
-            if(!isWhite(c))
-                value.push_back(c);
-        }
-    }
-
-    position += 80;
-    return std::make_pair(key, value);
+    memcpy(position, card, std::min(size_t(cardSize), FitsCardSize));
+    position += FitsCardSize;
 }
 
 void FitsFile::loadHeaderData()
 {
-    char buffer[32];
-    size_t numberOfAxis = atoi(headerProperties["NAXIS"].c_str());
-    axis.reserve(numberOfAxis);
-
-    for(size_t i = 1; i <= numberOfAxis; ++i)
+    auto &keywords = header.getKeywords();
+    axis = keywords.axis;
+    format = (FitsFormat)keywords.bitpix;
+
+    // The BYTEORDR keyword is an extension used by the SVR cube cache.
+    auto byteOrder = header.getString("BYTEORDR", "BIG");
+    nativeByteOrder = byteOrder == (isHostLittleEndian() ? "LITTLE" : "BIG");
+    if(compressedImage)
     {
-        sprintf(buffer, "NAXIS%d", int(i));
-        axis.push_back(atoi(headerProperties[buffer].c_str()));
+        axis = compressedImage->getAxis();
+        format = compressedImage->getFormat();
+        nativeByteOrder = false;
     }
 
-    format = (FitsFormat)atoi(headerProperties["BITPIX"].c_str());
+    // The slices of a virtual cube are stacked along the third axis.
+    if(isVirtual())
+    {
+        axis.resize(2, 1);
+        axis.push_back(sliceFileNames.size());
+    }
 }
 
 
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "SVR/FitsHeader.hpp"
+
+namespace SVR
+{
+
+const size_t FitsKeySize = 8;
+const size_t FitsMaxValueSize = 72;
+
+inline bool isWhite(int c)
+{
+    return c <= ' ';
+}
+
+inline FitsHeaderString trim(const char *start, const char *end)
+{
+    while(start < end && isWhite(*start))
+        ++start;
+    while(end > start && isWhite(end[-1]))
+        --end;
+    return FitsHeaderString(start, end - start);
+}
+
+inline FitsHeaderString trimEnd(const char *start, const char *end)
+{
+    while(end > start && end[-1] == ' ')
+        --end;
+    return FitsHeaderString(start, end - start);
+}
+
+inline bool copyValue(const FitsHeaderCard *card, char *buffer)
+{
+    if(!card || card->value.empty())
+        return false;
+
+    auto size = std::min(card->value.size, FitsMaxValueSize - 1);
+    memcpy(buffer, card->value.data, size);
+    buffer[size] = 0;
+    return true;
+}
+
+bool FitsHeader::isEndCard(const char *card)
+{
+    if(memcmp(card, "END", 3))
+        return false;
+
+    for(size_t i = 3; i < FitsKeySize; ++i)
+    {
+        if(card[i] != ' ')
+            return false;
+    }
+
+    return true;
+}
+
+void FitsHeader::clear()
+{
+    cards.clear();
+    keywords = FitsHeaderKeywords();
+}
+
+void FitsHeader::parse(const char *data, size_t cardCount)
+{
+    cards.clear();
+    cards.reserve(cardCount);
+    for(size_t i = 0; i < cardCount; ++i)
+    {
+        auto card = data + i*CardSize;
+        if(isEndCard(card))
+            break;
+
+        auto parsedCard = parseCard(card);
+        if(!parsedCard.key.empty())
+            cards.push_back(parsedCard);
+    }
+
+    // Keep the first card of repeated keys in front.
+    std::stable_sort(cards.begin(), cards.end(), [](const FitsHeaderCard &a, const FitsHeaderCard &b) {
+        return a.key < b.key;
+    });
+
+    decodeKeywords();
+}
+
+FitsHeaderCard FitsHeader::parseCard(const char *card)
+{
+    FitsHeaderCard result;
+    auto cardEnd = card + CardSize;
+    const char *valueStart = nullptr;
+
+    // Read the key. Long keys use the HIERARCH convention.
+    if(!memcmp(card, "HIERARCH ", 9))
+    {
+        auto equals = (const char*)memchr(card + 9, '=', CardSize - 9);
+        if(!equals)
+        {
+            result.key = trim(card, card + FitsKeySize);
+            return result;
+        }
+
+        result.key = trim(card + 9, equals);
+        valueStart = equals + 1;
+    }
+    else
+    {
+        result.key = trim(card, card + FitsKeySize);
+        if(card[8] == '=' && card[9] == ' ')
+            valueStart = card + 10;
+    }
+
+    if(!valueStart)
+        return result;
+
+    while(valueStart < cardEnd && isWhite(*valueStart))
+        ++valueStart;
+
+    // Read a string value. Two consecutive quotes are an escaped quote.
+    if(valueStart < cardEnd && *valueStart == '\'')
+    {
+        auto stringStart = valueStart + 1;
+        auto stringEnd = stringStart;
+        for(; stringEnd < cardEnd; ++stringEnd)
+        {
+            if(*stringEnd != '\'')
+                continue;
+            if(stringEnd + 1 < cardEnd && stringEnd[1] == '\'')
+                ++stringEnd;
+            else
+                break;
+        }
+
+        result.value = trimEnd(stringStart, stringEnd);
+        return result;
+    }
+
+    // Read the value up to the comment.
+    auto valueEnd = (const char*)memchr(valueStart, '/', cardEnd - valueStart);
+    result.value = trim(valueStart, valueEnd ? valueEnd : cardEnd);
+    return result;
+}
+
+size_t FitsHeader::size() const
+{
+    return cards.size();
+}
+
+FitsHeader::const_iterator FitsHeader::begin() const
+{
+    return cards.begin();
+}
+
+FitsHeader::const_iterator FitsHeader::end() const
+{
+    return cards.end();
+}
+
+const FitsHeaderCard *FitsHeader::find(const char *key) const
+{
+    auto keySize = strlen(key);
+    auto it = std::lower_bound(cards.begin(), cards.end(), key, [&](const FitsHeaderCard &card, const char *key) {
+        return card.key.compare(key, keySize) < 0;
+    });
+
+    if(it == cards.end() || it->key.compare(key, keySize) != 0)
+        return nullptr;
+    return &*it;
+}
+
+bool FitsHeader::contains(const char *key) const
+{
+    return find(key) != nullptr;
+}
+
+std::string FitsHeader::getString(const char *key, const std::string &absentValue) const
+{
+    auto card = find(key);
+    if(!card)
+        return absentValue;
+    return card->value.str();
+}
+
+int64_t FitsHeader::getInteger(const char *key, int64_t absentValue) const
+{
+    char buffer[FitsMaxValueSize];
+    if(!copyValue(find(key), buffer))
+        return absentValue;
+    return strtoll(buffer, nullptr, 10);
+}
+
+double FitsHeader::getDouble(const char *key, double absentValue) const
+{
+    char buffer[FitsMaxValueSize];
+    if(!copyValue(find(key), buffer))
+        return absentValue;
+
+    // Fortran double precision exponents.
+    for(auto c = buffer; *c; ++c)
+    {
+        if(*c == 'D' || *c == 'd')
+            *c = 'E';
+    }
+
+    return strtod(buffer, nullptr);
+}
+
+const FitsHeaderKeywords &FitsHeader::getKeywords() const
+{
+    return keywords;
+}
+
+void FitsHeader::decodeKeywords()
+{
+    char buffer[32];
+
+    keywords = FitsHeaderKeywords();
+    keywords.bitpix = getInteger("BITPIX");
+
+    // Axis and world coordinates.
+    auto numberOfAxis = getInteger("NAXIS");
+    for(int i = 1; i <= numberOfAxis; ++i)
+    {
+        sprintf(buffer, "NAXIS%d", i);
+        keywords.axis.push_back(getInteger(buffer));
+
+        sprintf(buffer, "CRPIX%d", i);
+        keywords.referencePixel.push_back(getDouble(buffer, 0.0));
+
+        sprintf(buffer, "CRVAL%d", i);
+        keywords.referenceValue.push_back(getDouble(buffer, 0.0));
+
+        sprintf(buffer, "CDELT%d", i);
+        keywords.pixelDelta.push_back(getDouble(buffer, 1.0));
+    }
+
+    // Physical value scaling.
+    keywords.bscale = getDouble("BSCALE", 1.0);
+    keywords.bzero = getDouble("BZERO", 0.0);
+    keywords.hasBlank = contains("BLANK");
+    keywords.blank = getInteger("BLANK");
+}
+
+} // namespace SVR
@@ -49,6 +49,8 @@ inline GLenum mapInternalFormat(PixelFormat pixelFormat)
         return GL_LUMINANCE8;
     case PixelFormat::L16:
         return GL_LUMINANCE16;
+    case PixelFormat::R16:
+        return GL_R16;
 
     case PixelFormat::I8:
         return GL_INTENSITY8;
@@ -91,6 +93,7 @@ inline GLenum mapFormat(PixelFormat pixelFormat)
     case PixelFormat::RGBA8:
         return GL_RGBA;
 
+    case PixelFormat::R16:
     case PixelFormat::R32F:
         return GL_R;
     case PixelFormat::RG32F:
@@ -115,6 +118,7 @@ inline GLenum mapType(PixelFormat pixelFormat)
         return GL_UNSIGNED_BYTE;
 
     case PixelFormat::L16:
+    case PixelFormat::R16:
         return GL_UNSIGNED_SHORT;
 
     case PixelFormat::R32F:
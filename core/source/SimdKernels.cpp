@@ -0,0 +1,527 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "SVR/SimdKernels.hpp"
+#include "SVR/Endianness.hpp"
+#include "SVR/Logging.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SVR_SIMD_X86 1
+#include <immintrin.h>
+#define SVR_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace SVR
+{
+
+// The vector kernels process blocks of a fixed width. The remaining elements
+// are copied into a padded block, so they get the same operations.
+#define SVR_DEFINE_CONVERSION_LOOP(isa, name, SourceType, width, block) \
+    SVR_TARGET(isa) static void name(const SourceType *source, float *dest, size_t count, const PhysicalConversion &conversion) \
+    { \
+        size_t i = 0; \
+        for(; i + width <= count; i += width) \
+            block(source + i, dest + i, conversion); \
+        if(i < count) \
+        { \
+            SourceType sourceTail[width] = {}; \
+            float destTail[width]; \
+            memcpy(sourceTail, source + i, (count - i)*sizeof(SourceType)); \
+            block(sourceTail, destTail, conversion); \
+            memcpy(dest + i, destTail, (count - i)*sizeof(float)); \
+        } \
+    }
+
+#define SVR_DEFINE_SCALE_LOOP(isa, name, DestType, width, block) \
+    SVR_TARGET(isa) static void name(const float *values, size_t count, float scale, DestType *dest) \
+    { \
+        size_t i = 0; \
+        for(; i + width <= count; i += width) \
+            block(values + i, scale, dest + i); \
+        if(i < count) \
+        { \
+            float valuesTail[width] = {}; \
+            DestType destTail[width]; \
+            memcpy(valuesTail, values + i, (count - i)*sizeof(float)); \
+            block(valuesTail, scale, destTail); \
+            memcpy(dest + i, destTail, (count - i)*sizeof(DestType)); \
+        } \
+    }
+
+// Scalar kernels. Multiplications and additions are kept separate, as in the
+// vector kernels, so there is no fused rounding.
+inline float physicalValue(float raw, const PhysicalConversion &conversion)
+{
+    if(!conversion.scaled)
+        return raw;
+    float product = raw*conversion.scale;
+    return product + conversion.zero;
+}
+
+static void convertUInt8Scalar(const uint8_t *source, float *dest, size_t count, const PhysicalConversion &conversion)
+{
+    auto blank = uint8_t(conversion.blank);
+    for(size_t i = 0; i < count; ++i)
+        dest[i] = conversion.hasBlank && source[i] == blank ? NAN : physicalValue(source[i], conversion);
+}
+
+static void convertInt16Scalar(const int16_t *source, float *dest, size_t count, const PhysicalConversion &conversion)
+{
+    auto blank = int16_t(conversion.blank);
+    for(size_t i = 0; i < count; ++i)
+    {
+        auto raw = conversion.bigEndian ? swapBytes<int16_t> (source[i]) : source[i];
+        dest[i] = conversion.hasBlank && raw == blank ? NAN : physicalValue(raw, conversion);
+    }
+}
+
+static void convertFloatScalar(const float *source, float *dest, size_t count, const PhysicalConversion &conversion)
+{
+    for(size_t i = 0; i < count; ++i)
+        dest[i] = physicalValue(conversion.bigEndian ? swapBytes<float> (source[i]) : source[i], conversion);
+}
+
+inline void mergeRange(float blockMin, float blockMax, float &minValue, float &maxValue)
+{
+    // An empty block has an inverted range.
+    if(!(blockMin <= blockMax))
+        return;
+    if(isnan(minValue) || blockMin < minValue)
+        minValue = blockMin;
+    if(isnan(maxValue) || blockMax > maxValue)
+        maxValue = blockMax;
+}
+
+inline void mergeLanes(const float *lanesMin, const float *lanesMax, size_t laneCount, float &minValue, float &maxValue)
+{
+    float blockMin = INFINITY;
+    float blockMax = -INFINITY;
+    for(size_t i = 0; i < laneCount; ++i)
+    {
+        blockMin = lanesMin[i] < blockMin ? lanesMin[i] : blockMin;
+        blockMax = lanesMax[i] > blockMax ? lanesMax[i] : blockMax;
+    }
+
+    mergeRange(blockMin, blockMax, minValue, maxValue);
+}
+
+static void computeRangeScalar(const float *values, size_t count, float &minValue, float &maxValue)
+{
+    float blockMin = INFINITY;
+    float blockMax = -INFINITY;
+    for(size_t i = 0; i < count; ++i)
+    {
+        auto value = values[i];
+        blockMin = value < blockMin ? value : blockMin;
+        blockMax = value > blockMax ? value : blockMax;
+    }
+
+    mergeRange(blockMin, blockMax, minValue, maxValue);
+}
+
+inline float saturate(float value, float maxValue)
+{
+    // NaN fails both comparisons, and becomes zero.
+    value = value > 0.0f ? value : 0.0f;
+    return value < maxValue ? value : maxValue;
+}
+
+static void scaleToUInt8Scalar(const float *values, size_t count, float scale, uint8_t *dest)
+{
+    for(size_t i = 0; i < count; ++i)
+        dest[i] = uint8_t(int32_t(saturate(values[i]*scale, 255.0f)));
+}
+
+static void scaleToUInt16Scalar(const float *values, size_t count, float scale, uint16_t *dest)
+{
+    for(size_t i = 0; i < count; ++i)
+        dest[i] = uint16_t(int32_t(saturate(values[i]*scale, 65535.0f)));
+}
+
+static const SimdKernels scalarKernels = {
+    SimdLevel::Scalar, "scalar",
+    convertUInt8Scalar, convertInt16Scalar, convertFloatScalar,
+    computeRangeScalar,
+    scaleToUInt8Scalar, scaleToUInt16Scalar
+};
+
+#ifdef SVR_SIMD_X86
+
+/**
+ * SSE4.1 kernels, with blocks of 4 elements.
+ */
+SVR_TARGET("sse4.1")
+inline __m128 finishConversionSSE41(__m128i raw, int32_t blank, const PhysicalConversion &conversion)
+{
+    auto value = _mm_cvtepi32_ps(raw);
+    if(conversion.scaled)
+        value = _mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(conversion.scale)), _mm_set1_ps(conversion.zero));
+    if(conversion.hasBlank)
+        value = _mm_blendv_ps(value, _mm_set1_ps(NAN), _mm_castsi128_ps(_mm_cmpeq_epi32(raw, _mm_set1_epi32(blank))));
+    return value;
+}
+
+SVR_TARGET("sse4.1")
+inline void convertUInt8BlockSSE41(const uint8_t *source, float *dest, const PhysicalConversion &conversion)
+{
+    int32_t bytes;
+    memcpy(&bytes, source, 4);
+    auto raw = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+    _mm_storeu_ps(dest, finishConversionSSE41(raw, uint8_t(conversion.blank), conversion));
+}
+
+SVR_TARGET("sse4.1")
+inline void convertInt16BlockSSE41(const int16_t *source, float *dest, const PhysicalConversion &conversion)
+{
+    auto raw = _mm_loadl_epi64(reinterpret_cast<const __m128i*> (source));
+    if(conversion.bigEndian)
+        raw = _mm_shuffle_epi8(raw, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+    _mm_storeu_ps(dest, finishConversionSSE41(_mm_cvtepi16_epi32(raw), int16_t(conversion.blank), conversion));
+}
+
+SVR_TARGET("sse4.1")
+inline void convertFloatBlockSSE41(const float *source, float *dest, const PhysicalConversion &conversion)
+{
+    auto raw = _mm_loadu_si128(reinterpret_cast<const __m128i*> (source));
+    if(conversion.bigEndian)
+        raw = _mm_shuffle_epi8(raw, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+    auto value = _mm_castsi128_ps(raw);
+    if(conversion.scaled)
+        value = _mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(conversion.scale)), _mm_set1_ps(conversion.zero));
+    _mm_storeu_ps(dest, value);
+}
+
+SVR_DEFINE_CONVERSION_LOOP("sse4.1", convertUInt8SSE41, uint8_t, 4, convertUInt8BlockSSE41)
+SVR_DEFINE_CONVERSION_LOOP("sse4.1", convertInt16SSE41, int16_t, 4, convertInt16BlockSSE41)
+SVR_DEFINE_CONVERSION_LOOP("sse4.1", convertFloatSSE41, float, 4, convertFloatBlockSSE41)
+
+SVR_TARGET("sse4.1")
+static void computeRangeSSE41(const float *values, size_t count, float &minValue, float &maxValue)
+{
+    // The NaN operands are not selected by min and max.
+    auto blockMin = _mm_set1_ps(INFINITY);
+    auto blockMax = _mm_set1_ps(-INFINITY);
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        auto value = _mm_loadu_ps(values + i);
+        blockMin = _mm_min_ps(value, blockMin);
+        blockMax = _mm_max_ps(value, blockMax);
+    }
+
+    float lanesMin[4], lanesMax[4];
+    _mm_storeu_ps(lanesMin, blockMin);
+    _mm_storeu_ps(lanesMax, blockMax);
+    mergeLanes(lanesMin, lanesMax, 4, minValue, maxValue);
+    computeRangeScalar(values + i, count - i, minValue, maxValue);
+}
+
+SVR_TARGET("sse4.1")
+inline __m128i saturatedSSE41(const float *values, float scale, float maxValue)
+{
+    auto value = _mm_mul_ps(_mm_loadu_ps(values), _mm_set1_ps(scale));
+    value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(maxValue));
+    return _mm_cvttps_epi32(value);
+}
+
+SVR_TARGET("sse4.1")
+inline void scaleToUInt8BlockSSE41(const float *values, float scale, uint8_t *dest)
+{
+    auto words = _mm_packs_epi32(saturatedSSE41(values, scale, 255.0f), _mm_setzero_si128());
+    auto bytes = _mm_packus_epi16(words, words);
+    int32_t packed = _mm_cvtsi128_si32(bytes);
+    memcpy(dest, &packed, 4);
+}
+
+SVR_TARGET("sse4.1")
+inline void scaleToUInt16BlockSSE41(const float *values, float scale, uint16_t *dest)
+{
+    auto words = _mm_packus_epi32(saturatedSSE41(values, scale, 65535.0f), _mm_setzero_si128());
+    _mm_storel_epi64(reinterpret_cast<__m128i*> (dest), words);
+}
+
+SVR_DEFINE_SCALE_LOOP("sse4.1", scaleToUInt8SSE41, uint8_t, 4, scaleToUInt8BlockSSE41)
+SVR_DEFINE_SCALE_LOOP("sse4.1", scaleToUInt16SSE41, uint16_t, 4, scaleToUInt16BlockSSE41)
+
+static const SimdKernels sse41Kernels = {
+    SimdLevel::SSE41, "sse4.1",
+    convertUInt8SSE41, convertInt16SSE41, convertFloatSSE41,
+    computeRangeSSE41,
+    scaleToUInt8SSE41, scaleToUInt16SSE41
+};
+
+/**
+ * AVX2 kernels, with blocks of 8 elements.
+ */
+SVR_TARGET("avx2")
+inline __m256 finishConversionAVX2(__m256i raw, int32_t blank, const PhysicalConversion &conversion)
+{
+    auto value = _mm256_cvtepi32_ps(raw);
+    if(conversion.scaled)
+        value = _mm256_add_ps(_mm256_mul_ps(value, _mm256_set1_ps(conversion.scale)), _mm256_set1_ps(conversion.zero));
+    if(conversion.hasBlank)
+        value = _mm256_blendv_ps(value, _mm256_set1_ps(NAN), _mm256_castsi256_ps(_mm256_cmpeq_epi32(raw, _mm256_set1_epi32(blank))));
+    return value;
+}
+
+SVR_TARGET("avx2")
+inline void convertUInt8BlockAVX2(const uint8_t *source, float *dest, const PhysicalConversion &conversion)
+{
+    auto raw = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*> (source)));
+    _mm256_storeu_ps(dest, finishConversionAVX2(raw, uint8_t(conversion.blank), conversion));
+}
+
+SVR_TARGET("avx2")
+inline void convertInt16BlockAVX2(const int16_t *source, float *dest, const PhysicalConversion &conversion)
+{
+    auto raw = _mm_loadu_si128(reinterpret_cast<const __m128i*> (source));
+    if(conversion.bigEndian)
+        raw = _mm_shuffle_epi8(raw, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+    _mm256_storeu_ps(dest, finishConversionAVX2(_mm256_cvtepi16_epi32(raw), int16_t(conversion.blank), conversion));
+}
+
+SVR_TARGET("avx2")
+inline void convertFloatBlockAVX2(const float *source, float *dest, const PhysicalConversion &conversion)
+{
+    auto raw = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (source));
+    if(conversion.bigEndian)
+        raw = _mm256_shuffle_epi8(raw, _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+    auto value = _mm256_castsi256_ps(raw);
+    if(conversion.scaled)
+        value = _mm256_add_ps(_mm256_mul_ps(value, _mm256_set1_ps(conversion.scale)), _mm256_set1_ps(conversion.zero));
+    _mm256_storeu_ps(dest, value);
+}
+
+SVR_DEFINE_CONVERSION_LOOP("avx2", convertUInt8AVX2, uint8_t, 8, convertUInt8BlockAVX2)
+SVR_DEFINE_CONVERSION_LOOP("avx2", convertInt16AVX2, int16_t, 8, convertInt16BlockAVX2)
+SVR_DEFINE_CONVERSION_LOOP("avx2", convertFloatAVX2, float, 8, convertFloatBlockAVX2)
+
+SVR_TARGET("avx2")
+static void computeRangeAVX2(const float *values, size_t count, float &minValue, float &maxValue)
+{
+    auto blockMin = _mm256_set1_ps(INFINITY);
+    auto blockMax = _mm256_set1_ps(-INFINITY);
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        auto value = _mm256_loadu_ps(values + i);
+        blockMin = _mm256_min_ps(value, blockMin);
+        blockMax = _mm256_max_ps(value, blockMax);
+    }
+
+    float lanesMin[8], lanesMax[8];
+    _mm256_storeu_ps(lanesMin, blockMin);
+    _mm256_storeu_ps(lanesMax, blockMax);
+    mergeLanes(lanesMin, lanesMax, 8, minValue, maxValue);
+    computeRangeScalar(values + i, count - i, minValue, maxValue);
+}
+
+SVR_TARGET("avx2")
+inline __m256i saturatedAVX2(const float *values, float scale, float maxValue)
+{
+    auto value = _mm256_mul_ps(_mm256_loadu_ps(values), _mm256_set1_ps(scale));
+    value = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), _mm256_set1_ps(maxValue));
+    return _mm256_cvttps_epi32(value);
+}
+
+SVR_TARGET("avx2")
+inline void scaleToUInt8BlockAVX2(const float *values, float scale, uint8_t *dest)
+{
+    auto integers = saturatedAVX2(values, scale, 255.0f);
+    auto words = _mm_packs_epi32(_mm256_castsi256_si128(integers), _mm256_extracti128_si256(integers, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*> (dest), _mm_packus_epi16(words, words));
+}
+
+SVR_TARGET("avx2")
+inline void scaleToUInt16BlockAVX2(const float *values, float scale, uint16_t *dest)
+{
+    auto integers = saturatedAVX2(values, scale, 65535.0f);
+    auto words = _mm_packus_epi32(_mm256_castsi256_si128(integers), _mm256_extracti128_si256(integers, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*> (dest), words);
+}
+
+SVR_DEFINE_SCALE_LOOP("avx2", scaleToUInt8AVX2, uint8_t, 8, scaleToUInt8BlockAVX2)
+SVR_DEFINE_SCALE_LOOP("avx2", scaleToUInt16AVX2, uint16_t, 8, scaleToUInt16BlockAVX2)
+
+static const SimdKernels avx2Kernels = {
+    SimdLevel::AVX2, "avx2",
+    convertUInt8AVX2, convertInt16AVX2, convertFloatAVX2,
+    computeRangeAVX2,
+    scaleToUInt8AVX2, scaleToUInt16AVX2
+};
+
+/**
+ * AVX-512 kernels, with blocks of 16 elements.
+ */
+#define SVR_AVX512 "avx512f,avx512bw"
+
+// The undefined operands of the AVX-512 intrinsics are reported by some GCC versions.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+SVR_TARGET(SVR_AVX512)
+inline __m512 scaledAVX512(__m512 value, const PhysicalConversion &conversion)
+{
+    // Rounded multiplication, so it is not contracted with the addition.
+    auto product = _mm512_mul_round_ps(value, _mm512_set1_ps(conversion.scale), _MM_FROUND_CUR_DIRECTION);
+    return _mm512_add_round_ps(product, _mm512_set1_ps(conversion.zero), _MM_FROUND_CUR_DIRECTION);
+}
+
+SVR_TARGET(SVR_AVX512)
+inline __m512 finishConversionAVX512(__m512i raw, int32_t blank, const PhysicalConversion &conversion)
+{
+    auto value = _mm512_cvtepi32_ps(raw);
+    if(conversion.scaled)
+        value = scaledAVX512(value, conversion);
+    if(conversion.hasBlank)
+        value = _mm512_mask_blend_ps(_mm512_cmpeq_epi32_mask(raw, _mm512_set1_epi32(blank)), value, _mm512_set1_ps(NAN));
+    return value;
+}
+
+SVR_TARGET(SVR_AVX512)
+inline void convertUInt8BlockAVX512(const uint8_t *source, float *dest, const PhysicalConversion &conversion)
+{
+    auto raw = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*> (source)));
+    _mm512_storeu_ps(dest, finishConversionAVX512(raw, uint8_t(conversion.blank), conversion));
+}
+
+SVR_TARGET(SVR_AVX512)
+inline void convertInt16BlockAVX512(const int16_t *source, float *dest, const PhysicalConversion &conversion)
+{
+    auto raw = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (source));
+    if(conversion.bigEndian)
+        raw = _mm256_shuffle_epi8(raw, _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+    _mm512_storeu_ps(dest, finishConversionAVX512(_mm512_cvtepi16_epi32(raw), int16_t(conversion.blank), conversion));
+}
+
+SVR_TARGET(SVR_AVX512)
+inline void convertFloatBlockAVX512(const float *source, float *dest, const PhysicalConversion &conversion)
+{
+    auto raw = _mm512_loadu_si512(source);
+    if(conversion.bigEndian)
+        raw = _mm512_shuffle_epi8(raw, _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203));
+    auto value = _mm512_castsi512_ps(raw);
+    if(conversion.scaled)
+        value = scaledAVX512(value, conversion);
+    _mm512_storeu_ps(dest, value);
+}
+
+SVR_DEFINE_CONVERSION_LOOP(SVR_AVX512, convertUInt8AVX512, uint8_t, 16, convertUInt8BlockAVX512)
+SVR_DEFINE_CONVERSION_LOOP(SVR_AVX512, convertInt16AVX512, int16_t, 16, convertInt16BlockAVX512)
+SVR_DEFINE_CONVERSION_LOOP(SVR_AVX512, convertFloatAVX512, float, 16, convertFloatBlockAVX512)
+
+SVR_TARGET(SVR_AVX512)
+static void computeRangeAVX512(const float *values, size_t count, float &minValue, float &maxValue)
+{
+    auto blockMin = _mm512_set1_ps(INFINITY);
+    auto blockMax = _mm512_set1_ps(-INFINITY);
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        auto value = _mm512_loadu_ps(values + i);
+        blockMin = _mm512_min_ps(value, blockMin);
+        blockMax = _mm512_max_ps(value, blockMax);
+    }
+
+    float lanesMin[16], lanesMax[16];
+    _mm512_storeu_ps(lanesMin, blockMin);
+    _mm512_storeu_ps(lanesMax, blockMax);
+    mergeLanes(lanesMin, lanesMax, 16, minValue, maxValue);
+    computeRangeScalar(values + i, count - i, minValue, maxValue);
+}
+
+SVR_TARGET(SVR_AVX512)
+inline __m512i saturatedAVX512(const float *values, float scale, float maxValue)
+{
+    auto value = _mm512_mul_ps(_mm512_loadu_ps(values), _mm512_set1_ps(scale));
+    value = _mm512_min_ps(_mm512_max_ps(value, _mm512_setzero_ps()), _mm512_set1_ps(maxValue));
+    return _mm512_cvttps_epi32(value);
+}
+
+SVR_TARGET(SVR_AVX512)
+inline void scaleToUInt8BlockAVX512(const float *values, float scale, uint8_t *dest)
+{
+    auto bytes = _mm512_cvtepi32_epi8(saturatedAVX512(values, scale, 255.0f));
+    _mm_storeu_si128(reinterpret_cast<__m128i*> (dest), bytes);
+}
+
+SVR_TARGET(SVR_AVX512)
+inline void scaleToUInt16BlockAVX512(const float *values, float scale, uint16_t *dest)
+{
+    auto words = _mm512_cvtepi32_epi16(saturatedAVX512(values, scale, 65535.0f));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*> (dest), words);
+}
+
+SVR_DEFINE_SCALE_LOOP(SVR_AVX512, scaleToUInt8AVX512, uint8_t, 16, scaleToUInt8BlockAVX512)
+SVR_DEFINE_SCALE_LOOP(SVR_AVX512, scaleToUInt16AVX512, uint16_t, 16, scaleToUInt16BlockAVX512)
+
+static const SimdKernels avx512Kernels = {
+    SimdLevel::AVX512, "avx512",
+    convertUInt8AVX512, convertInt16AVX512, convertFloatAVX512,
+    computeRangeAVX512,
+    scaleToUInt8AVX512, scaleToUInt16AVX512
+};
+
+#pragma GCC diagnostic pop
+
+#endif //SVR_SIMD_X86
+
+const SimdKernels *getSimdKernels(SimdLevel level)
+{
+#ifdef SVR_SIMD_X86
+    __builtin_cpu_init();
+    switch(level)
+    {
+    case SimdLevel::Scalar:
+        return &scalarKernels;
+    case SimdLevel::SSE41:
+        return __builtin_cpu_supports("sse4.1") ? &sse41Kernels : nullptr;
+    case SimdLevel::AVX2:
+        return __builtin_cpu_supports("avx2") ? &avx2Kernels : nullptr;
+    case SimdLevel::AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") ? &avx512Kernels : nullptr;
+    }
+
+    return nullptr;
+#else
+    return level == SimdLevel::Scalar ? &scalarKernels : nullptr;
+#endif
+}
+
+static const SimdKernels &selectSimdKernels()
+{
+    auto maxLevel = SimdLevel::AVX512;
+    auto requestedLevel = getenv("SVR_SIMD");
+    if(requestedLevel)
+    {
+        std::string name = requestedLevel;
+        if(name == "scalar")
+            maxLevel = SimdLevel::Scalar;
+        else if(name == "sse4.1")
+            maxLevel = SimdLevel::SSE41;
+        else if(name == "avx2")
+            maxLevel = SimdLevel::AVX2;
+        else if(name != "avx512")
+            logWarning("Unknown SVR_SIMD instruction set");
+    }
+
+    for(int level = int(maxLevel); level > int(SimdLevel::Scalar); --level)
+    {
+        auto kernels = getSimdKernels(SimdLevel(level));
+        if(kernels)
+            return *kernels;
+    }
+
+    return scalarKernels;
+}
+
+const SimdKernels &getSimdKernels()
+{
+    static const SimdKernels &kernels = selectSimdKernels();
+    return kernels;
+}
+
+} // namespace SVR
@@ -0,0 +1,124 @@
+#include <atomic>
+#include <algorithm>
+#include "SVR/ThreadPool.hpp"
+
+namespace SVR
+{
+
+// Nested parallel loops are run in the calling worker.
+static thread_local bool isWorkerThread = false;
+
+ThreadPool::ThreadPool(size_t threadCount)
+    : quitting(false)
+{
+    if(threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    threads.reserve(threadCount);
+    for(size_t i = 0; i < threadCount; ++i)
+        threads.push_back(std::thread([this]() { workerMain(); }));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        quitting = true;
+    }
+
+    pendingTasksCondition.notify_all();
+    for(auto &thread : threads)
+        thread.join();
+}
+
+ThreadPool &ThreadPool::getDefault()
+{
+    static ThreadPool defaultPool;
+    return defaultPool;
+}
+
+size_t ThreadPool::getThreadCount() const
+{
+    return threads.size();
+}
+
+void ThreadPool::enqueue(const Task &task)
+{
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        pendingTasks.push_back(task);
+    }
+
+    pendingTasksCondition.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, const IndexedTask &body)
+{
+    if(count == 0)
+        return;
+
+    if(count == 1 || isWorkerThread || threads.empty())
+    {
+        for(size_t i = 0; i < count; ++i)
+            body(i);
+        return;
+    }
+
+    // The workers and the caller take indices from a shared counter.
+    struct SharedState
+    {
+        std::atomic<size_t> nextIndex;
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable finishedCondition;
+    };
+
+    auto state = std::make_shared<SharedState> ();
+    state->nextIndex = 0;
+    state->remaining = count;
+
+    auto worker = [state, count, &body]() {
+        for(size_t i = state->nextIndex++; i < count; i = state->nextIndex++)
+        {
+            body(i);
+            if(--state->remaining == 0)
+            {
+                std::unique_lock<std::mutex> l(state->mutex);
+                state->finishedCondition.notify_all();
+            }
+        }
+    };
+
+    auto workerCount = std::min(threads.size(), count - 1);
+    for(size_t i = 0; i < workerCount; ++i)
+        enqueue(worker);
+    worker();
+
+    std::unique_lock<std::mutex> l(state->mutex);
+    while(state->remaining != 0)
+        state->finishedCondition.wait(l);
+}
+
+void ThreadPool::workerMain()
+{
+    isWorkerThread = true;
+    for(;;)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> l(mutex);
+            while(!quitting && pendingTasks.empty())
+                pendingTasksCondition.wait(l);
+
+            if(quitting && pendingTasks.empty())
+                return;
+
+            task = pendingTasks.front();
+            pendingTasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+} // namespace SVR
@@ -3,25 +3,97 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <algorithm>
 #include "SVR/UnixMemoryMappedFile.hpp"
 
 namespace SVR
 {
-MemoryMappedFile::MemoryMappedFile(int fd, char *data, size_t size)
-    : fd(fd), data(data), size(size)
+
+inline size_t getPageSize()
+{
+    static size_t pageSize = sysconf(_SC_PAGESIZE);
+    return pageSize;
+}
+
+inline size_t computeResidentSize(char *data, size_t size)
+{
+    const size_t PagesPerQuery = 1 << 16;
+    auto pageSize = getPageSize();
+    auto pageCount = (size + pageSize - 1) / pageSize;
+
+    std::vector<unsigned char> residency(std::min(pageCount, PagesPerQuery));
+    size_t residentPages = 0;
+    for(size_t page = 0; page < pageCount; page += PagesPerQuery)
+    {
+        auto queryPages = std::min(pageCount - page, PagesPerQuery);
+        if(mincore(data + page*pageSize, queryPages*pageSize, &residency[0]) < 0)
+            return 0;
+
+        for(size_t i = 0; i < queryPages; ++i)
+            residentPages += residency[i] & 1;
+    }
+
+    return residentPages*pageSize;
+}
+
+MemoryMappedWindow::MemoryMappedWindow()
+    : file(nullptr), data(nullptr), offset(0), size(0)
+{
+}
+
+MemoryMappedWindow::~MemoryMappedWindow()
+{
+    unmap();
+}
+
+bool MemoryMappedWindow::contains(size_t rangeOffset, size_t rangeSize) const
+{
+    return data && offset <= rangeOffset && rangeOffset + rangeSize <= offset + size;
+}
+
+char *MemoryMappedWindow::getDataAt(size_t dataOffset) const
+{
+    return data + (dataOffset - offset);
+}
+
+size_t MemoryMappedWindow::getMappedSize() const
+{
+    return size;
+}
+
+void MemoryMappedWindow::unmap()
+{
+    if(!data)
+        return;
+
+    munmap(data, size);
+    if(file)
+        file->unregisterWindow(this);
+
+    file = nullptr;
+    data = nullptr;
+    offset = 0;
+    size = 0;
+}
+
+MemoryMappedFile::MemoryMappedFile(int fd, char *data, size_t size, bool canWrite)
+    : fd(fd), directFd(-1), data(data), size(size), canWrite(canWrite),
+      prefetchedOffset(0), prefetchEnd(0), prefetchDistance(0), consumedOffset(0), prefetchStopping(false)
 {
 }
 
 MemoryMappedFile::~MemoryMappedFile()
 {
+    close();
 }
 
-MemoryMappedFile *MemoryMappedFile::create(const char *filename, size_t size)
+MemoryMappedFile *MemoryMappedFile::create(const char *filename, size_t size, const MemoryMappedCreateOptions &options)
 {
     // Open the file.
     int fd = ::open(filename, O_RDWR | O_CREAT, 0644);
@@ -38,21 +110,39 @@ MemoryMappedFile *MemoryMappedFile::create(const char *filename, size_t size)
         abort();
     }
 
+#ifdef __linux__
+    // Allocate the blocks now, so that the first write into a page does not
+    // have to allocate them. Not every file system supports this.
+    if(options.preallocate && size > 0)
+        fallocate(fd, 0, 0, size);
+#endif
+
     // Perform memory mapping
-    char *data = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(!data)
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if(options.populate)
+        flags |= MAP_POPULATE;
+#endif
+
+    char *data = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if(data == MAP_FAILED)
     {
         perror("Failed to memory map file");
         abort();
     }
 
-    return new MemoryMappedFile(fd, data, size);
+#ifndef MAP_POPULATE
+    if(options.populate)
+        madvise(data, size, MADV_WILLNEED);
+#endif
+
+    return new MemoryMappedFile(fd, data, size, true);
 }
 
-MemoryMappedFile *MemoryMappedFile::open(const char *filename, bool canWrite)
+MemoryMappedFile *MemoryMappedFile::open(const char *filename, bool canWrite, bool windowed, bool directIO)
 {
     // Open the file.
-    int fd = ::open(filename, canWrite ? O_RDONLY : O_RDWR);
+    int fd = ::open(filename, canWrite ? O_RDWR : O_RDONLY);
     if(fd < 0)
     {
         perror("Failed to open file");
@@ -63,21 +153,51 @@ MemoryMappedFile *MemoryMappedFile::open(const char *filename, bool canWrite)
     size_t size = lseek(fd, 0, SEEK_END);
     lseek(fd, 0, SEEK_SET);
 
+    // Windowed files are mapped on demand.
+    if(windowed)
+    {
+        auto file = new MemoryMappedFile(fd, nullptr, size, canWrite);
+
+        // Direct IO is optional, because not every file system supports it.
+#ifdef O_DIRECT
+        if(directIO)
+            file->directFd = ::open(filename, O_RDONLY | O_DIRECT);
+#endif
+        return file;
+    }
+
     // Perform memory mapping
     char *data = (char*)mmap(NULL, size, canWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
-    if(!data)
+    if(data == MAP_FAILED)
     {
         perror("Failed to memory map file");
         abort();
     }
 
-    return new MemoryMappedFile(fd, data, size);
+    return new MemoryMappedFile(fd, data, size, canWrite);
 }
 
 void MemoryMappedFile::close()
 {
-    munmap(data, size);
-    ::close(fd);
+    stopPrefetch();
+
+    {
+        std::unique_lock<std::mutex> l(windowsMutex);
+        for(auto window : windows)
+            window->file = nullptr;
+        windows.clear();
+    }
+
+    if(data)
+        munmap(data, size);
+    data = nullptr;
+    if(fd >= 0)
+        ::close(fd);
+    fd = -1;
+
+    if(directFd >= 0)
+        ::close(directFd);
+    directFd = -1;
 }
 
 size_t MemoryMappedFile::getSize()
@@ -90,6 +210,353 @@ char *MemoryMappedFile::getData()
     return data;
 }
 
+bool MemoryMappedFile::isWindowed() const
+{
+    return data == nullptr;
+}
+
+char *MemoryMappedFile::mapWindow(MemoryMappedWindow &window, size_t offset, size_t rangeSize)
+{
+    // Whole files do not need an extra mapping.
+    if(!isWindowed())
+        return data + offset;
+
+    // The window ends at the end of the file.
+    if(offset > size)
+    {
+        fprintf(stderr, "Failed to memory map a file window after the end of the file\n");
+        return nullptr;
+    }
+
+    rangeSize = std::min(rangeSize, size - offset);
+    if(window.contains(offset, rangeSize))
+        return window.getDataAt(offset);
+
+    window.unmap();
+
+    // Align the window into page boundaries.
+    auto pageSize = getPageSize();
+    auto windowOffset = offset / pageSize * pageSize;
+    auto windowSize = std::max(offset + rangeSize - windowOffset, size_t(1));
+
+    auto windowData = (char*)mmap(NULL, windowSize, canWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, windowOffset);
+    if(windowData == MAP_FAILED)
+    {
+        perror("Failed to memory map file window");
+        abort();
+    }
+
+    window.file = this;
+    window.data = windowData;
+    window.offset = windowOffset;
+    window.size = windowSize;
+
+    {
+        std::unique_lock<std::mutex> l(windowsMutex);
+        windows.push_back(&window);
+    }
+
+    return window.getDataAt(offset);
+}
+
+void MemoryMappedFile::unregisterWindow(MemoryMappedWindow *window)
+{
+    std::unique_lock<std::mutex> l(windowsMutex);
+    auto it = std::find(windows.begin(), windows.end(), window);
+    if(it != windows.end())
+        windows.erase(it);
+}
+
+void MemoryMappedFile::flushInBackground(size_t offset, size_t rangeSize)
+{
+    auto pageSize = getPageSize();
+    auto flushOffset = offset / pageSize * pageSize;
+    auto flushSize = std::min(size, offset + rangeSize) - flushOffset;
+
+#ifdef __linux__
+    // MS_ASYNC does not start the write back in Linux.
+    sync_file_range(fd, flushOffset, flushSize, SYNC_FILE_RANGE_WRITE);
+#else
+    if(data)
+        msync(data + flushOffset, flushSize, MS_ASYNC);
+#endif
+}
+
+void MemoryMappedFile::adviseAccess(MemoryAccessHint hint, size_t offset, size_t rangeSize)
+{
+    if(offset >= size)
+        return;
+
+    rangeSize = std::min(rangeSize, size - offset);
+    auto pageSize = getPageSize();
+    auto adviceOffset = offset / pageSize * pageSize;
+    auto adviceSize = offset + rangeSize - adviceOffset;
+
+    // Mappings have their own read ahead policy, that is given with madvise.
+    int advice = MADV_NORMAL;
+    int fileAdvice = POSIX_FADV_NORMAL;
+    switch(hint)
+    {
+    case MemoryAccessHint::Normal:
+        break;
+    case MemoryAccessHint::Sequential:
+        advice = MADV_SEQUENTIAL;
+        fileAdvice = POSIX_FADV_SEQUENTIAL;
+        break;
+    case MemoryAccessHint::Random:
+        advice = MADV_RANDOM;
+        fileAdvice = POSIX_FADV_RANDOM;
+        break;
+    case MemoryAccessHint::WillNeed:
+        advice = MADV_WILLNEED;
+        fileAdvice = POSIX_FADV_WILLNEED;
+        break;
+    case MemoryAccessHint::DontNeed:
+        advice = MADV_DONTNEED;
+        fileAdvice = POSIX_FADV_DONTNEED;
+        break;
+    case MemoryAccessHint::HugePages:
+#ifdef MADV_HUGEPAGE
+        if(data)
+            madvise(data + adviceOffset, adviceSize, MADV_HUGEPAGE);
+#endif
+        return;
+    }
+
+    if(data)
+        madvise(data + adviceOffset, adviceSize, advice);
+
+    // Windows are mapped on demand, so the advice is given to the file.
+    // Dropped pages also have to be removed from the page cache.
+    if(!data || hint == MemoryAccessHint::DontNeed)
+        posix_fadvise(fd, adviceOffset, adviceSize, fileAdvice);
+}
+
+void MemoryMappedFile::startPrefetch(size_t offset, size_t rangeSize, size_t distance)
+{
+    stopPrefetch();
+
+    prefetchedOffset = std::min(offset, size);
+    prefetchEnd = std::min(size, offset + rangeSize);
+    consumedOffset = prefetchedOffset;
+    prefetchDistance = distance;
+    prefetchStopping = false;
+    prefetchThread = std::thread([this]() { prefetchThreadMain(); });
+}
+
+void MemoryMappedFile::advancePrefetch(size_t newConsumedOffset)
+{
+    {
+        std::unique_lock<std::mutex> l(prefetchMutex);
+        if(newConsumedOffset <= consumedOffset)
+            return;
+        consumedOffset = newConsumedOffset;
+    }
+
+    prefetchCondition.notify_one();
+}
+
+void MemoryMappedFile::stopPrefetch()
+{
+    if(!prefetchThread.joinable())
+        return;
+
+    {
+        std::unique_lock<std::mutex> l(prefetchMutex);
+        prefetchStopping = true;
+    }
+
+    prefetchCondition.notify_one();
+    prefetchThread.join();
+}
+
+void MemoryMappedFile::prefetchThreadMain()
+{
+    const size_t PrefetchChunkSize = 1 << 20;
+    auto pageSize = getPageSize();
+    for(;;)
+    {
+        size_t chunkStart, chunkEnd;
+        {
+            std::unique_lock<std::mutex> l(prefetchMutex);
+            while(!prefetchStopping && prefetchedOffset < prefetchEnd &&
+                prefetchedOffset >= consumedOffset + prefetchDistance)
+                prefetchCondition.wait(l);
+
+            if(prefetchStopping || prefetchedOffset >= prefetchEnd)
+                return;
+
+            // Skip the pages that the consumer has already read.
+            chunkStart = std::max(prefetchedOffset, consumedOffset);
+            chunkEnd = std::min(prefetchEnd, chunkStart + PrefetchChunkSize);
+            prefetchedOffset = chunkEnd;
+        }
+
+        // Start reading the chunk, and fault it into the mapping so that
+        // the consumer does not have to.
+        adviseAccess(MemoryAccessHint::WillNeed, chunkStart, chunkEnd - chunkStart);
+        if(data)
+        {
+            volatile char sink = 0;
+            for(size_t offset = chunkStart / pageSize * pageSize; offset < chunkEnd; offset += pageSize)
+                sink += data[offset];
+            (void)sink;
+        }
+    }
+}
+
+inline ssize_t readFully(int fd, char *buffer, size_t size, size_t offset)
+{
+    size_t readSize = 0;
+    while(readSize < size)
+    {
+        auto result = pread(fd, buffer + readSize, size - readSize, offset + readSize);
+        if(result < 0 && errno == EINTR)
+            continue;
+        if(result < 0)
+            return result;
+        if(result == 0)
+            break;
+        readSize += result;
+    }
+
+    return readSize;
+}
+
+const char *MemoryMappedFile::readRange(const FileRange &range, char *buffer, size_t bufferSize)
+{
+    // Direct reads have to be aligned. The unused bytes around the range are discarded.
+    if(directFd >= 0)
+    {
+        auto pageSize = getPageSize();
+        auto alignedOffset = range.offset / pageSize * pageSize;
+        auto alignedSize = (range.offset + range.size - alignedOffset + pageSize - 1) / pageSize * pageSize;
+        auto result = readFully(directFd, buffer, std::min(alignedSize, bufferSize), alignedOffset);
+        if(result >= ssize_t(range.offset + range.size - alignedOffset))
+            return buffer + (range.offset - alignedOffset);
+
+        // Use the page cache from now on.
+        ::close(directFd);
+        directFd = -1;
+    }
+
+    if(readFully(fd, buffer, range.size, range.offset) != ssize_t(range.size))
+    {
+        perror("Failed to read file");
+        abort();
+    }
+
+    return buffer;
+}
+
+void MemoryMappedFile::streamRanges(const std::vector<FileRange> &ranges, const RangeConsumer &consumer)
+{
+    const size_t SlotCount = 2;
+    if(ranges.empty())
+        return;
+
+    // The buffers are aligned for direct reads.
+    auto pageSize = getPageSize();
+    size_t maxRangeSize = 0;
+    for(auto &range : ranges)
+        maxRangeSize = std::max(maxRangeSize, range.size);
+    auto bufferSize = (maxRangeSize + pageSize - 1) / pageSize * pageSize + pageSize;
+
+    struct Slot
+    {
+        Slot() : buffer(nullptr), data(nullptr) {}
+        char *buffer;
+        const char *data;
+    };
+
+    Slot slots[SlotCount];
+    for(auto &slot : slots)
+    {
+        void *buffer;
+        if(posix_memalign(&buffer, pageSize, bufferSize) != 0)
+        {
+            perror("Failed to allocate the read buffers");
+            abort();
+        }
+        slot.buffer = reinterpret_cast<char*> (buffer);
+    }
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t readCount = 0;
+    size_t consumedCount = 0;
+
+    // The ranges are read in a separate thread, while the previous one is consumed.
+    std::thread reader([&]() {
+        for(size_t i = 0; i < ranges.size(); ++i)
+        {
+            {
+                std::unique_lock<std::mutex> l(mutex);
+                while(i - consumedCount >= SlotCount)
+                    condition.wait(l);
+            }
+
+            auto &slot = slots[i % SlotCount];
+            slot.data = readRange(ranges[i], slot.buffer, bufferSize);
+
+            {
+                std::unique_lock<std::mutex> l(mutex);
+                readCount = i + 1;
+            }
+            condition.notify_all();
+        }
+    });
+
+    for(size_t i = 0; i < ranges.size(); ++i)
+    {
+        {
+            std::unique_lock<std::mutex> l(mutex);
+            while(readCount <= i)
+                condition.wait(l);
+        }
+
+        consumer(i, slots[i % SlotCount].data);
+
+        {
+            std::unique_lock<std::mutex> l(mutex);
+            consumedCount = i + 1;
+        }
+        condition.notify_all();
+    }
+
+    reader.join();
+    for(auto &slot : slots)
+        free(slot.buffer);
+}
+
+MemoryUsage MemoryMappedFile::getMemoryUsage()
+{
+    MemoryUsage usage;
+    if(data)
+    {
+        usage.mappedSize = size;
+        usage.residentSize = computeResidentSize(data, size);
+    }
+    else
+    {
+        std::unique_lock<std::mutex> l(windowsMutex);
+        for(auto window : windows)
+        {
+            usage.mappedSize += window->size;
+            usage.residentSize += computeResidentSize(window->data, window->size);
+        }
+    }
+
+    struct rusage resourceUsage;
+    if(getrusage(RUSAGE_SELF, &resourceUsage) == 0)
+    {
+        usage.minorPageFaults = resourceUsage.ru_minflt;
+        usage.majorPageFaults = resourceUsage.ru_majflt;
+    }
+
+    return usage;
+}
+
 } // namespace ImageMapping
 
 #endif // _WIN32
@@ -1,5 +1,8 @@
 // OpenCL volumetric raycast kernel
+#pragma OPENCL EXTENSION cl_khr_3d_image_writes : enable
+
 __constant const sampler_t ColorMapSampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+__constant const sampler_t VoxelSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
 
 enum SamplingMode
 {
@@ -16,14 +19,87 @@ float filterValue(float value, float minValue, float maxValue )
 	return 1.0;
 }
 
+float4 colorSample(float value, image1d_t colorMap, float invColorMapSize, float filterMinValue, float filterMaxValue)
+{
+	float4 mappedValue = read_imagef(colorMap, ColorMapSampler, value*(1.0f - invColorMapSize) + invColorMapSize*0.5f);
+	return ((float4) (mappedValue.xyz, mappedValue.w*value))*filterValue(value, filterMinValue, filterMaxValue);
+}
+
 float4 sampleVolume(image3d_t volume, sampler_t volumeSampler, float4 point, image1d_t colorMap, float invColorMapSize, float filterMinValue, float filterMaxValue)
 {
 
 	float value = read_imagef(volume, volumeSampler, point).x;
-	float4 mappedValue = read_imagef(colorMap, ColorMapSampler, value*(1.0f - invColorMapSize) + invColorMapSize*0.5f);
-	return ((float4) (mappedValue.xyz, mappedValue.w*value))*filterValue(value, filterMinValue, filterMaxValue);
+	return colorSample(value, colorMap, invColorMapSize, filterMinValue, filterMaxValue);
+}
+
+
+// Halves the volume along each axis with a box filter, which keeps the integral along the rays.
+__kernel void downsampleVolume(__read_only image3d_t source, __write_only image3d_t destination)
+{
+	int4 coord = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+	int4 sourceCoord = coord*2;
+
+	float sum = 0.0f;
+	for(int z = 0; z < 2; ++z)
+	{
+		for(int y = 0; y < 2; ++y)
+		{
+			for(int x = 0; x < 2; ++x)
+				sum += read_imagef(source, VoxelSampler, sourceCoord + (int4) (x, y, z, 0)).x;
+		}
+	}
+
+	write_imagef(destination, coord, sum*0.125f);
+}
+
+// Number of brick slices of a volume level, in the brick ranges.
+int getBrickSliceCount(int4 volumeSize, int brickSize)
+{
+	return (volumeSize.z + brickSize - 1) / brickSize;
+}
+
+// Computes the range of each brick of the volume, for skipping the empty space.
+// The brick ranges of the volume levels are stacked along z, and the bricks
+// of each level start at its slice offset.
+// A voxel of apron on each side covers the linear filtering across the brick faces.
+__kernel void computeBrickRanges(__read_only image3d_t volume, __write_only image3d_t brickRanges, int brickSize, int brickSliceOffset)
+{
+	int4 brick = (int4) (get_global_id(0), get_global_id(1), get_global_id(2), 0);
+	int4 start = brick*brickSize - 1;
+	int4 end = start + brickSize + 2;
+
+	float minValue = INFINITY;
+	float maxValue = -INFINITY;
+	for(int z = start.z; z < end.z; ++z)
+	{
+		for(int y = start.y; y < end.y; ++y)
+		{
+			for(int x = start.x; x < end.x; ++x)
+			{
+				float value = read_imagef(volume, VoxelSampler, (int4) (x, y, z, 0)).x;
+				minValue = min(minValue, value);
+				maxValue = max(maxValue, value);
+			}
+		}
+	}
+
+	write_imagef(brickRanges, (int4) (brick.x, brick.y, brick.z + brickSliceOffset, 0), (float4) (minValue, maxValue, 0.0f, 0.0f));
+}
+
+// A brick is empty when the filter discards all of its values.
+bool isBrickEmpty(image3d_t brickRanges, int4 brick, int brickSliceOffset, float filterMinValue, float filterMaxValue)
+{
+	float2 range = read_imagef(brickRanges, VoxelSampler, (int4) (brick.x, brick.y, brick.z + brickSliceOffset, 0)).xy;
+	return range.y < filterMinValue || range.x > filterMaxValue;
 }
 
+// Simpson's rule weight of a sample.
+float simpsonWeight(int index, int numberOfSteps)
+{
+	if(index == 0 || index == numberOfSteps - 1)
+		return 1.0f;
+	return (index & 1) ? 4.0f : 2.0f;
+}
 
 // Ray-Box intersection.
 // Taken from implementation located in: https://github.com/hpicgs/cgsee/wiki/Ray-Box-Intersection-on-the-GPU
@@ -64,6 +140,7 @@ float4 convertToCubeCoordinates(float3 point, float4 boxMin, float4 boxMax)
 
 float4 integrate(__read_only image3d_t volume, float segmentLength, float4 startPoint, float4 endPoint, int minNumberOfSamples, int maxNumberOfSamples, float lengthSamplingFactor, float boxLength, float lengthScale, float4 cubeViewRegionMin, float4 cubeViewRegionMax, sampler_t cubeSampler,
 image1d_t colorMap, float invColorMapSize, float filterMinValue, float filterMaxValue,
+image3d_t brickRanges, int brickSize, int brickSliceOffset,
 
     int averageSamples,
     float4 sampleColorIntensity
@@ -75,17 +152,77 @@ image1d_t colorMap, float invColorMapSize, float filterMinValue, float filterMax
 	float scaleFactor = integrationLength;
 	float stepSize = 1.0 / (numberOfSteps - 1);
 
+	// Walk the brick grid along the ray, and skip the samples of the empty bricks.
+	// The samples keep their Simpson's rule weight, the skipped ones only add zero.
+	float4 result = (float4) (0.0f, 0.0f, 0.0f, 0.0f);
+	int i = 0;
+	if(brickSize > 0)
+	{
+		int4 brickCount = (get_image_dim(volume) + brickSize - 1) / brickSize;
+		float3 gridScale = convert_float3(get_image_dim(volume).xyz) / brickSize;
+		float3 gridStart = startPoint.xyz*gridScale;
+		float3 gridDelta = (endPoint - startPoint).xyz*gridScale;
+
+		int4 brick = (int4) (clamp(convert_int3(floor(gridStart)), (int3) (0), brickCount.xyz - 1), 0);
+		int3 brickStep = (int3) (gridDelta.x < 0.0f ? -1 : 1, gridDelta.y < 0.0f ? -1 : 1, gridDelta.z < 0.0f ? -1 : 1);
+
+		// Ray parameter of the next brick face along each axis.
+		float3 boundary = convert_float3(brick.xyz + max(brickStep, 0));
+		float3 nextBoundary = (float3) (
+			gridDelta.x != 0.0f ? (boundary.x - gridStart.x) / gridDelta.x : 2.0f,
+			gridDelta.y != 0.0f ? (boundary.y - gridStart.y) / gridDelta.y : 2.0f,
+			gridDelta.z != 0.0f ? (boundary.z - gridStart.z) / gridDelta.z : 2.0f);
+		float3 boundaryDelta = (float3) (
+			gridDelta.x != 0.0f ? fabs(1.0f / gridDelta.x) : 2.0f,
+			gridDelta.y != 0.0f ? fabs(1.0f / gridDelta.y) : 2.0f,
+			gridDelta.z != 0.0f ? fabs(1.0f / gridDelta.z) : 2.0f);
+
+		while(i < numberOfSteps)
+		{
+			float brickExit = min(min(min(nextBoundary.x, nextBoundary.y), nextBoundary.z), 1.0f);
+			int lastSample = min(numberOfSteps - 1, (int)floor(brickExit*(numberOfSteps - 1)));
+			if(isBrickEmpty(brickRanges, brick, brickSliceOffset, filterMinValue, filterMaxValue))
+			{
+				i = max(i, lastSample + 1);
+			}
+			else
+			{
+				for(; i <= lastSample; ++i) {
+					float4 point = mix(startPoint, endPoint, i*stepSize);
+					result += simpsonWeight(i, numberOfSteps)*sampleColorIntensity*sampleVolume(volume, cubeSampler, point, colorMap, invColorMapSize, filterMinValue, filterMaxValue);
+				}
+			}
+
+			if(brickExit >= 1.0f)
+				break;
+
+			// Step into the next brick.
+			if(nextBoundary.x <= nextBoundary.y && nextBoundary.x <= nextBoundary.z)
+			{
+				brick.x += brickStep.x;
+				nextBoundary.x += boundaryDelta.x;
+			}
+			else if(nextBoundary.y <= nextBoundary.z)
+			{
+				brick.y += brickStep.y;
+				nextBoundary.y += boundaryDelta.y;
+			}
+			else
+			{
+				brick.z += brickStep.z;
+				nextBoundary.z += boundaryDelta.z;
+			}
+
+			if(any(brick.xyz < 0) || any(brick.xyz >= brickCount.xyz))
+				break;
+		}
+	}
 
-	// Endpoints for the Simpson's rule
-	float4 result = sampleColorIntensity*sampleVolume(volume, cubeSampler, startPoint, colorMap, invColorMapSize, filterMinValue, filterMaxValue);
-
-	// Sample the inner points
-	for(int i = 1; i < numberOfSteps-1; ++i) {
+	// The remaining samples, when the walk leaves the grid early by rounding.
+	for(; i < numberOfSteps; ++i) {
 		float4 point = mix(startPoint, endPoint, i*stepSize);
-		float factor = (i & 1) ? 4.0f : 2.0f;
-		result += factor*sampleColorIntensity*sampleVolume(volume, cubeSampler, point, colorMap, invColorMapSize, filterMinValue, filterMaxValue);
+		result += simpsonWeight(i, numberOfSteps)*sampleColorIntensity*sampleVolume(volume, cubeSampler, point, colorMap, invColorMapSize, filterMinValue, filterMaxValue);
 	}
-	result += sampleColorIntensity*sampleVolume(volume, cubeSampler, endPoint, colorMap, invColorMapSize, filterMinValue, filterMaxValue);
 
     //printf("Number of steps %d\n", numberOfSteps);
     if(averageSamples)
@@ -127,6 +264,12 @@ __kernel void raycastVolume(__read_only image3d_t volume, __write_only image2d_t
     // Color mapping
 	image1d_t colorMap, float invColorMapSize, float filterMinValue, float filterMaxValue,
 
+    // Empty space skipping, disabled when the brick size is zero
+	__read_only image3d_t brickRanges, int brickSize,
+
+    // Coarser levels of the volume, halved along each axis
+	__read_only image3d_t volumeLevel1, __read_only image3d_t volumeLevel2, __read_only image3d_t volumeLevel3, int levelCount,
+
     // Color correction
 	float invGammaCorrectionFactor,
 
@@ -170,11 +313,182 @@ __kernel void raycastVolume(__read_only image3d_t volume, __write_only image2d_t
 
 		float4 startPointCube = convertToCubeCoordinates(startPoint, boxMin, boxMax);
 		float4 endPointCube = convertToCubeCoordinates(endPoint, boxMin, boxMax);
-		color = integrate(volume, length(endPoint - startPoint)/lengthScale, startPointCube, endPointCube, minNumberOfSamples, maxNumberOfSamples, lengthSamplingFactor, boxLength, lengthScale, cubeViewRegionMin, cubeViewRegionMax, cubeSampler, colorMap, invColorMapSize, filterMinValue, filterMaxValue,
-        averageSamples, sampleColorIntensity);
+
+		// Pick the coarsest level whose voxels are not larger than a pixel at the entry point.
+		// The pixel footprint grows linearly with the depth, from the near to the far plane.
+		float entryDepth = max(intersection.x, 0.0f) / rayMaxParameter;
+		float pixelSize = mix(length(nearTopRight - nearTopLeft), length(farTopRight - farTopLeft), entryDepth) / extent.x;
+		float3 voxelSize = boxExtent.xyz / convert_float3(get_image_dim(volume).xyz);
+		int level = clamp((int)floor(log2(pixelSize / min(min(voxelSize.x, voxelSize.y), voxelSize.z))), 0, levelCount - 1);
+
+		// The voxel diagonal, and so the number of samples, halves with each level.
+		int levelMaxNumberOfSamples = max(minNumberOfSamples, maxNumberOfSamples >> level);
+		int brickSliceOffset = 0;
+		if(brickSize > 0)
+		{
+			if(level > 0)
+				brickSliceOffset += getBrickSliceCount(get_image_dim(volume), brickSize);
+			if(level > 1)
+				brickSliceOffset += getBrickSliceCount(get_image_dim(volumeLevel1), brickSize);
+			if(level > 2)
+				brickSliceOffset += getBrickSliceCount(get_image_dim(volumeLevel2), brickSize);
+		}
+
+#define INTEGRATE_LEVEL(levelVolume) integrate(levelVolume, length(endPoint - startPoint)/lengthScale, startPointCube, endPointCube, minNumberOfSamples, levelMaxNumberOfSamples, lengthSamplingFactor, boxLength, lengthScale, cubeViewRegionMin, cubeViewRegionMax, cubeSampler, colorMap, invColorMapSize, filterMinValue, filterMaxValue, \
+        brickRanges, brickSize, brickSliceOffset, averageSamples, sampleColorIntensity)
+		switch(level)
+		{
+		case 1:
+			color = INTEGRATE_LEVEL(volumeLevel1);
+			break;
+		case 2:
+			color = INTEGRATE_LEVEL(volumeLevel2);
+			break;
+		case 3:
+			color = INTEGRATE_LEVEL(volumeLevel3);
+			break;
+		default:
+			color = INTEGRATE_LEVEL(volume);
+			break;
+		}
+#undef INTEGRATE_LEVEL
         //if(coord.x == 100 && coord.y == 100)
         //    printf("color %f %f %f %f\n", color.x, color.y, color.z, color.w);
 	}
 
 	write_imagef(renderBuffer, coord,  pow(color, invGammaCorrectionFactor));
 }
+
+// Samples a virtual volume, whose resident bricks are in the slots of a brick atlas.
+// Each slot has a voxel of apron around its brick, for the linear filtering.
+// The page table has the slot of each resident brick, and a positive w.
+// Missing bricks sample as zero, and the first one along the ray is recorded.
+float sampleVirtualVolume(image3d_t brickAtlas, image3d_t pageTable, sampler_t volumeSampler, float4 point,
+	float4 volumeSize, int brickSize, int4 *missingBrick)
+{
+	float4 voxel = point*volumeSize;
+	int4 brick = (int4) (clamp(convert_int3(floor(voxel.xyz / brickSize)), (int3) (0), get_image_dim(pageTable).xyz - 1), 0);
+	float4 page = read_imagef(pageTable, VoxelSampler, brick);
+	if(page.w <= 0.0f)
+	{
+		if(missingBrick->w == 0)
+			*missingBrick = (int4) (brick.xyz, 1);
+		return 0.0f;
+	}
+
+	float4 atlasVoxel = page*(brickSize + 2) + 1.0f + voxel - convert_float4(brick*brickSize);
+	float4 atlasSize = convert_float4(get_image_dim(brickAtlas));
+	atlasVoxel.w = 0.0f;
+	atlasSize.w = 1.0f;
+	return read_imagef(brickAtlas, volumeSampler, atlasVoxel / atlasSize).x;
+}
+
+// Cube volume rendering from a virtual volume. The brick feedback receives,
+// from one ray of each 4x4 tile, the first missing brick along the ray, or
+// else the first visible one, whose w is 0.5, so that it stays in the cache.
+// The sampled ray of the tile is selected by the feedback phase.
+__kernel void raycastVirtualVolume(__read_only image3d_t brickAtlas, __write_only image2d_t renderBuffer,
+    // Camera information
+    float4 nearTopLeft, float4 nearTopRight, float4 nearBottomLeft, float4 nearBottomRight,
+    float4 farTopLeft, float4 farTopRight, float4 farBottomLeft, float4 farBottomRight,
+
+    // Cube parameters
+	float4 boxMin, float4 boxMax,
+	float4 cubeViewRegionMin, float4 cubeViewRegionMax,
+    float lengthScale,
+
+    // Sampling
+	int minNumberOfSamples,
+	int maxNumberOfSamples,
+	float lengthSamplingFactor,
+	sampler_t cubeSampler,
+
+    // Color mapping
+	image1d_t colorMap, float invColorMapSize, float filterMinValue, float filterMaxValue,
+
+    // Virtual volume
+	__read_only image3d_t pageTable, float4 volumeSize, int brickSize,
+	__write_only image2d_t brickFeedback, int feedbackPhase,
+
+    // Color correction
+	float invGammaCorrectionFactor,
+
+    // Extra modes
+    int averageSamples,
+    float4 sampleColorIntensity
+)
+{
+	// Compute data from the cube.
+	float boxLength = length(boxMax - boxMin);
+	float4 boxExtent = (boxMax - boxMin);
+
+	// Compute the viewed cube
+	float4 viewMin = cubeViewRegionMin*boxExtent + boxMin;
+	float4 viewMax = cubeViewRegionMax*boxExtent + boxMin;
+
+	// Compute basic thread information.
+	int2 extent = (int2) (get_global_size(0), get_global_size(1));
+	int2 coord = (int2) (get_global_id(0), get_global_id(1));
+	float2 uvCoord = (float2) ((coord.x) / (extent.x - 1.0f), coord.y / (extent.y - 1.0f));
+
+	// Compute the point location in the near and the far plane
+    float4 nearPoint = mix(mix(nearBottomLeft, nearBottomRight, uvCoord.x), mix(nearTopLeft, nearTopRight, uvCoord.x), uvCoord.y);
+    float4 farPoint = mix(mix(farBottomLeft, farBottomRight, uvCoord.x), mix(farTopLeft, farTopRight, uvCoord.x), uvCoord.y);
+
+    // Compute the ray.
+    float3 rayOrigin = nearPoint.xyz;
+    float3 rayTarget = farPoint.xyz;
+	float3 rayDirection = normalize(rayTarget - rayOrigin);
+	float3 rayInverseDirection = 1.0f / rayDirection;
+    float rayMaxParameter = dot(rayTarget - rayOrigin, rayDirection);
+
+	// Compute the ray intersection points.
+	float3 intersection = rayBoxIntersection(rayOrigin, rayDirection, rayInverseDirection, viewMin.xyz, viewMax.xyz);
+	float4 color = (float4) (0.0, 0.0, 0.0, 1.0);
+	int4 missingBrick = (int4) (0, 0, 0, 0);
+	int4 visibleBrick = (int4) (0, 0, 0, 0);
+	if(intersection.z == 1.0 && intersection.y >= 0.0)
+	{
+        // Compute the start and end points in world space.
+		float3 startPoint = rayOrigin + rayDirection*max(intersection.x, 0.0f);
+		float3 endPoint = rayOrigin + rayDirection*min(intersection.y, rayMaxParameter);
+
+		float4 startPointCube = convertToCubeCoordinates(startPoint, boxMin, boxMax);
+		float4 endPointCube = convertToCubeCoordinates(endPoint, boxMin, boxMax);
+
+		// Integrate with the Simpson's rule, as integrate does.
+		float integrationLength = length(endPoint - startPoint)/lengthScale;
+		int numberOfSteps = clamp((int)ceil(lengthSamplingFactor*integrationLength * (maxNumberOfSamples - 1) / boxLength),  minNumberOfSamples, maxNumberOfSamples);
+		float stepSize = 1.0 / (numberOfSteps - 1);
+
+		float4 result = (float4) (0.0f, 0.0f, 0.0f, 0.0f);
+		for(int i = 0; i < numberOfSteps; ++i) {
+			float4 point = mix(startPointCube, endPointCube, i*stepSize);
+			float value = sampleVirtualVolume(brickAtlas, pageTable, cubeSampler, point, volumeSize, brickSize, &missingBrick);
+			float4 sample = colorSample(value, colorMap, invColorMapSize, filterMinValue, filterMaxValue);
+			if(visibleBrick.w == 0 && sample.w > 0.0f)
+				visibleBrick = (int4) (convert_int3(floor((point*volumeSize).xyz / brickSize)), 1);
+			result += simpsonWeight(i, numberOfSteps)*sampleColorIntensity*sample;
+		}
+
+		if(averageSamples)
+			result *= stepSize  / 3.0f;
+		else
+			result *= stepSize * integrationLength / 3.0f;
+		result.w = 1.0f;
+		color = result;
+	}
+
+	write_imagef(renderBuffer, coord,  pow(color, invGammaCorrectionFactor));
+
+	// Report the bricks of one ray of the tile.
+	if(coord.x % 4 == feedbackPhase % 4 && coord.y % 4 == feedbackPhase / 4)
+	{
+		float4 feedback = (float4) (0.0f, 0.0f, 0.0f, 0.0f);
+		if(missingBrick.w)
+			feedback = (float4) (convert_float3(missingBrick.xyz), 1.0f);
+		else if(visibleBrick.w)
+			feedback = (float4) (convert_float3(visibleBrick.xyz), 0.5f);
+		write_imagef(brickFeedback, coord / 4, feedback);
+	}
+}
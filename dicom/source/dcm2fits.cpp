@@ -3,9 +3,11 @@
 #include <string.h>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include "SVR/Endianness.hpp"
 #include "SVR/FitsFile.hpp"
+#include "SVR/ThreadPool.hpp"
 
 #define HAVE_CONFIG_H
 #include "dcmtk/config/osconfig.h"
@@ -16,11 +18,14 @@ using namespace SVR;
 int width = -1;
 int height = -1;
 int depth;
+int threadCount = 0;
+bool populateOutput = false;
 std::vector<std::string> inputFileNames;
 std::string outputFileName;
 
 void printHelp()
 {
+    printf("dcm2fits -w <width> -h <height> -o <output.fits> [-threads <count>] [-populate] <slices.dcm...>\n");
 }
 
 std::string intToString(int v)
@@ -95,6 +100,14 @@ int main(int argc, const char **argv)
         {
             outputFileName = argv[i];
         }
+        else if(!strcmp(argv[i], "-threads") && argv[++i])
+        {
+            threadCount = atoi(argv[i]);
+        }
+        else if(!strcmp(argv[i], "-populate"))
+        {
+            populateOutput = true;
+        }
         else if(!strcmp(argv[i], "-help"))
         {
             printHelp();
@@ -119,6 +132,7 @@ int main(int argc, const char **argv)
 
     // Create the FITS file properties.
     FitsHeaderProperties properties;
+    properties["SIMPLE"] = "T";
     properties["BITPIX"] = "16";
     properties["NAXIS"] = "3";
     properties["NAXIS1"] = intToString(width);
@@ -126,18 +140,17 @@ int main(int argc, const char **argv)
     properties["NAXIS3"] = intToString(depth);
 
     // Create the output file
-    auto slicePitch = width*height;
+    auto slicePitch = size_t(width)*height;
     auto outputDataSize = slicePitch*depth;
-    auto outputFits = FitsFile::create(outputFileName.c_str(), properties, outputDataSize*2);
-
-    auto outputBuffer = reinterpret_cast<int16_t*> (outputFits->getImageData());
-
-    // Start writing the slices
-    for(auto &inputFileName : inputFileNames)
-    {
-        copyDicomInto(inputFileName, slicePitch, outputBuffer);
-        outputBuffer += slicePitch;
-    } 
+    MemoryMappedCreateOptions createOptions;
+    createOptions.populate = populateOutput;
+    auto outputFits = FitsFile::create(outputFileName.c_str(), properties, outputDataSize*2, createOptions);
+
+    // Write the slices in parallel.
+    ThreadPool pool(std::max(threadCount, 0));
+    outputFits->writeSlices([&](size_t slice, char *sliceData) {
+        copyDicomInto(inputFileNames[slice], slicePitch*2, reinterpret_cast<int16_t*> (sliceData));
+    }, &pool);
 
     // Close the output fits.
     outputFits->close();
@@ -0,0 +1,34 @@
+#include <UnitTest++.h>
+#include "SVR/BrickCache.hpp"
+
+using namespace SVR;
+
+SUITE(BrickCache)
+{
+    TEST(EvictsTheLeastRecentlyUsedBrick)
+    {
+        BrickCache cache;
+        cache.reset(10, 2);
+
+        size_t evicted;
+        auto first = cache.allocate(3, evicted);
+        CHECK_EQUAL(evicted, BrickCache::NoBrick);
+        auto second = cache.allocate(5, evicted);
+        CHECK(first != second);
+        CHECK_EQUAL(cache.getResidentCount(), 2u);
+
+        // Every slot is used in this frame.
+        CHECK_EQUAL(cache.allocate(7, evicted), BrickCache::NoSlot);
+
+        cache.beginFrame();
+        CHECK_EQUAL(cache.touch(3), first);
+        CHECK_EQUAL(cache.allocate(7, evicted), second);
+        CHECK_EQUAL(evicted, 5u);
+        CHECK_EQUAL(cache.touch(5), BrickCache::NoSlot);
+        CHECK_EQUAL(cache.getResidentCount(), 2u);
+
+        cache.reset(10, 2);
+        CHECK_EQUAL(cache.touch(3), BrickCache::NoSlot);
+        CHECK_EQUAL(cache.getResidentCount(), 0u);
+    }
+}
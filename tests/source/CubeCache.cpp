@@ -0,0 +1,64 @@
+#include <UnitTest++.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "SVR/CubeCache.hpp"
+#include "TestFits.hpp"
+
+using namespace SVR;
+
+SUITE(CubeCache)
+{
+    const char *TestFileName = "SVRTests_CubeCache.fits";
+    const char *TestCacheDirectory = "SVRTests_CubeCache";
+
+    FitsFile *createTestCube()
+    {
+        // The physical values of slice i are 10 + i + [0, 2.5].
+        return createTestFits(TestFileName, FitsFormat::Int16, {3, 2, 2}, [](size_t i) {
+            return double((i / 6)*2 + i % 6);
+        }, {{"BSCALE", "0.5"}, {"BZERO", "10.0"}});
+    }
+
+    TEST(StoreAndOpen)
+    {
+        auto source = createTestCube();
+        CubeCache cache(TestCacheDirectory);
+        auto key = cache.computeKey(TestFileName, source);
+        CHECK(!key.empty());
+
+        // Every statistic that is saved is computed.
+        CubeStatistics statistics;
+        auto stored = cache.store(key, source, statistics, FitsAccessMode::Windowed);
+        CHECK(stored);
+        CHECK(stored->isNativeByteOrder());
+        CHECK_EQUAL(statistics.minValue, 10.0);
+        CHECK_EQUAL(statistics.maxValue, 13.5);
+        CHECK_EQUAL(statistics.sliceMinValue.size(), 2u);
+        CHECK_EQUAL(statistics.sliceMeanValue.size(), 2u);
+        CHECK_EQUAL(statistics.sliceNanCount.size(), 2u);
+        CHECK_CLOSE(statistics.sliceMeanValue[1], 12.25, 1e-12);
+        CHECK(!statistics.brickMinValue.empty());
+
+        auto storedData = reinterpret_cast<const float*> (stored->getImageData());
+        CHECK_EQUAL(storedData[7], 11.5f);
+        stored->close();
+        delete stored;
+
+        CubeStatistics loaded;
+        auto cached = cache.open(key, loaded, FitsAccessMode::Streamed);
+        CHECK(cached);
+        CHECK(cached->isNativeByteOrder());
+        CHECK_EQUAL(loaded.sliceMaxValue[1], 13.5);
+        CHECK_CLOSE(loaded.sliceMeanValue[0], statistics.sliceMeanValue[0], 1e-12);
+        CHECK_EQUAL(loaded.brickMinValue.size(), statistics.brickMinValue.size());
+        cached->close();
+        delete cached;
+
+        source->close();
+        delete source;
+        remove(TestFileName);
+        remove((std::string(TestCacheDirectory) + "/" + key + ".fits").c_str());
+        remove((std::string(TestCacheDirectory) + "/" + key + ".stats").c_str());
+        CHECK_EQUAL(rmdir(TestCacheDirectory), 0);
+    }
+}
@@ -0,0 +1,98 @@
+#include <UnitTest++.h>
+#include <math.h>
+#include <stdio.h>
+#include "SVR/CubeStatistics.hpp"
+#include "TestFits.hpp"
+
+using namespace SVR;
+
+SUITE(CubeStatistics)
+{
+    const char *TestFileName = "SVRTests_CubeStatistics.fits";
+    const char *TestStatisticsFileName = "SVRTests_CubeStatistics.fits.svrstats";
+
+    FitsFile *createTestCube()
+    {
+        // Slice i has the values [i, i + 7], except for a NaN at the end.
+        return createTestFits(TestFileName, FitsFormat::Float, {4, 2, 3}, [](size_t i) {
+            return i < 23 ? double(i / 8 + i % 8) : NAN;
+        });
+    }
+
+    TEST(ComputeAndReload)
+    {
+        auto cube = createTestCube();
+        CubeStatistics statistics;
+        computeCubeStatistics(cube, statistics, CubeStatistics::HistogramBinCount, 2);
+        CHECK_EQUAL(statistics.minValue, 0.0);
+        CHECK_EQUAL(statistics.maxValue, 8.0);
+        CHECK_EQUAL(statistics.nanCount, 1u);
+        CHECK_EQUAL(statistics.sliceMinValue.size(), 3u);
+        CHECK_EQUAL(statistics.sliceMinValue[1], 1.0);
+        CHECK_EQUAL(statistics.sliceMaxValue[2], 8.0);
+        CHECK_CLOSE(statistics.sliceMeanValue[0], 3.5, 1e-12);
+        CHECK_CLOSE(statistics.sliceStandardDeviation[0], sqrt(5.25), 1e-12);
+        CHECK_EQUAL(statistics.sliceNanCount[2], 1u);
+        CHECK_CLOSE(statistics.meanValue, (3.5*8 + 4.5*8 + (5.5*8 - 9))/23.0, 1e-12);
+
+        // The bricks are 2x2x2, the last one along z is partial.
+        CHECK_EQUAL(statistics.brickCountX, 2u);
+        CHECK_EQUAL(statistics.brickCountZ, 2u);
+        CHECK_EQUAL(statistics.brickMinValue[0], 0.0);
+        CHECK_EQUAL(statistics.brickMaxValue[0], 6.0);
+
+        uint64_t histogramTotal = 0;
+        for(auto count : statistics.histogram)
+            histogramTotal += count;
+        CHECK_EQUAL(histogramTotal, 23u);
+
+        // Only whole slices have a known range.
+        double minValue, maxValue;
+        CHECK(statistics.getRegionRange(cube, SliceRange(0, 4), SliceRange(0, 2), SliceRange(1, 2), minValue, maxValue));
+        CHECK_EQUAL(minValue, 1.0);
+        CHECK_EQUAL(maxValue, 8.0);
+        CHECK(!statistics.getRegionRange(cube, SliceRange(1, 3), SliceRange(0, 2), SliceRange(1, 2), minValue, maxValue));
+
+        // Brick aligned regions have a known range too.
+        CHECK(statistics.getRegionRange(cube, SliceRange(0, 2), SliceRange(0, 2), SliceRange(0, 2), minValue, maxValue));
+        CHECK_EQUAL(minValue, 0.0);
+        CHECK_EQUAL(maxValue, 6.0);
+        CHECK(statistics.getRegionRange(cube, SliceRange(2, 2), SliceRange(0, 2), SliceRange(2, 1), minValue, maxValue));
+        CHECK_EQUAL(minValue, 4.0);
+        CHECK_EQUAL(maxValue, 8.0);
+
+        CHECK(statistics.save(TestStatisticsFileName, "key"));
+        CubeStatistics loaded;
+        CHECK(!loaded.load(TestStatisticsFileName, "otherKey"));
+        CHECK(loaded.load(TestStatisticsFileName, "key"));
+        CHECK_EQUAL(loaded.nanCount, 1u);
+        CHECK(loaded.histogram == statistics.histogram);
+        CHECK(loaded.sliceMaxValue == statistics.sliceMaxValue);
+        CHECK_EQUAL(loaded.meanValue, statistics.meanValue);
+        CHECK(loaded.sliceStandardDeviation == statistics.sliceStandardDeviation);
+        CHECK(loaded.brickMaxValue == statistics.brickMaxValue);
+
+        delete cube;
+        remove(TestFileName);
+        remove(TestStatisticsFileName);
+    }
+
+    TEST(RememberedRegionRange)
+    {
+        auto cube = createTestCube();
+        CubeStatistics statistics;
+        double minValue, maxValue;
+        CHECK(!statistics.getRegionRange(cube, SliceRange(1, 3), SliceRange(0, 2), SliceRange(1, 2), minValue, maxValue));
+
+        statistics.setRegionRange(SliceRange(1, 3), SliceRange(0, 2), SliceRange(1, 2), 2.0, 7.0);
+        statistics.setRegionRange(SliceRange(1, 3), SliceRange(0, 2), SliceRange(1, 2), 2.0, 8.0);
+        CHECK(statistics.getRegionRange(cube, SliceRange(1, 3), SliceRange(0, 2), SliceRange(1, 2), minValue, maxValue));
+        CHECK_EQUAL(minValue, 2.0);
+        CHECK_EQUAL(maxValue, 8.0);
+        CHECK(!statistics.getRegionRange(cube, SliceRange(1, 3), SliceRange(0, 2), SliceRange(0, 2), minValue, maxValue));
+        CHECK(statistics.isEmpty());
+
+        delete cube;
+        remove(TestFileName);
+    }
+}
@@ -0,0 +1,577 @@
+#include <UnitTest++.h>
+#include <zlib.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "SVR/FitsFile.hpp"
+#include "TestFits.hpp"
+
+using namespace SVR;
+
+SUITE(FitsFile)
+{
+    const char *TestFileName = "SVRTests_FitsFile.fits";
+
+    FitsFile *createTestFile(size_t width, size_t height, size_t depth, FitsAccessMode accessMode=FitsAccessMode::Mapped)
+    {
+        FitsHeaderProperties properties;
+        properties["BSCALE"] = "2.5";
+        properties["BZERO"] = "-1.0D+01";
+        properties["CDELT3"] = "0.5";
+        properties["OBJECT"] = "'M 31    ' / Target name";
+        return createTestFits(TestFileName, FitsFormat::Float, {width, height, depth}, [](size_t i) {
+            return double(i);
+        }, properties, accessMode);
+    }
+
+    TEST(CreateAndOpen)
+    {
+        auto fits = createTestFile(4, 3, 2);
+        CHECK(fits);
+        CHECK_EQUAL(fits->getHduCount(), 1u);
+        CHECK_EQUAL(fits->getWidth(), 4u);
+        CHECK_EQUAL(fits->getHeight(), 3u);
+        CHECK_EQUAL(fits->getDepth(), 2u);
+        CHECK(fits->getFormat() == FitsFormat::Float);
+        CHECK_EQUAL(fits->getElementSize(), 4u);
+        fits->close();
+        delete fits;
+        remove(TestFileName);
+    }
+
+    TEST(HeaderKeywords)
+    {
+        auto fits = createTestFile(4, 3, 2, FitsAccessMode::Windowed);
+        auto &keywords = fits->getKeywords();
+        CHECK(keywords.hasScaling());
+        CHECK_CLOSE(keywords.bscale, 2.5, 1e-9);
+        CHECK_CLOSE(keywords.bzero, -10.0, 1e-9);
+        CHECK(!keywords.hasBlank);
+        CHECK_CLOSE(keywords.pixelDelta[2], 0.5, 1e-9);
+        CHECK_CLOSE(keywords.pixelDelta[0], 1.0, 1e-9);
+        CHECK(fits->getHeader().getString("OBJECT") == "M 31");
+        CHECK(!fits->getHeader().find("MISSING"));
+        fits->close();
+        delete fits;
+        remove(TestFileName);
+    }
+
+    TEST(HduIndexOfAnotherVersion)
+    {
+        auto fits = createTestFile(4, 3, 2);
+        auto indexFileName = FitsFile::hduIndexFileNameFor(TestFileName);
+        CHECK(fits->saveHduIndex(indexFileName));
+        fits->close();
+        delete fits;
+
+        // A file rewritten with the same size has another modification time.
+        FitsHduIndex index;
+        struct stat fileStatus;
+        CHECK_EQUAL(stat(TestFileName, &fileStatus), 0);
+        CHECK(FitsFile::loadHduIndex(indexFileName, fileStatus.st_size, fileStatus.st_mtime, index));
+        CHECK_EQUAL(index.size(), 1u);
+        CHECK(!FitsFile::loadHduIndex(indexFileName, fileStatus.st_size, fileStatus.st_mtime + 1, index));
+        remove(indexFileName.c_str());
+        remove(TestFileName);
+    }
+
+    TEST(StreamedRowBlocks)
+    {
+        auto fits = createTestFile(5, 4, 3, FitsAccessMode::Streamed);
+        CHECK(fits->isStreamed());
+
+        // Every row of the region is visited once, in order.
+        int nextSlice = 1;
+        int nextRow = 1;
+        bool matches = true;
+        fits->readRowBlocks(SliceRange(1, 3), SliceRange(1, 2), SliceRange(1, 2), [&](const char *rows, int slice, int firstRow, int rowCount) {
+            auto values = reinterpret_cast<const float*> (rows);
+            for(int row = 0; row < rowCount; ++row)
+            {
+                matches = matches && slice == nextSlice && firstRow + row == nextRow;
+                for(int column = 0; column < 3; ++column)
+                    matches = matches && swapBytes<float> (values[row*5 + column]) == float(slice*20 + (firstRow + row)*5 + column + 1);
+
+                if(++nextRow == 3)
+                {
+                    nextRow = 1;
+                    ++nextSlice;
+                }
+            }
+        });
+
+        CHECK(matches);
+        CHECK_EQUAL(nextSlice, 3);
+        fits->close();
+        delete fits;
+        remove(TestFileName);
+    }
+
+    TEST(VirtualCubeFromSlices)
+    {
+        // Two 3x2 slice files, with the slice index in every value.
+        std::vector<std::string> sliceFileNames;
+        for(int slice = 0; slice < 2; ++slice)
+        {
+            sliceFileNames.push_back("SVRTests_FitsFile_slice" + std::to_string(slice) + ".fits");
+            auto sliceFile = createTestFits(sliceFileNames.back().c_str(), FitsFormat::UInt8, {3, 2}, [&](size_t i) {
+                return double(slice*10 + i);
+            });
+            sliceFile->close();
+            delete sliceFile;
+        }
+
+        auto fits = FitsFile::openSlices(sliceFileNames);
+        CHECK(fits->isVirtual());
+        CHECK_EQUAL(fits->getDepth(), 2u);
+        CHECK_EQUAL(fits->getNumberOfElements(), 12u);
+
+        std::vector<int> values;
+        fits->readRowBlocks(SliceRange(1, 2), SliceRange(1, 1), SliceRange(0, 2), [&](const char *rows, int, int, int) {
+            values.push_back(rows[0]);
+            values.push_back(rows[1]);
+        });
+
+        CHECK_EQUAL(values.size(), 4u);
+        CHECK(values == std::vector<int>({4, 5, 14, 15}));
+        delete fits;
+        for(auto &sliceFileName : sliceFileNames)
+            remove(sliceFileName.c_str());
+    }
+
+    const char *CompressedFileName = "SVRTests_FitsFile_compressed.fits";
+
+    /**
+     * A compressed tile, with the quantization of its floating point values.
+     */
+    struct TestTile
+    {
+        TestTile()
+            : scale(1.0), zero(0.0) {}
+
+        std::vector<uint8_t> data;
+        double scale;
+        double zero;
+    };
+
+    struct BitWriter
+    {
+        BitWriter()
+            : usedBits(0) {}
+
+        void write(uint64_t value, int bitCount)
+        {
+            for(int i = bitCount - 1; i >= 0; --i)
+            {
+                if(usedBits == 0)
+                    bytes.push_back(0);
+                bytes.back() |= uint8_t(((value >> i) & 1) << (7 - usedBits));
+                usedBits = (usedBits + 1) % 8;
+            }
+        }
+
+        std::vector<uint8_t> bytes;
+        int usedBits;
+    };
+
+    int bitLength(uint64_t value)
+    {
+        int result = 0;
+        for(; value; value >>= 1)
+            ++result;
+        return result;
+    }
+
+    /**
+     * Rice encoder with the block layout of fpack. Blocks without differences
+     * are constant, and blocks with large differences store them directly.
+     */
+    std::vector<uint8_t> riceEncode(const std::vector<int32_t> &values, int valueBits, int fsBits, int fsMax)
+    {
+        const size_t BlockSize = 32;
+        uint64_t mask = (uint64_t(1) << valueBits) - 1;
+        int64_t half = int64_t(1) << (valueBits - 1);
+
+        BitWriter writer;
+        writer.write(uint64_t(values[0]) & mask, valueBits);
+        int64_t lastValue = values[0];
+        for(size_t blockStart = 0; blockStart < values.size(); blockStart += BlockSize)
+        {
+            std::vector<uint64_t> mapped;
+            uint64_t maxMapped = 0;
+            for(size_t i = blockStart; i < std::min(blockStart + BlockSize, values.size()); ++i)
+            {
+                int64_t difference = ((values[i] - lastValue + half) & mask) - half;
+                lastValue = values[i];
+                mapped.push_back(difference < 0 ? ~(uint64_t(difference) << 1) & mask : uint64_t(difference) << 1);
+                maxMapped = std::max(maxMapped, mapped.back());
+            }
+
+            int fs = std::max(bitLength(maxMapped) - 2, 0);
+            if(maxMapped == 0)
+            {
+                writer.write(0, fsBits);
+            }
+            else if(fs >= fsMax)
+            {
+                writer.write(fsMax + 1, fsBits);
+                for(auto value : mapped)
+                    writer.write(value, valueBits);
+            }
+            else
+            {
+                writer.write(fs + 1, fsBits);
+                for(auto value : mapped)
+                {
+                    writer.write(0, int(value >> fs));
+                    writer.write(1, 1);
+                    writer.write(value & ((uint64_t(1) << fs) - 1), fs);
+                }
+            }
+        }
+
+        return writer.bytes;
+    }
+
+    std::vector<uint8_t> gzipCompress(const std::vector<uint8_t> &data)
+    {
+        uLongf compressedSize = compressBound(uLong(data.size()));
+        std::vector<uint8_t> result(compressedSize);
+        compress(&result[0], &compressedSize, &data[0], uLong(data.size()));
+        result.resize(compressedSize);
+        return result;
+    }
+
+    /**
+     * The values of each tile, with the tiles and their values along x first.
+     */
+    template<typename T>
+    std::vector<std::vector<T>> splitTiles(const std::vector<T> &values, int width, int height, int depth, int tileWidth, int tileHeight, int tileDepth)
+    {
+        std::vector<std::vector<T>> tiles;
+        for(int tz = 0; tz < depth; tz += tileDepth)
+        {
+            for(int ty = 0; ty < height; ty += tileHeight)
+            {
+                for(int tx = 0; tx < width; tx += tileWidth)
+                {
+                    tiles.push_back(std::vector<T> ());
+                    for(int z = tz; z < std::min(tz + tileDepth, depth); ++z)
+                    {
+                        for(int y = ty; y < std::min(ty + tileHeight, height); ++y)
+                        {
+                            for(int x = tx; x < std::min(tx + tileWidth, width); ++x)
+                                tiles.back().push_back(values[(z*height + y)*width + x]);
+                        }
+                    }
+                }
+            }
+        }
+
+        return tiles;
+    }
+
+    void addCard(std::string &header, const char *key, const std::string &value)
+    {
+        char card[81];
+        snprintf(card, sizeof(card), "%-8s= %-70s", key, value.c_str());
+        header += card;
+    }
+
+    void padBlock(std::string &data, char padding)
+    {
+        data.append((2880 - data.size() % 2880) % 2880, padding);
+    }
+
+    /**
+     * Writes a tile compressed image after an empty primary HDU. The keywords
+     * describe the image, and the table has the ZSCALE and ZZERO columns when
+     * the image is quantized.
+     */
+    void writeCompressedFile(const std::vector<std::pair<std::string, std::string>> &keywords, const std::vector<TestTile> &tiles, bool quantized)
+    {
+        std::string table;
+        std::string heap;
+        size_t maxTileSize = 0;
+        for(auto &tile : tiles)
+        {
+            char row[24];
+            int32_t descriptor[2] = {swapBytes<int32_t> (int32_t(tile.data.size())), swapBytes<int32_t> (int32_t(heap.size()))};
+            double scaling[2] = {swapBytes<double> (tile.scale), swapBytes<double> (tile.zero)};
+            memcpy(row, descriptor, sizeof(descriptor));
+            memcpy(row + 8, scaling, sizeof(scaling));
+            table.append(row, quantized ? 24 : 8);
+            heap.append(tile.data.begin(), tile.data.end());
+            maxTileSize = std::max(maxTileSize, tile.data.size());
+        }
+
+        std::string primary;
+        addCard(primary, "SIMPLE", "T");
+        addCard(primary, "BITPIX", "8");
+        addCard(primary, "NAXIS", "0");
+        addCard(primary, "EXTEND", "T");
+        primary += std::string("END").append(77, ' ');
+        padBlock(primary, ' ');
+
+        std::string header;
+        addCard(header, "XTENSION", "'BINTABLE'");
+        addCard(header, "BITPIX", "8");
+        addCard(header, "NAXIS", "2");
+        addCard(header, "NAXIS1", std::to_string(quantized ? 24 : 8));
+        addCard(header, "NAXIS2", std::to_string(tiles.size()));
+        addCard(header, "PCOUNT", std::to_string(heap.size()));
+        addCard(header, "GCOUNT", "1");
+        addCard(header, "TFIELDS", quantized ? "3" : "1");
+        addCard(header, "TTYPE1", "'COMPRESSED_DATA'");
+        addCard(header, "TFORM1", "'1PB(" + std::to_string(maxTileSize) + ")'");
+        if(quantized)
+        {
+            addCard(header, "TTYPE2", "'ZSCALE'");
+            addCard(header, "TFORM2", "'1D'");
+            addCard(header, "TTYPE3", "'ZZERO'");
+            addCard(header, "TFORM3", "'1D'");
+        }
+        addCard(header, "ZIMAGE", "T");
+        for(auto &keyword : keywords)
+            addCard(header, keyword.first.c_str(), keyword.second);
+        header += std::string("END").append(77, ' ');
+        padBlock(header, ' ');
+
+        std::string data = table + heap;
+        padBlock(data, '\0');
+
+        auto file = fopen(CompressedFileName, "wb");
+        fwrite(primary.data(), 1, primary.size(), file);
+        fwrite(header.data(), 1, header.size(), file);
+        fwrite(data.data(), 1, data.size(), file);
+        fclose(file);
+    }
+
+    /**
+     * A 7x5x3 int16 image in 4x2x2 tiles, with a constant tile, small
+     * differences in the first slice and large ones in the others.
+     */
+    const int ImageWidth = 7;
+    const int ImageHeight = 5;
+    const int ImageDepth = 3;
+
+    std::vector<int16_t> createTestImage()
+    {
+        std::vector<int16_t> values;
+        for(int z = 0; z < ImageDepth; ++z)
+        {
+            for(int y = 0; y < ImageHeight; ++y)
+            {
+                for(int x = 0; x < ImageWidth; ++x)
+                {
+                    if(x < 4 && y < 2 && z < 2)
+                        values.push_back(-500);
+                    else if(z == 0)
+                        values.push_back(int16_t(x + y*3));
+                    else
+                        values.push_back(int16_t((x*7919 + y*104729 + z*31) % 60000 - 30000));
+                }
+            }
+        }
+
+        return values;
+    }
+
+    std::vector<std::pair<std::string, std::string>> imageKeywords(const char *bitpix, const char *compression, int tileWidth, int tileHeight, int tileDepth)
+    {
+        return {
+            {"ZBITPIX", bitpix}, {"ZNAXIS", "3"},
+            {"ZNAXIS1", std::to_string(ImageWidth)}, {"ZNAXIS2", std::to_string(ImageHeight)}, {"ZNAXIS3", std::to_string(ImageDepth)},
+            {"ZTILE1", std::to_string(tileWidth)}, {"ZTILE2", std::to_string(tileHeight)}, {"ZTILE3", std::to_string(tileDepth)},
+            {"ZCMPTYPE", compression},
+        };
+    }
+
+    void writeRiceImage(const std::vector<int16_t> &values)
+    {
+        std::vector<TestTile> tiles;
+        for(auto &tileValues : splitTiles(values, ImageWidth, ImageHeight, ImageDepth, 4, 2, 2))
+        {
+            tiles.push_back(TestTile());
+            tiles.back().data = riceEncode(std::vector<int32_t> (tileValues.begin(), tileValues.end()), 16, 4, 14);
+        }
+
+        auto keywords = imageKeywords("16", "'RICE_1'", 4, 2, 2);
+        keywords.push_back({"ZNAME1", "'BLOCKSIZE'"});
+        keywords.push_back({"ZVAL1", "32"});
+        keywords.push_back({"ZNAME2", "'BYTEPIX'"});
+        keywords.push_back({"ZVAL2", "2"});
+        writeCompressedFile(keywords, tiles, false);
+    }
+
+    TEST(RiceTiles)
+    {
+        auto values = createTestImage();
+        writeRiceImage(values);
+
+        auto fits = FitsFile::open(CompressedFileName);
+        CHECK(fits);
+        CHECK(fits->getFormat() == FitsFormat::Int16);
+        CHECK_EQUAL(fits->getWidth(), size_t(ImageWidth));
+        CHECK_EQUAL(fits->getDepth(), size_t(ImageDepth));
+
+        auto data = reinterpret_cast<const int16_t*> (fits->getImageData());
+        int mismatches = 0;
+        for(size_t i = 0; i < values.size(); ++i)
+            mismatches += swapBytes<int16_t> (data[i]) != values[i];
+        CHECK_EQUAL(mismatches, 0);
+        fits->close();
+        delete fits;
+        remove(CompressedFileName);
+    }
+
+    TEST(ShuffledGzipTiles)
+    {
+        // GZIP_2 stores the most significant bytes of all the values first.
+        auto values = createTestImage();
+        std::vector<TestTile> tiles;
+        for(auto &tileValues : splitTiles(values, ImageWidth, ImageHeight, ImageDepth, 4, 2, 2))
+        {
+            std::vector<uint8_t> shuffled(tileValues.size()*2);
+            for(size_t i = 0; i < tileValues.size(); ++i)
+            {
+                shuffled[i] = uint8_t(uint16_t(tileValues[i]) >> 8);
+                shuffled[tileValues.size() + i] = uint8_t(tileValues[i]);
+            }
+
+            tiles.push_back(TestTile());
+            tiles.back().data = gzipCompress(shuffled);
+        }
+        writeCompressedFile(imageKeywords("16", "'GZIP_2'", 4, 2, 2), tiles, false);
+
+        auto fits = FitsFile::open(CompressedFileName);
+        CHECK(fits);
+        auto data = reinterpret_cast<const int16_t*> (fits->getImageData());
+        int mismatches = 0;
+        for(size_t i = 0; i < values.size(); ++i)
+            mismatches += swapBytes<int16_t> (data[i]) != values[i];
+        CHECK_EQUAL(mismatches, 0);
+        fits->close();
+        delete fits;
+        remove(CompressedFileName);
+    }
+
+    TEST(DitheredFloatTiles)
+    {
+        // The dithering sequence of the tiled image convention.
+        std::vector<float> randomValues(10000);
+        double seed = 1.0;
+        for(auto &randomValue : randomValues)
+        {
+            double temp = 16807.0*seed;
+            seed = temp - 2147483647.0*int(temp/2147483647.0);
+            randomValue = float(seed/2147483647.0);
+        }
+
+        const int32_t Blank = -2147483647;
+        std::vector<float> values;
+        for(int i = 0; i < ImageWidth*ImageHeight*ImageDepth; ++i)
+            values.push_back(i == 5 ? NAN : float(sin(i*0.37)*100.0 + i));
+
+        // Each tile is quantized in a thousand steps of its range.
+        std::vector<TestTile> tiles;
+        auto tileValues = splitTiles(values, ImageWidth, ImageHeight, ImageDepth, ImageWidth, 2, 1);
+        for(size_t tileIndex = 0; tileIndex < tileValues.size(); ++tileIndex)
+        {
+            TestTile tile;
+            float minValue = INFINITY;
+            float maxValue = -INFINITY;
+            for(auto value : tileValues[tileIndex])
+            {
+                if(isnan(value))
+                    continue;
+                minValue = std::min(minValue, value);
+                maxValue = std::max(maxValue, value);
+            }
+            tile.scale = (maxValue - minValue) / 1000.0;
+            tile.zero = minValue;
+
+            // The sequence starts at the tile index, with ZDITHER0 = 1.
+            std::vector<int32_t> quantized;
+            int randomSeed = int(tileIndex);
+            int nextRandom = int(randomValues[randomSeed]*500);
+            for(auto value : tileValues[tileIndex])
+            {
+                if(isnan(value))
+                    quantized.push_back(Blank);
+                else
+                    quantized.push_back(int32_t(lround((value - tile.zero) / tile.scale + randomValues[nextRandom] - 0.5)));
+                ++nextRandom;
+            }
+
+            tile.data = riceEncode(quantized, 32, 5, 25);
+            tiles.push_back(tile);
+        }
+
+        auto keywords = imageKeywords("-32", "'RICE_1'", ImageWidth, 2, 1);
+        keywords.push_back({"ZNAME1", "'BLOCKSIZE'"});
+        keywords.push_back({"ZVAL1", "32"});
+        keywords.push_back({"ZNAME2", "'BYTEPIX'"});
+        keywords.push_back({"ZVAL2", "4"});
+        keywords.push_back({"ZQUANTIZ", "'SUBTRACTIVE_DITHER_1'"});
+        keywords.push_back({"ZDITHER0", "1"});
+        keywords.push_back({"ZBLANK", std::to_string(Blank)});
+        writeCompressedFile(keywords, tiles, true);
+
+        auto fits = FitsFile::open(CompressedFileName);
+        CHECK(fits);
+        CHECK(fits->getFormat() == FitsFormat::Float);
+        auto data = reinterpret_cast<const float*> (fits->getImageData());
+        CHECK(isnan(swapBytes<float> (data[5])));
+
+        // The dithered values are within half a quantization step.
+        int mismatches = 0;
+        for(int z = 0; z < ImageDepth; ++z)
+        {
+            for(int y = 0; y < ImageHeight; ++y)
+            {
+                for(int x = 0; x < ImageWidth; ++x)
+                {
+                    auto i = (z*ImageHeight + y)*ImageWidth + x;
+                    auto &tile = tiles[z*((ImageHeight + 1) / 2) + y / 2];
+                    if(i != 5)
+                        mismatches += fabs(swapBytes<float> (data[i]) - values[i]) > 0.51*tile.scale;
+                }
+            }
+        }
+        CHECK_EQUAL(mismatches, 0);
+        fits->close();
+        delete fits;
+        remove(CompressedFileName);
+    }
+
+    TEST(RegionAcrossTiles)
+    {
+        auto values = createTestImage();
+        writeRiceImage(values);
+
+        // The region covers parts of eight tiles.
+        auto fits = FitsFile::open(CompressedFileName);
+        auto region = reinterpret_cast<const int16_t*> (fits->mapRegion(SliceRange(2, 4), SliceRange(1, 3), SliceRange(1, 2)));
+        CHECK(region);
+
+        int mismatches = 0;
+        for(int z = 0; z < 2; ++z)
+        {
+            for(int y = 0; y < 3; ++y)
+            {
+                for(int x = 0; x < 4; ++x)
+                {
+                    auto value = region[(z*ImageHeight + y)*ImageWidth + x];
+                    mismatches += swapBytes<int16_t> (value) != values[((z + 1)*ImageHeight + y + 1)*ImageWidth + x + 2];
+                }
+            }
+        }
+        CHECK_EQUAL(mismatches, 0);
+        fits->close();
+        delete fits;
+        remove(CompressedFileName);
+    }
+}
@@ -0,0 +1,124 @@
+#include <UnitTest++.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "SVR/AstronomyMappings.hpp"
+#include "SVR/SimdKernels.hpp"
+#include "SVR/Endianness.hpp"
+#include "TestFits.hpp"
+
+using namespace SVR;
+
+SUITE(SimdKernels)
+{
+    bool sameValues(const std::vector<float> &a, const std::vector<float> &b)
+    {
+        for(size_t i = 0; i < a.size(); ++i)
+        {
+            if(isnan(a[i]) != isnan(b[i]) || (!isnan(a[i]) && a[i] != b[i]))
+                return false;
+        }
+
+        return true;
+    }
+
+    TEST(MatchScalarKernels)
+    {
+        // 37 elements, so the vector kernels also have a partial block.
+        const size_t count = 37;
+        FitsHeaderKeywords keywords;
+        keywords.bscale = 0.5;
+        keywords.bzero = -3.0;
+        keywords.hasBlank = true;
+        keywords.blank = -7;
+        PhysicalConversion conversion(keywords, true);
+
+        std::vector<int16_t> raw(count);
+        for(size_t i = 0; i < count; ++i)
+            raw[i] = swapBytes<int16_t> (i % 5 == 0 ? -7 : int16_t(i*331 - 6000));
+
+        auto &scalar = *getSimdKernels(SimdLevel::Scalar);
+        std::vector<float> expected(count);
+        scalar.convertInt16(raw.data(), expected.data(), count, conversion);
+        CHECK(isnan(expected[0]));
+        CHECK_EQUAL(expected[1], (331.0f - 6000.0f)*0.5f - 3.0f);
+
+        float expectedMin = NAN, expectedMax = NAN;
+        scalar.computeRange(expected.data(), count, expectedMin, expectedMax);
+        std::vector<uint8_t> expectedMapped(count);
+        scalar.scaleToUInt8(expected.data(), count, 0.1f, expectedMapped.data());
+        CHECK_EQUAL(expectedMapped[0], 0);
+        CHECK_EQUAL(expectedMapped[count - 1], 255);
+
+        for(int level = int(SimdLevel::SSE41); level <= int(SimdLevel::AVX512); ++level)
+        {
+            auto kernels = getSimdKernels(SimdLevel(level));
+            if(!kernels)
+                continue;
+
+            std::vector<float> values(count);
+            kernels->convertInt16(raw.data(), values.data(), count, conversion);
+            CHECK(sameValues(values, expected));
+
+            float minValue = NAN, maxValue = NAN;
+            kernels->computeRange(values.data(), count, minValue, maxValue);
+            CHECK_EQUAL(minValue, expectedMin);
+            CHECK_EQUAL(maxValue, expectedMax);
+
+            std::vector<uint8_t> mapped(count);
+            kernels->scaleToUInt8(values.data(), count, 0.1f, mapped.data());
+            CHECK(mapped == expectedMapped);
+        }
+    }
+
+    TEST(ScaledRangeInDoublePrecision)
+    {
+        // A BSCALE and a BZERO that are not exact in single precision.
+        const char *TestFileName = "SVRTests_SimdKernels.fits";
+        const int width = 37, height = 3;
+        auto fits = createTestFits(TestFileName, FitsFormat::Int16, {width, height}, [](size_t i) {
+            return double(int(i)*541 - 29999);
+        }, {{"BSCALE", "0.1"}, {"BZERO", "3.3"}});
+        SliceRange x(0, width), y(0, height), z(0, 1);
+        PhysicalMapping physical;
+        std::vector<float> physicalValues(width*height);
+        mapFitsInto(physical, fits, physicalValues.data(), x, y, z);
+        CHECK_EQUAL(physical.minValue, -29999*0.1 + 3.3);
+        CHECK_EQUAL(physical.maxValue, ((width*height - 1)*541 - 29999)*0.1 + 3.3);
+
+        // The mapping is set up with the same range.
+        LinearMapping linear;
+        std::vector<uint8_t> mapped(width*height);
+        mapFitsInto(linear, fits, mapped.data(), x, y, z);
+        CHECK_EQUAL(linear.minValue, physical.minValue);
+        CHECK_EQUAL(linear.maxValue, physical.maxValue);
+        fits->close();
+        delete fits;
+        remove(TestFileName);
+    }
+
+    TEST(ScaledTableMatchesScalarPath)
+    {
+        // Unsigned 16 bit data with a BSCALE, and more elements than the mapping table.
+        const char *TestFileName = "SVRTests_SimdKernels.fits";
+        const int width = 64, height = 32, depth = 33;
+        auto fits = createTestFits(TestFileName, FitsFormat::Int16, {width, height, depth}, [](size_t i) {
+            return i % 97 == 0 ? -32768.0 : double(int(i*7 % 65535) - 32767);
+        }, {{"BSCALE", "0.3"}, {"BZERO", "32768"}, {"BLANK", "-32768"}});
+        SliceRange x(0, width), y(0, height), z(0, depth);
+        LogMapping table;
+        std::vector<uint16_t> tableMapped(width*height*depth);
+        mapFitsInto(table, fits, tableMapped.data(), x, y, z);
+
+        LogMapping scalar;
+        std::vector<uint16_t> scalarMapped(width*height*depth);
+        detail::mapPhysicalFromTypeInto<int16_t, true> (detail::PhysicalValue<int16_t, true, true> (fits->getKeywords()), scalar, fits, scalarMapped.data(), x, y, z, nullptr);
+        CHECK_EQUAL(table.minValue, scalar.minValue);
+        CHECK_EQUAL(table.maxValue, scalar.maxValue);
+        CHECK(tableMapped == scalarMapped);
+        fits->close();
+        delete fits;
+        remove(TestFileName);
+    }
+}
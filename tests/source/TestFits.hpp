@@ -0,0 +1,78 @@
+#ifndef _SVR_TESTS_TEST_FITS_HPP_
+#define _SVR_TESTS_TEST_FITS_HPP_
+
+#include <stdlib.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "SVR/FitsFile.hpp"
+#include "SVR/Endianness.hpp"
+
+namespace SVR
+{
+
+typedef std::function<double (size_t)> TestFitsFill;
+
+template<typename T>
+inline void fillTestFitsData(char *data, size_t elementCount, const TestFitsFill &fill)
+{
+    auto values = reinterpret_cast<T*> (data);
+    for(size_t i = 0; i < elementCount; ++i)
+        values[i] = swapBytes<T> (T(fill(i)));
+}
+
+/**
+ * Creates a FITS image for the tests, and opens it again. The fill function
+ * gives the raw value of each element, in the order of the image, and the
+ * extra properties, such as BSCALE and BZERO, are added to the header.
+ */
+inline FitsFile *createTestFits(const char *fileName, FitsFormat format, const std::vector<size_t> &axes, const TestFitsFill &fill,
+    const FitsHeaderProperties &extraProperties=FitsHeaderProperties(), FitsAccessMode accessMode=FitsAccessMode::Mapped)
+{
+    FitsHeaderProperties properties = extraProperties;
+    properties["SIMPLE"] = "T";
+    properties["BITPIX"] = std::to_string(int(format));
+    properties["NAXIS"] = std::to_string(axes.size());
+
+    size_t elementCount = 1;
+    for(size_t i = 0; i < axes.size(); ++i)
+    {
+        properties["NAXIS" + std::to_string(i + 1)] = std::to_string(axes[i]);
+        elementCount *= axes[i];
+    }
+
+    auto created = FitsFile::create(fileName, properties, elementCount*abs(int(format))/8);
+    if(!created)
+        return nullptr;
+
+    auto data = created->getImageData();
+    switch(format)
+    {
+    case FitsFormat::UInt8:
+        fillTestFitsData<uint8_t> (data, elementCount, fill);
+        break;
+    case FitsFormat::Int16:
+        fillTestFitsData<int16_t> (data, elementCount, fill);
+        break;
+    case FitsFormat::Int32:
+        fillTestFitsData<int32_t> (data, elementCount, fill);
+        break;
+    case FitsFormat::Int64:
+        fillTestFitsData<int64_t> (data, elementCount, fill);
+        break;
+    case FitsFormat::Float:
+        fillTestFitsData<float> (data, elementCount, fill);
+        break;
+    case FitsFormat::Double:
+        fillTestFitsData<double> (data, elementCount, fill);
+        break;
+    }
+    created->close();
+    delete created;
+
+    return FitsFile::open(fileName, false, accessMode);
+}
+
+} // namespace SVR
+
+#endif //_SVR_TESTS_TEST_FITS_HPP_
@@ -0,0 +1,35 @@
+#include <UnitTest++.h>
+#include <atomic>
+#include <vector>
+#include "SVR/ThreadPool.hpp"
+
+using namespace SVR;
+
+SUITE(ThreadPool)
+{
+    TEST(ParallelForVisitsAllIndices)
+    {
+        ThreadPool pool(4);
+        std::vector<int> visited(1000, 0);
+        pool.parallelFor(visited.size(), [&](size_t i) {
+            ++visited[i];
+        });
+
+        for(auto count : visited)
+            CHECK_EQUAL(count, 1);
+    }
+
+    TEST(NestedParallelFor)
+    {
+        ThreadPool pool(2);
+        std::atomic<int> total(0);
+        pool.parallelFor(8, [&](size_t) {
+            pool.parallelFor(8, [&](size_t) {
+                ++total;
+            });
+        });
+
+        CHECK_EQUAL(total.load(), 64);
+    }
+
+}